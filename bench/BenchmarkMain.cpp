@@ -0,0 +1,416 @@
+#include "DirectoryCache.h"
+#include "DirectoryReader.h"
+#include "DirectoryTreeBuilder.h"
+#include "SyntheticTree.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+// Every allocation made through the global operator new is counted, so each result carries the
+// number of heap allocations and bytes requested by one BuildTree call.
+namespace {
+std::atomic<uint64_t> g_allocationCount{0};
+std::atomic<uint64_t> g_allocatedBytes{0};
+}
+
+void* operator new(std::size_t size) {
+    g_allocationCount.fetch_add(1, std::memory_order_relaxed);
+    g_allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* block = std::malloc(size ? size : 1)) {
+        return block;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* block) noexcept {
+    std::free(block);
+}
+
+void operator delete(void* block, std::size_t) noexcept {
+    std::free(block);
+}
+
+namespace {
+constexpr int kDepths[] = {-1, 3};
+constexpr TreeFormat kFormats[] = {TreeFormat::TEXT, TreeFormat::JSON, TreeFormat::XML};
+// DirectoryCache does not keep directories modified within the last two seconds.
+constexpr std::chrono::milliseconds kCacheSettleDelay(2500);
+
+// None builds without a cache, Cold starts every run with an empty one, Warm reuses a cache
+// filled by an untimed build.
+enum class CacheMode {
+    None,
+    Cold,
+    Warm
+};
+
+constexpr char kUsage[] =
+    "Usage: dirtree_bench [options]\n"
+    "\n"
+    "Generates synthetic trees, times DirectoryTreeBuilder::BuildTree on them and counts the stat\n"
+    "calls it makes. Results are written to stdout as JSON lines, progress to stderr.\n"
+    "\n"
+    "Options:\n"
+    "  --dir PATH     where to generate the trees (default: a new directory in the temp dir)\n"
+    "  --shape NAME   only this shape: wide-flat, deep-narrow, mixed, symlink-heavy, unicode\n"
+    "  --scale N      multiply the size of every tree by N (default 1)\n"
+    "  --repeat N     timed runs per case (default 3)\n"
+    "  --threads N    traversal worker threads, 0 = hardware concurrency (default 0)\n"
+    "  --keep         keep the generated trees\n"
+    "  -h, --help     show this help\n";
+
+struct BenchOptions {
+    std::filesystem::path directory;
+    bool hasShape = false;
+    SyntheticTreeGenerator::Shape shape = SyntheticTreeGenerator::Shape::Mixed;
+    size_t scale = 1;
+    size_t repeat = 3;
+    size_t threads = 0;
+    bool keep = false;
+};
+
+const char* CacheModeName(CacheMode mode) {
+    switch (mode) {
+    case CacheMode::Cold:
+        return "cold";
+    case CacheMode::Warm:
+        return "warm";
+    case CacheMode::None:
+    default:
+        return "none";
+    }
+}
+
+const char* FormatName(TreeFormat format) {
+    switch (format) {
+    case TreeFormat::JSON:
+        return "json";
+    case TreeFormat::XML:
+        return "xml";
+    case TreeFormat::TEXT:
+    default:
+        return "text";
+    }
+}
+
+// Peak resident set size in KiB. On Linux the high-water mark is reset before every case, so
+// the value belongs to that case alone; elsewhere it is the process-wide peak so far.
+const char* PeakRssScope() {
+#ifdef __linux__
+    return "case";
+#else
+    return "process";
+#endif
+}
+
+void ResetPeakRss() {
+#ifdef __linux__
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5";
+#endif
+}
+
+uint64_t ReadPeakRssKb() {
+#if defined(__linux__)
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return std::strtoull(line.c_str() + 6, nullptr, 10);
+        }
+    }
+    return 0;
+#elif defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters{};
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize / 1024;
+    }
+    return 0;
+#else
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return static_cast<uint64_t>(usage.ru_maxrss) / 1024;
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss);
+#endif
+#endif
+}
+
+// Number of nodes in a rendered tree, not counting the root. Names are escaped in JSON and XML,
+// so the markers below cannot occur inside a name; generated names never contain line breaks.
+uint64_t CountEntries(const std::wstring& content, TreeFormat format) {
+    const wchar_t* marker = format == TreeFormat::JSON ? L"\"name\": \"" : format == TreeFormat::XML ? L" name=\"" : L"\n";
+    const size_t markerLength = std::wcslen(marker);
+    uint64_t count = 0;
+    for (size_t position = content.find(marker); position != std::wstring::npos; position = content.find(marker, position + markerLength)) {
+        ++count;
+    }
+    return count > 0 ? count - 1 : 0;
+}
+
+std::string JsonString(const std::string& text) {
+    std::string quoted = "\"";
+    for (char ch : text) {
+        if (ch == '"' || ch == '\\') {
+            quoted += '\\';
+        }
+        quoted += ch;
+    }
+    quoted += '"';
+    return quoted;
+}
+
+bool ParseCount(const char* text, size_t& value) {
+    char* end = nullptr;
+    const unsigned long long parsed = std::strtoull(text, &end, 10);
+    if (end == text || *end != '\0') {
+        return false;
+    }
+    value = static_cast<size_t>(parsed);
+    return true;
+}
+
+bool ParseArguments(int argc, char* argv[], BenchOptions& options, bool& showHelp) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "-h" || arg == "--help") {
+            showHelp = true;
+            return true;
+        } else if (arg == "--keep") {
+            options.keep = true;
+        } else if (arg == "--dir" && hasValue) {
+            options.directory = std::filesystem::u8path(argv[++i]);
+        } else if (arg == "--shape" && hasValue) {
+            if (!SyntheticTreeGenerator::ParseShape(argv[++i], options.shape)) {
+                std::fprintf(stderr, "dirtree_bench: unknown shape %s\n", argv[i]);
+                return false;
+            }
+            options.hasShape = true;
+        } else if (arg == "--scale" && hasValue) {
+            if (!ParseCount(argv[++i], options.scale) || options.scale == 0) {
+                std::fprintf(stderr, "dirtree_bench: invalid scale %s\n", argv[i]);
+                return false;
+            }
+        } else if (arg == "--repeat" && hasValue) {
+            if (!ParseCount(argv[++i], options.repeat) || options.repeat == 0) {
+                std::fprintf(stderr, "dirtree_bench: invalid repeat count %s\n", argv[i]);
+                return false;
+            }
+        } else if (arg == "--threads" && hasValue) {
+            if (!ParseCount(argv[++i], options.threads)) {
+                std::fprintf(stderr, "dirtree_bench: invalid thread count %s\n", argv[i]);
+                return false;
+            }
+        } else {
+            std::fprintf(stderr, "dirtree_bench: unexpected argument %s\n", arg.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+std::filesystem::path DefaultBenchDirectory() {
+    std::error_code ec;
+    std::filesystem::path base = std::filesystem::temp_directory_path(ec);
+    if (ec) {
+        base = std::filesystem::current_path();
+    }
+#ifdef _WIN32
+    const unsigned long processId = GetCurrentProcessId();
+#else
+    const unsigned long processId = static_cast<unsigned long>(getpid());
+#endif
+    return base / ("dirtree-bench-" + std::to_string(processId));
+}
+
+bool RunCase(DirectoryTreeBuilder& builder, const BenchOptions& options, SyntheticTreeGenerator::Shape shape,
+             const std::filesystem::path& root, TreeFormat format, int depth, bool expandSymlinks,
+             CacheMode cacheMode = CacheMode::None) {
+    const std::wstring rootPath = FromNativePath(root);
+    std::vector<double> seconds;
+    uint64_t entries = 0;
+    uint64_t allocations = 0;
+    uint64_t allocatedBytes = 0;
+
+    DirectoryCache cache;
+    if (cacheMode != CacheMode::None) {
+        builder.SetDirectoryCache(&cache);
+    }
+    if (cacheMode == CacheMode::Warm) {
+        builder.BuildTree(rootPath, depth, format, expandSymlinks);
+    }
+
+    ResetPeakRss();
+    for (size_t run = 0; run < options.repeat; ++run) {
+        if (cacheMode == CacheMode::Cold) {
+            cache.Clear();
+        }
+
+        const uint64_t allocationsBefore = g_allocationCount.load();
+        const uint64_t bytesBefore = g_allocatedBytes.load();
+        const auto start = std::chrono::steady_clock::now();
+
+        BuildTreeResult result = builder.BuildTree(rootPath, depth, format, expandSymlinks);
+
+        const auto finish = std::chrono::steady_clock::now();
+        allocations = g_allocationCount.load() - allocationsBefore;
+        allocatedBytes = g_allocatedBytes.load() - bytesBefore;
+        if (!result.success) {
+            std::fprintf(stderr, "dirtree_bench: BuildTree failed on %s\n", root.u8string().c_str());
+            builder.SetDirectoryCache(nullptr);
+            return false;
+        }
+
+        seconds.push_back(std::chrono::duration<double>(finish - start).count());
+        entries = CountEntries(result.content, format);
+    }
+    const uint64_t peakRssKb = ReadPeakRssKb();
+
+    // Metadata queries are counted in one more, untimed build: the recorder's clock reads would
+    // otherwise be part of the timings.
+    TraversalRecorder recorder;
+    if (cacheMode == CacheMode::Cold) {
+        cache.Clear();
+    }
+    builder.SetStatsRecorder(&recorder);
+    builder.BuildTree(rootPath, depth, format, expandSymlinks);
+    builder.SetStatsRecorder(nullptr);
+    builder.SetDirectoryCache(nullptr);
+    const uint64_t statCalls = recorder.Stats().statCalls;
+
+    std::sort(seconds.begin(), seconds.end());
+    const double best = seconds.front();
+    const double median = seconds[seconds.size() / 2];
+    std::printf("{\"type\":\"result\",\"shape\":%s,\"format\":%s,\"depth\":%d,\"expand_symlinks\":%s,"
+                "\"cache\":%s,\"threads\":%zu,\"entries\":%llu,\"runs\":%zu,\"best_seconds\":%.6f,\"median_seconds\":%.6f,"
+                "\"entries_per_sec\":%.0f,\"peak_rss_kb\":%llu,\"peak_rss_scope\":%s,"
+                "\"allocations\":%llu,\"allocated_bytes\":%llu,\"stat_calls\":%llu}\n",
+                JsonString(SyntheticTreeGenerator::ShapeName(shape)).c_str(), JsonString(FormatName(format)).c_str(),
+                depth, expandSymlinks ? "true" : "false", JsonString(CacheModeName(cacheMode)).c_str(), options.threads,
+                static_cast<unsigned long long>(entries), seconds.size(), best, median,
+                best > 0 ? static_cast<double>(entries) / best : 0.0,
+                static_cast<unsigned long long>(peakRssKb), JsonString(PeakRssScope()).c_str(),
+                static_cast<unsigned long long>(allocations), static_cast<unsigned long long>(allocatedBytes),
+                static_cast<unsigned long long>(statCalls));
+    std::fflush(stdout);
+    return true;
+}
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    bool showHelp = false;
+    if (!ParseArguments(argc, argv, options, showHelp)) {
+        std::fputs(kUsage, stderr);
+        return 2;
+    }
+    if (showHelp) {
+        std::fputs(kUsage, stdout);
+        return 0;
+    }
+
+    const bool ownsDirectory = options.directory.empty();
+    if (ownsDirectory) {
+        options.directory = DefaultBenchDirectory();
+    }
+    std::error_code ec;
+    std::filesystem::create_directories(options.directory, ec);
+    if (ec) {
+        std::fprintf(stderr, "dirtree_bench: cannot create %s\n", options.directory.u8string().c_str());
+        return 1;
+    }
+
+    std::vector<SyntheticTreeGenerator::Shape> shapes;
+    if (options.hasShape) {
+        shapes.push_back(options.shape);
+    } else {
+        shapes = {SyntheticTreeGenerator::Shape::WideFlat, SyntheticTreeGenerator::Shape::DeepNarrow,
+                  SyntheticTreeGenerator::Shape::Mixed, SyntheticTreeGenerator::Shape::SymlinkHeavy,
+                  SyntheticTreeGenerator::Shape::Unicode};
+    }
+
+    DirectoryTreeBuilder builder(options.threads);
+    bool ok = true;
+    for (SyntheticTreeGenerator::Shape shape : shapes) {
+        const std::filesystem::path root = options.directory / SyntheticTreeGenerator::ShapeName(shape);
+        std::fprintf(stderr, "generating %s in %s\n", SyntheticTreeGenerator::ShapeName(shape), root.u8string().c_str());
+
+        SyntheticTreeGenerator generator;
+        SyntheticTreeGenerator::Stats stats;
+        std::string error;
+        const auto start = std::chrono::steady_clock::now();
+        if (!generator.Generate(shape, root, options.scale, stats, error)) {
+            std::fprintf(stderr, "dirtree_bench: %s\n", error.c_str());
+            ok = false;
+            break;
+        }
+        const auto generated = std::chrono::steady_clock::now();
+        const double generateSeconds = std::chrono::duration<double>(generated - start).count();
+        std::printf("{\"type\":\"tree\",\"shape\":%s,\"scale\":%zu,\"directories\":%zu,\"files\":%zu,"
+                    "\"symlinks\":%zu,\"failed_symlinks\":%zu,\"generate_seconds\":%.3f}\n",
+                    JsonString(SyntheticTreeGenerator::ShapeName(shape)).c_str(), options.scale,
+                    stats.directories, stats.files, stats.symlinks, stats.failedSymlinks, generateSeconds);
+
+        const bool hasSymlinks = shape == SyntheticTreeGenerator::Shape::SymlinkHeavy;
+        for (int expand = 0; expand <= (hasSymlinks ? 1 : 0) && ok; ++expand) {
+            for (int depth : kDepths) {
+                if (expand != 0 && depth < 0) {
+                    // Links to siblings are not cycles, so a fully expanded symlink-heavy tree
+                    // grows exponentially; only the depth-limited case is measured.
+                    continue;
+                }
+                for (TreeFormat format : kFormats) {
+                    std::fprintf(stderr, "  %s depth=%d symlinks=%d\n", FormatName(format), depth, expand);
+                    if (!RunCase(builder, options, shape, root, format, depth, expand != 0)) {
+                        ok = false;
+                        break;
+                    }
+                }
+            }
+        }
+
+        // Repeat builds of an unchanged tree, with and without a populated listing cache.
+        std::this_thread::sleep_until(generated + kCacheSettleDelay);
+        for (CacheMode cacheMode : {CacheMode::Cold, CacheMode::Warm}) {
+            if (!ok) {
+                break;
+            }
+            std::fprintf(stderr, "  text depth=-1 cache=%s\n", CacheModeName(cacheMode));
+            ok = RunCase(builder, options, shape, root, TreeFormat::TEXT, -1, false, cacheMode);
+        }
+
+        if (!options.keep) {
+            std::filesystem::remove_all(root, ec);
+        }
+        if (!ok) {
+            break;
+        }
+    }
+
+    if (ownsDirectory && !options.keep) {
+        std::filesystem::remove_all(options.directory, ec);
+    }
+    return ok ? 0 : 1;
+}
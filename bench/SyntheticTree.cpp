@@ -0,0 +1,273 @@
+#include "SyntheticTree.h"
+
+#include <cstdio>
+#include <iterator>
+#include <system_error>
+#include <vector>
+
+namespace {
+constexpr const char* kWords[] = {
+    "src", "build", "Docs", "assets", "Test", "README", "config", "Data", "cache", "lib",
+    "module", "Util", "report", "image", "backup", "Notes", "archive", "draft", "export", "Main"
+};
+
+constexpr const char* kExtensions[] = {
+    ".txt", ".cpp", ".h", ".json", ".xml", ".md", ".png", ".jpg", ".log", ".dat", ""
+};
+
+// UTF-8 fragments; a name is assembled from two or three of them.
+constexpr const char* kUnicodeWords[] = {
+    "документ", "Файл", "отчёт", "写真", "データ", "資料", "ελληνικά", "Ærø", "ñandú", "Ünïcödé",
+    "😀", "🚀", "日本語", "한국어", "עברית", "العربية", "Straße", "café", "Ёлка", "emoji✓"
+};
+
+std::filesystem::path FromUtf8(const std::string& name) {
+    return std::filesystem::u8path(name);
+}
+}
+
+SyntheticTreeGenerator::SyntheticTreeGenerator(uint64_t seed)
+    : m_state(seed ? seed : 1)
+    , m_serial(0) {
+}
+
+const char* SyntheticTreeGenerator::ShapeName(Shape shape) {
+    switch (shape) {
+    case Shape::WideFlat:
+        return "wide-flat";
+    case Shape::DeepNarrow:
+        return "deep-narrow";
+    case Shape::Mixed:
+        return "mixed";
+    case Shape::SymlinkHeavy:
+        return "symlink-heavy";
+    case Shape::Unicode:
+    default:
+        return "unicode";
+    }
+}
+
+bool SyntheticTreeGenerator::ParseShape(const std::string& name, Shape& shape) {
+    for (Shape candidate : {Shape::WideFlat, Shape::DeepNarrow, Shape::Mixed, Shape::SymlinkHeavy, Shape::Unicode}) {
+        if (name == ShapeName(candidate)) {
+            shape = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t SyntheticTreeGenerator::Next() {
+    // xorshift64*: tiny, fast and identical on every platform, unlike the std distributions.
+    m_state ^= m_state >> 12;
+    m_state ^= m_state << 25;
+    m_state ^= m_state >> 27;
+    return m_state * 0x2545F4914F6CDD1Dull;
+}
+
+size_t SyntheticTreeGenerator::Uniform(size_t bound) {
+    return bound == 0 ? 0 : static_cast<size_t>(Next() % bound);
+}
+
+std::string SyntheticTreeGenerator::AsciiName(bool isDirectory) {
+    std::string name = kWords[Uniform(std::size(kWords))];
+    if (Uniform(2) == 0) {
+        name += '_';
+        name += kWords[Uniform(std::size(kWords))];
+    }
+    // The serial keeps names unique within a directory.
+    name += '_';
+    name += std::to_string(++m_serial);
+    if (!isDirectory) {
+        name += kExtensions[Uniform(std::size(kExtensions))];
+    }
+    return name;
+}
+
+std::string SyntheticTreeGenerator::UnicodeName(bool isDirectory) {
+    std::string name = kUnicodeWords[Uniform(std::size(kUnicodeWords))];
+    const size_t extraWords = 1 + Uniform(2);
+    for (size_t i = 0; i < extraWords; ++i) {
+        name += Uniform(2) == 0 ? " " : "_";
+        name += kUnicodeWords[Uniform(std::size(kUnicodeWords))];
+    }
+    name += '_';
+    name += std::to_string(++m_serial);
+    if (!isDirectory) {
+        name += kExtensions[Uniform(std::size(kExtensions))];
+    }
+    return name;
+}
+
+bool SyntheticTreeGenerator::MakeFile(const std::filesystem::path& path, Stats& stats) {
+#ifdef _WIN32
+    std::FILE* file = _wfopen(path.c_str(), L"wb");
+#else
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+#endif
+    if (!file) {
+        return false;
+    }
+    std::fclose(file);
+    ++stats.files;
+    return true;
+}
+
+bool SyntheticTreeGenerator::MakeDirectory(const std::filesystem::path& path, Stats& stats) {
+    std::error_code ec;
+    if (!std::filesystem::create_directory(path, ec) || ec) {
+        return false;
+    }
+    ++stats.directories;
+    return true;
+}
+
+void SyntheticTreeGenerator::GrowMixed(const std::filesystem::path& directory, int depth, bool unicodeNames,
+                                       Budget& budget, Stats& stats) {
+    const size_t fileCount = Uniform(25);
+    for (size_t i = 0; i < fileCount && budget.remaining > 0; ++i) {
+        if (MakeFile(directory / FromUtf8(unicodeNames ? UnicodeName(false) : AsciiName(false)), stats)) {
+            --budget.remaining;
+        }
+    }
+
+    if (depth >= 7) {
+        return;
+    }
+
+    // Fan-out shrinks with depth so that the budget is spread over several levels.
+    const size_t directoryCount = depth == 0 ? 8 : Uniform(static_cast<size_t>(7 - depth));
+    for (size_t i = 0; i < directoryCount && budget.remaining > 0; ++i) {
+        const std::filesystem::path child = directory / FromUtf8(unicodeNames ? UnicodeName(true) : AsciiName(true));
+        if (!MakeDirectory(child, stats)) {
+            continue;
+        }
+        --budget.remaining;
+        GrowMixed(child, depth + 1, unicodeNames, budget, stats);
+    }
+}
+
+bool SyntheticTreeGenerator::GrowUntilSpent(const std::filesystem::path& root, bool unicodeNames, Budget& budget,
+                                            Stats& stats, std::string& error) {
+    while (budget.remaining > 0) {
+        const size_t before = budget.remaining;
+        GrowMixed(root, 0, unicodeNames, budget, stats);
+        if (budget.remaining == before) {
+            error = "cannot create entries under " + root.u8string();
+            return false;
+        }
+    }
+    return true;
+}
+
+void SyntheticTreeGenerator::AddSymlinks(const std::filesystem::path& root, Stats& stats) {
+    std::vector<std::filesystem::path> directories;
+    std::vector<std::filesystem::path> files;
+    std::error_code ec;
+    for (std::filesystem::recursive_directory_iterator it(root, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->is_symlink(ec)) {
+            continue;
+        }
+        if (it->is_directory(ec)) {
+            directories.push_back(it->path());
+        } else {
+            files.push_back(it->path());
+        }
+    }
+
+    auto link = [&stats](const std::filesystem::path& target, const std::filesystem::path& linkPath, bool toDirectory) {
+        std::error_code linkEc;
+        if (toDirectory) {
+            std::filesystem::create_directory_symlink(target, linkPath, linkEc);
+        } else {
+            std::filesystem::create_symlink(target, linkPath, linkEc);
+        }
+        if (linkEc) {
+            // Windows needs developer mode or elevation for symlinks; keep going without them.
+            ++stats.failedSymlinks;
+        } else {
+            ++stats.symlinks;
+        }
+    };
+
+    for (size_t i = 0; i < directories.size(); ++i) {
+        const std::filesystem::path& directory = directories[i];
+        link("..", directory / "link_up", true);
+        link(root, directory / "link_root", true);
+        link(directories[Uniform(directories.size())], directory / "link_other", true);
+        if (!files.empty()) {
+            link(files[Uniform(files.size())], directory / "link_file.txt", false);
+        }
+        link(directory / "missing_target", directory / "link_broken", false);
+    }
+}
+
+bool SyntheticTreeGenerator::Generate(Shape shape, const std::filesystem::path& root, size_t scale,
+                                      Stats& stats, std::string& error) {
+    stats = Stats();
+    if (scale == 0) {
+        scale = 1;
+    }
+    if (!MakeDirectory(root, stats)) {
+        error = "cannot create " + root.u8string();
+        return false;
+    }
+
+    switch (shape) {
+    case Shape::WideFlat: {
+        const size_t entryCount = 50000 * scale;
+        for (size_t i = 0; i < entryCount; ++i) {
+            // One directory per hundred files exercises the directories-first ordering.
+            const bool isDirectory = i % 100 == 0;
+            const std::filesystem::path path = root / FromUtf8(AsciiName(isDirectory));
+            if (isDirectory ? !MakeDirectory(path, stats) : !MakeFile(path, stats)) {
+                error = "cannot create " + path.u8string();
+                return false;
+            }
+        }
+        break;
+    }
+    case Shape::DeepNarrow: {
+        // Short component names keep the deepest paths well below the Windows MAX_PATH limit.
+        const size_t chainCount = 20 * scale;
+        for (size_t chain = 0; chain < chainCount; ++chain) {
+            std::filesystem::path directory = root / ("c" + std::to_string(chain));
+            for (int depth = 0; depth < 100; ++depth) {
+                if (!MakeDirectory(directory, stats)) {
+                    error = "cannot create " + directory.u8string();
+                    return false;
+                }
+                for (int i = 0; i < 3; ++i) {
+                    MakeFile(directory / ("f" + std::to_string(i) + ".txt"), stats);
+                }
+                directory /= "n";
+            }
+        }
+        break;
+    }
+    case Shape::Mixed: {
+        Budget budget{30000 * scale};
+        if (!GrowUntilSpent(root, false, budget, stats, error)) {
+            return false;
+        }
+        break;
+    }
+    case Shape::SymlinkHeavy: {
+        Budget budget{5000 * scale};
+        if (!GrowUntilSpent(root, false, budget, stats, error)) {
+            return false;
+        }
+        AddSymlinks(root, stats);
+        break;
+    }
+    case Shape::Unicode: {
+        Budget budget{20000 * scale};
+        if (!GrowUntilSpent(root, true, budget, stats, error)) {
+            return false;
+        }
+        break;
+    }
+    }
+
+    return true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+// Reproducible directory trees for benchmarking. The same shape, scale and seed always produce
+// the same names and layout, independent of the standard library in use.
+class SyntheticTreeGenerator {
+public:
+    enum class Shape {
+        WideFlat,     // one directory with many files
+        DeepNarrow,   // long single-directory chains with a few files per level
+        Mixed,        // varied fan-out and depth, realistic names and extensions
+        SymlinkHeavy, // mixed tree plus links to parents, the root, siblings, files and nowhere
+        Unicode       // mixed tree with Cyrillic, CJK, Greek, accented and emoji names
+    };
+
+    struct Stats {
+        size_t directories = 0;
+        size_t files = 0;
+        size_t symlinks = 0;
+        size_t failedSymlinks = 0;
+    };
+
+    explicit SyntheticTreeGenerator(uint64_t seed = 0x5EED5EED5EEDull);
+
+    // Creates the tree under root, which must not exist yet. scale multiplies the entry count.
+    bool Generate(Shape shape, const std::filesystem::path& root, size_t scale, Stats& stats, std::string& error);
+
+    static const char* ShapeName(Shape shape);
+    static bool ParseShape(const std::string& name, Shape& shape);
+
+private:
+    struct Budget {
+        size_t remaining;
+    };
+
+    uint64_t Next();
+    size_t Uniform(size_t bound);
+
+    std::string AsciiName(bool isDirectory);
+    std::string UnicodeName(bool isDirectory);
+
+    void GrowMixed(const std::filesystem::path& directory, int depth, bool unicodeNames, Budget& budget, Stats& stats);
+    bool GrowUntilSpent(const std::filesystem::path& root, bool unicodeNames, Budget& budget, Stats& stats, std::string& error);
+    void AddSymlinks(const std::filesystem::path& root, Stats& stats);
+
+    bool MakeFile(const std::filesystem::path& path, Stats& stats);
+    bool MakeDirectory(const std::filesystem::path& path, Stats& stats);
+
+    uint64_t m_state;
+    uint64_t m_serial;
+};
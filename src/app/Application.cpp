@@ -42,8 +42,8 @@ Application::Application()
     , m_hHotkeysWindow(nullptr)
     , m_hAboutWindow(nullptr)
     , m_hMainMenu(nullptr)
+    , m_treeCanvasChars(0)
     , m_previousTreeSizeBeforeBuild(0)
-    , m_previousTreeCapacityBeforeBuild(0)
     , m_expandSymlinks(false)
     , m_isMinimized(false)
     , m_isDefaultDepthValue(true)
@@ -646,15 +646,7 @@ LRESULT Application::HandleMessage(UINT message, WPARAM wParam, LPARAM lParam) {
         break;
 
     case WM_TREE_COMPLETED:
-        {
-            auto* completedResult = reinterpret_cast<std::wstring*>(lParam);
-            if (completedResult) {
-                OnTreeGenerationCompleted(*completedResult);
-                delete completedResult;
-            } else {
-                OnTreeGenerationError(L"Ошибка: результат построения дерева не получен");
-            }
-        }
+        OnTreeGenerationCompleted();
         break;
 
     case WM_TREE_ERROR:
@@ -12,6 +12,7 @@ class SystemTray;
 class GlobalHotkeys;
 class TreeGenerationService;
 class FileSaveService;
+class RenderedTreeText;
 class UpdateService;
 enum class TreeFormat;
 
@@ -60,16 +61,18 @@ private:
     void GenerateTree();
     void GenerateTreeAsync();
     void CancelGeneration();
-    void OnTreeGenerationCompleted(const std::wstring& result);
+    void OnTreeGenerationCompleted();
     void OnTreeGenerationError(const std::wstring& error);
     void OnSaveCompleted();
     void OnSaveError(const std::wstring& error);
     void UpdateProgressAnimation();
     void CopyToClipboard();
     void SaveToFile();
-    void SaveFileSync(std::wstring&& fileName, const std::wstring& content);
+    void SaveFileSync(std::wstring&& fileName, const RenderedTreeText& content);
     void SaveFileAsync(std::wstring&& fileName, TreeFormat format);
     void UpdateCurrentPath();
+    // The finished tree, or nullptr while none is shown.
+    const RenderedTreeText* GetTreeOutput() const;
     void CompactTreeBuffersForNextBuild(int nextDepth);
     void RecreateTreeCanvasControl();
     void UpdateTreeCanvasScrollBarVisibility();
@@ -114,9 +117,9 @@ private:
     std::unique_ptr<FileSaveService> m_fileSaveService;
     std::unique_ptr<UpdateService> m_updateService;
 
-    std::wstring m_treeContent;
+    // Characters of the tree shown in the canvas; the text itself lives in the generation service.
+    size_t m_treeCanvasChars;
     size_t m_previousTreeSizeBeforeBuild;
-    size_t m_previousTreeCapacityBeforeBuild;
     bool m_expandSymlinks;
     bool m_isMinimized;
     bool m_isDefaultDepthValue;
@@ -5,6 +5,7 @@
 #include "DarkMode.h"
 #include "DirectoryTreeBuilder.h"
 #include "FileSaveService.h"
+#include "RenderedTreeText.h"
 #include "TreeGenerationService.h"
 #include "UpdateService.h"
 
@@ -17,15 +18,8 @@
 using namespace ApplicationInternal;
 
 void Application::CompactTreeBuffersForNextBuild(int) {
-    const size_t previousSize = m_treeContent.size();
-    const size_t previousCapacity = m_treeContent.capacity();
-    const bool hadLargeStorage = previousCapacity > kTreeLargeCharsThreshold;
-    const bool shouldShrinkTreeStorage = hadLargeStorage || previousSize > kTreeLargeCharsThreshold;
-
-    m_treeContent.clear();
-    if (shouldShrinkTreeStorage) {
-        std::wstring().swap(m_treeContent);
-    }
+    const size_t previousSize = m_treeCanvasChars;
+    m_treeCanvasChars = 0;
 
     const bool shouldRecreateCanvas = previousSize > kTreeLargeCharsThreshold;
     if (shouldRecreateCanvas) {
@@ -36,7 +30,7 @@ void Application::CompactTreeBuffersForNextBuild(int) {
         UpdateTreeCanvasScrollBarVisibility();
     }
 
-    if (shouldShrinkTreeStorage || shouldRecreateCanvas) {
+    if (shouldRecreateCanvas) {
         TrimProcessMemoryUsage();
     }
 }
@@ -108,8 +102,7 @@ void Application::GenerateTreeAsync() {
     GetWindowText(m_hDepthEdit, depthBuffer, 32);
     const int depth = _wtoi(depthBuffer);
 
-    m_previousTreeSizeBeforeBuild = m_treeContent.size();
-    m_previousTreeCapacityBeforeBuild = m_treeContent.capacity();
+    m_previousTreeSizeBeforeBuild = m_treeCanvasChars;
     CompactTreeBuffersForNextBuild(depth);
 
     m_isGenerating = true;
@@ -131,11 +124,8 @@ void Application::GenerateTreeAsync() {
         currentPath,
         depth,
         IsExpandSymlinksEnabled(),
-        [this](std::wstring&& result) {
-            std::wstring* completedResult = new std::wstring(std::move(result));
-            if (!PostMessage(m_hWnd, WM_TREE_COMPLETED, 0, reinterpret_cast<LPARAM>(completedResult))) {
-                delete completedResult;
-            }
+        [this]() {
+            PostMessage(m_hWnd, WM_TREE_COMPLETED, 0, 0);
         },
         [this](std::wstring&& error) {
             std::wstring* errorMessage = new std::wstring(std::move(error));
@@ -160,28 +150,33 @@ void Application::CancelGeneration() {
     m_isGenerating = false;
 }
 
-void Application::OnTreeGenerationCompleted(const std::wstring& result) {
+void Application::OnTreeGenerationCompleted() {
     KillTimer(m_hWnd, PROGRESS_TIMER_ID);
 
-    m_treeContent = result;
-    if (m_treeContent.capacity() > kTreeLargeCharsThreshold &&
-        m_treeContent.size() < (m_treeContent.capacity() / kTreeShrinkFactor)) {
-        std::wstring compact(m_treeContent);
-        m_treeContent.swap(compact);
+    if (!m_treeGenerationService) {
+        OnTreeGenerationError(L"Ошибка: результат построения дерева не получен");
+        return;
     }
+    const RenderedTreeText& output = m_treeGenerationService->Output();
+    const size_t treeChars = output.CharCount();
 
     const bool droppedByAbsoluteThreshold =
-        m_previousTreeSizeBeforeBuild > m_treeContent.size() &&
-        (m_previousTreeSizeBeforeBuild - m_treeContent.size()) > kTreeLargeCharsThreshold;
+        m_previousTreeSizeBeforeBuild > treeChars &&
+        (m_previousTreeSizeBeforeBuild - treeChars) > kTreeLargeCharsThreshold;
     const bool droppedByFactor =
         m_previousTreeSizeBeforeBuild > kTreeLargeCharsThreshold &&
-        m_treeContent.size() < (m_previousTreeSizeBeforeBuild / kTreeShrinkFactor);
+        treeChars < (m_previousTreeSizeBeforeBuild / kTreeShrinkFactor);
     const bool droppedFromLargeTree = droppedByAbsoluteThreshold || droppedByFactor;
-    if (droppedFromLargeTree || m_previousTreeCapacityBeforeBuild > kTreeLargeCharsThreshold) {
+    if (droppedFromLargeTree) {
         RecreateTreeCanvasControl();
     }
 
-    SetWindowText(m_hTreeCanvas, m_treeContent.c_str());
+    {
+        // The edit control takes the text in one piece; this copy lives only while it is handed over.
+        const std::wstring text = output.Text();
+        SetWindowText(m_hTreeCanvas, text.c_str());
+    }
+    m_treeCanvasChars = treeChars;
     SendMessage(m_hTreeCanvas, EM_EMPTYUNDOBUFFER, 0, 0);
     UpdateTreeCanvasScrollBarVisibility();
     if (droppedFromLargeTree) {
@@ -220,14 +215,28 @@ void Application::UpdateProgressAnimation() {
     UpdateTreeCanvasScrollBarVisibility();
 
     std::wstring statusMessage = L"Построение дерева";
+    if (m_treeGenerationService) {
+        const uint64_t processedEntries = m_treeGenerationService->Progress().processedEntries.load(std::memory_order_relaxed);
+        if (processedEntries > 0) {
+            statusMessage += L" (обработано элементов: " + std::to_wstring(processedEntries) + L")";
+        }
+    }
     for (int i = 0; i < m_animationStep; ++i) {
         statusMessage += L".";
     }
     ShowPersistentStatusMessage(statusMessage);
 }
 
+const RenderedTreeText* Application::GetTreeOutput() const {
+    if (!m_treeGenerationService || m_isGenerating.load() || m_treeCanvasChars == 0) {
+        return nullptr;
+    }
+    return &m_treeGenerationService->Output();
+}
+
 void Application::CopyToClipboard() {
-    if (m_treeContent.empty()) {
+    const RenderedTreeText* output = GetTreeOutput();
+    if (!output) {
         return;
     }
 
@@ -236,12 +245,13 @@ void Application::CopyToClipboard() {
     }
 
     EmptyClipboard();
-    const size_t size = (m_treeContent.length() + 1) * sizeof(wchar_t);
+    const std::wstring text = output->Text();
+    const size_t size = (text.length() + 1) * sizeof(wchar_t);
     HGLOBAL hMem = GlobalAlloc(GMEM_MOVEABLE, size);
     if (hMem) {
         void* pMem = GlobalLock(hMem);
         if (pMem) {
-            wcscpy_s(static_cast<wchar_t*>(pMem), m_treeContent.length() + 1, m_treeContent.c_str());
+            wcscpy_s(static_cast<wchar_t*>(pMem), text.length() + 1, text.c_str());
             GlobalUnlock(hMem);
             SetClipboardData(CF_UNICODETEXT, hMem);
         }
@@ -251,7 +261,8 @@ void Application::CopyToClipboard() {
 }
 
 void Application::SaveToFile() {
-    if (m_treeContent.empty()) {
+    const RenderedTreeText* output = GetTreeOutput();
+    if (!output) {
         return;
     }
 
@@ -293,13 +304,13 @@ void Application::SaveToFile() {
     }
 
     if (format == TreeFormat::TEXT) {
-        SaveFileSync(std::move(fileName), m_treeContent);
+        SaveFileSync(std::move(fileName), *output);
     } else {
         SaveFileAsync(std::move(fileName), format);
     }
 }
 
-void Application::SaveFileSync(std::wstring&& fileName, const std::wstring& content) {
+void Application::SaveFileSync(std::wstring&& fileName, const RenderedTreeText& content) {
     std::wstring errorMessage;
     if (m_fileSaveService && m_fileSaveService->SaveTextFileSync(fileName, content, &errorMessage)) {
         ShowStatusMessage(L"Файл сохранен");
@@ -320,22 +331,16 @@ void Application::SaveFileAsync(std::wstring&& fileName, TreeFormat format) {
     m_isSaving = true;
     ShowPersistentStatusMessage(L"Сохранение файла...");
 
-    wchar_t depthBuffer[32];
-    GetWindowText(m_hDepthEdit, depthBuffer, 32);
-    const int depth = _wtoi(depthBuffer);
-    const std::wstring currentPath = GetCurrentWorkingPath();
-
-    if (!m_fileSaveService) {
+    if (!m_fileSaveService || !m_treeGenerationService) {
         OnSaveError(L"Сервис сохранения не инициализирован");
         return;
     }
 
+    // The tree on screen is exported as it is: no second scan, no fresh look at the depth field.
     m_fileSaveService->SaveTreeAsync(
         fileName,
-        currentPath,
-        depth,
+        m_treeGenerationService->Model(),
         format,
-        IsExpandSymlinksEnabled(),
         [this]() {
             PostMessage(m_hWnd, WM_SAVE_COMPLETED, 0, 0);
         },
@@ -0,0 +1,513 @@
+#include "DirectoryReader.h"
+#include "DirectoryTreeBuilder.h"
+#include "DirectoryWatcher.h"
+#include "LiveTreeModel.h"
+#include "StopToken.h"
+#include "TextEncoding.h"
+#include "TreeDiff.h"
+#include "TraversalStats.h"
+#include "TreeOutputSink.h"
+#include "TreeSnapshot.h"
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cwchar>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+namespace {
+constexpr int kExitSuccess = 0;
+constexpr int kExitFailure = 1;
+constexpr int kExitUsage = 2;
+
+constexpr char kUsage[] =
+    "Использование: dirtree [параметры] <каталог>\n"
+    "              dirtree [параметры] --from-snapshot ФАЙЛ\n"
+    "\n"
+    "Параметры:\n"
+    "  -d, --depth N          максимальная глубина (-1 — без ограничения, по умолчанию)\n"
+    "  -f, --format ФОРМАТ    text, json или xml (по умолчанию text)\n"
+    "  -L, --follow-symlinks  заходить в каталоги по символическим ссылкам\n"
+    "  -o, --output ФАЙЛ      записать результат в файл вместо стандартного вывода\n"
+    "  -j, --threads N        число потоков обхода (0 — по числу ядер, по умолчанию)\n"
+    "      --stream           однопроходный обход без построения дерева в памяти\n"
+    "      --stats            вывести статистику обхода и время этапов в stderr\n"
+    "      --timeout МС       прервать построение, если оно длится дольше МС миллисекунд\n"
+    "      --max-entries N    прервать построение после N элементов\n"
+    "      --save-snapshot ФАЙЛ  сохранить построенное дерево в двоичный снимок\n"
+    "      --from-snapshot ФАЙЛ  вывести дерево из снимка, не обращаясь к файловой системе\n"
+    "      --diff ФАЙЛ        вывести изменения относительно снимка: добавленные (+),\n"
+    "                         удалённые (-) и сменившие тип (~) элементы\n"
+    "  -w, --watch            после вывода дерева следить за изменениями каталога и выводить\n"
+    "                         заменяемые строки блоками «@@ -строка,было +строка,стало @@»\n"
+    "  -h, --help             показать эту справку\n";
+
+struct CliOptions {
+    std::wstring rootPath;
+    std::wstring outputPath;
+    std::wstring snapshotOutputPath;
+    std::wstring snapshotInputPath;
+    std::wstring diffBasePath;
+    int depth = -1;
+    // Whether -d was given; --diff otherwise scans with the depth of the base snapshot.
+    bool depthSet = false;
+    TreeFormat format = TreeFormat::TEXT;
+    bool expandSymlinks = false;
+    bool stream = false;
+    bool printStats = false;
+    bool watch = false;
+    size_t threadCount = 0;
+    long long timeoutMs = 0;
+    unsigned long long maxEntries = 0;
+    bool showHelp = false;
+};
+
+// UTF-8 bytes straight to the process's standard output.
+class StdoutOutputSink : public Utf8OutputSink {
+protected:
+    bool WriteChunk(const char* data, size_t length) override {
+        return std::fwrite(data, 1, length, stdout) == length;
+    }
+};
+
+void PrintError(const std::wstring& message) {
+    const std::string encoded = TextEncoding::ToUtf8(message);
+    std::fprintf(stderr, "dirtree: %s\n", encoded.c_str());
+}
+
+bool ParseInteger(const std::wstring& text, long long minimum, long long& value) {
+    if (text.empty()) {
+        return false;
+    }
+
+    wchar_t* end = nullptr;
+    value = std::wcstoll(text.c_str(), &end, 10);
+    return end == text.c_str() + text.size() && value >= minimum;
+}
+
+bool ParseFormat(const std::wstring& text, TreeFormat& format) {
+    if (text == L"text" || text == L"txt") {
+        format = TreeFormat::TEXT;
+    } else if (text == L"json") {
+        format = TreeFormat::JSON;
+    } else if (text == L"xml") {
+        format = TreeFormat::XML;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool ParseArguments(const std::vector<std::wstring>& args, CliOptions& options) {
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::wstring& arg = args[i];
+        const bool hasValue = i + 1 < args.size();
+
+        if (arg == L"-h" || arg == L"--help") {
+            options.showHelp = true;
+            return true;
+        } else if (arg == L"-L" || arg == L"--follow-symlinks") {
+            options.expandSymlinks = true;
+        } else if (arg == L"--stream") {
+            options.stream = true;
+        } else if (arg == L"--stats") {
+            options.printStats = true;
+        } else if (arg == L"-w" || arg == L"--watch") {
+            options.watch = true;
+        } else if (arg == L"-d" || arg == L"--depth") {
+            long long depth = 0;
+            if (!hasValue || !ParseInteger(args[++i], -1, depth) || depth > 1000000) {
+                PrintError(L"некорректное значение глубины");
+                return false;
+            }
+            options.depth = static_cast<int>(depth);
+            options.depthSet = true;
+        } else if (arg == L"-f" || arg == L"--format") {
+            if (!hasValue || !ParseFormat(args[++i], options.format)) {
+                PrintError(L"неизвестный формат, ожидается text, json или xml");
+                return false;
+            }
+        } else if (arg == L"-o" || arg == L"--output") {
+            if (!hasValue || args[i + 1].empty()) {
+                PrintError(L"не указан файл для вывода");
+                return false;
+            }
+            options.outputPath = args[++i];
+        } else if (arg == L"-j" || arg == L"--threads") {
+            long long threadCount = 0;
+            if (!hasValue || !ParseInteger(args[++i], 0, threadCount) || threadCount > 1024) {
+                PrintError(L"некорректное число потоков");
+                return false;
+            }
+            options.threadCount = static_cast<size_t>(threadCount);
+        } else if (arg == L"--timeout") {
+            if (!hasValue || !ParseInteger(args[++i], 1, options.timeoutMs)) {
+                PrintError(L"некорректное время ожидания");
+                return false;
+            }
+        } else if (arg == L"--max-entries") {
+            long long maxEntries = 0;
+            if (!hasValue || !ParseInteger(args[++i], 1, maxEntries)) {
+                PrintError(L"некорректное число элементов");
+                return false;
+            }
+            options.maxEntries = static_cast<unsigned long long>(maxEntries);
+        } else if (arg == L"--save-snapshot" || arg == L"--from-snapshot" || arg == L"--diff") {
+            if (!hasValue || args[i + 1].empty()) {
+                PrintError(L"не указан файл снимка");
+                return false;
+            }
+            std::wstring& target = arg == L"--save-snapshot" ? options.snapshotOutputPath
+                                 : arg == L"--from-snapshot" ? options.snapshotInputPath
+                                 : options.diffBasePath;
+            target = args[++i];
+        } else if (arg.size() > 1 && arg[0] == L'-') {
+            PrintError(L"неизвестный параметр: " + arg);
+            return false;
+        } else if (options.rootPath.empty()) {
+            options.rootPath = arg;
+        } else {
+            PrintError(L"каталог указан более одного раза");
+            return false;
+        }
+    }
+
+    if (!options.snapshotInputPath.empty()) {
+        if (!options.rootPath.empty() || !options.snapshotOutputPath.empty()) {
+            PrintError(L"--from-snapshot не сочетается с каталогом и --save-snapshot");
+            return false;
+        }
+        return true;
+    }
+    if (options.rootPath.empty()) {
+        PrintError(L"не указан каталог");
+        return false;
+    }
+    if (options.watch && (options.format != TreeFormat::TEXT || options.stream || !options.outputPath.empty() ||
+                          !options.snapshotOutputPath.empty() || !options.diffBasePath.empty())) {
+        PrintError(L"--watch работает только с текстовым выводом в стандартный вывод");
+        return false;
+    }
+    if (options.stream && (!options.snapshotOutputPath.empty() || !options.diffBasePath.empty())) {
+        PrintError(L"--save-snapshot и --diff не сочетаются с --stream");
+        return false;
+    }
+    return true;
+}
+
+double ToMilliseconds(std::chrono::nanoseconds duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+void PrintStats(const TraversalStats& stats) {
+    std::fprintf(stderr,
+                 "Каталогов: %llu, файлов: %llu, ссылок: %llu, пропущено: %llu, нет доступа: %llu, циклов: %llu, "
+                 "запросов stat: %llu\n",
+                 static_cast<unsigned long long>(stats.directories), static_cast<unsigned long long>(stats.files),
+                 static_cast<unsigned long long>(stats.symlinks), static_cast<unsigned long long>(stats.skipped),
+                 static_cast<unsigned long long>(stats.permissionDenied),
+                 static_cast<unsigned long long>(stats.cyclesBroken),
+                 static_cast<unsigned long long>(stats.statCalls));
+    std::fputs("Время, мс:", stderr);
+    for (size_t i = 0; i < kTraversalPhaseCount; ++i) {
+        const TraversalPhase phase = static_cast<TraversalPhase>(i);
+        std::fprintf(stderr, " %s %.1f,", TraversalStats::PhaseName(phase), ToMilliseconds(stats.PhaseTime(phase)));
+    }
+    std::fprintf(stderr, " всего %.1f\n", ToMilliseconds(stats.totalTime));
+}
+
+// Snapshots and models are rendered by the caller, so the render phase is timed here.
+template <typename Tree>
+BuildTreeResult RenderTree(const Tree& tree, TreeFormat format, StopToken& stopToken, Utf8OutputSink& sink) {
+    PhaseScope render(sink.StatsRecorder(), TraversalPhase::Render);
+    std::unique_ptr<TreeRenderer> renderer = TreeRenderer::Create(format, sink);
+    renderer->SetStopToken(&stopToken);
+    if (!renderer->RenderModel(tree)) {
+        return {false, L"", StopMessage(stopToken)};
+    }
+    if (!renderer->Flush()) {
+        return {false, L"", L"Ошибка записи результата"};
+    }
+    return {true, L"", L""};
+}
+
+BuildTreeResult OpenSnapshot(const std::wstring& fileName, TreeSnapshot& snapshot) {
+    std::wstring errorMessage;
+    if (!snapshot.Open(fileName, errorMessage)) {
+        return {false, L"", errorMessage};
+    }
+    return {true, L"", L""};
+}
+
+// Builds the model of options.rootPath and saves it if a snapshot was asked for.
+BuildTreeResult ScanTree(DirectoryTreeBuilder& builder, const CliOptions& options, StopToken& stopToken,
+                         TreeModel& model) {
+    BuildTreeResult result = builder.BuildTreeModel(options.rootPath, options.depth, options.format, model,
+                                                    options.expandSymlinks, &stopToken);
+    if (!result.success || options.snapshotOutputPath.empty()) {
+        return result;
+    }
+
+    std::error_code ec;
+    const std::filesystem::path absolutePath = std::filesystem::absolute(ToNativePath(options.rootPath), ec);
+    TreeSnapshotInfo info;
+    info.rootPath = ec ? options.rootPath : FromNativePath(absolutePath);
+    info.maxDepth = options.depth;
+    info.format = options.format;
+    info.expandSymlinks = options.expandSymlinks;
+    info.createdTime = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    if (!TreeSnapshot::Save(options.snapshotOutputPath, model, info, result.errorMessage)) {
+        result.success = false;
+    }
+    return result;
+}
+
+// Trees scanned with a different depth, root rules or link handling differ in entries that
+// did not change, so only trees with the same settings are compared.
+bool SameScanSettings(const TreeSnapshotInfo& first, const TreeSnapshotInfo& second) {
+    return first.maxDepth == second.maxDepth && first.format == second.format &&
+           first.expandSymlinks == second.expandSymlinks;
+}
+
+// The current tree comes from the scan or from --from-snapshot, the old one from --diff. The
+// scan takes its settings from the base snapshot; -d and -L may only repeat them.
+BuildTreeResult RenderDiff(DirectoryTreeBuilder& builder, const CliOptions& options, StopToken& stopToken,
+                           Utf8OutputSink& sink) {
+    TreeSnapshot base;
+    BuildTreeResult result = OpenSnapshot(options.diffBasePath, base);
+    if (!result.success) {
+        return result;
+    }
+
+    TreeDiff diff;
+    if (!options.snapshotInputPath.empty()) {
+        TreeSnapshot current;
+        result = OpenSnapshot(options.snapshotInputPath, current);
+        if (!result.success) {
+            return result;
+        }
+        if (!SameScanSettings(base.Info(), current.Info())) {
+            return {false, L"", L"Снимки построены с разными параметрами (глубина, формат, ссылки)"};
+        }
+        diff.Compare(base, current);
+    } else {
+        const TreeSnapshotInfo& baseInfo = base.Info();
+        if ((options.depthSet && options.depth != baseInfo.maxDepth) ||
+            (options.expandSymlinks && !baseInfo.expandSymlinks)) {
+            return {false, L"", L"Параметры -d и -L не совпадают с параметрами снимка: " + options.diffBasePath};
+        }
+        // The output format stays the requested one; the model follows the snapshot's root rules.
+        CliOptions scanOptions = options;
+        scanOptions.depth = baseInfo.maxDepth;
+        scanOptions.format = baseInfo.format;
+        scanOptions.expandSymlinks = baseInfo.expandSymlinks;
+        TreeModel current;
+        result = ScanTree(builder, scanOptions, stopToken, current);
+        if (!result.success) {
+            return result;
+        }
+        diff.Compare(base, current);
+    }
+    return RenderTree(diff, options.format, stopToken, sink);
+}
+
+BuildTreeResult Render(DirectoryTreeBuilder& builder, const CliOptions& options, StopToken& stopToken,
+                       Utf8OutputSink& sink) {
+    if (!options.diffBasePath.empty()) {
+        return RenderDiff(builder, options, stopToken, sink);
+    }
+    if (!options.snapshotInputPath.empty()) {
+        TreeSnapshot snapshot;
+        BuildTreeResult result = OpenSnapshot(options.snapshotInputPath, snapshot);
+        return result.success ? RenderTree(snapshot, options.format, stopToken, sink) : result;
+    }
+    if (options.stream) {
+        return builder.StreamTreeToSink(options.rootPath, options.depth, options.format, sink, options.expandSymlinks, &stopToken);
+    }
+    if (!options.snapshotOutputPath.empty()) {
+        TreeModel model;
+        BuildTreeResult result = ScanTree(builder, options, stopToken, model);
+        return result.success ? RenderTree(model, options.format, stopToken, sink) : result;
+    }
+    return builder.BuildTreeToSink(options.rootPath, options.depth, options.format, sink, options.expandSymlinks, &stopToken);
+}
+
+std::atomic<StopToken*> g_interruptToken(nullptr);
+
+void OnInterrupt(int) {
+    if (StopToken* stopToken = g_interruptToken.load()) {
+        stopToken->RequestStop();
+    }
+}
+
+// Turns Ctrl+C and SIGTERM into a cancellation of stopToken for its lifetime: the build and
+// the render wind down, and a partial output file is removed as after any other failure.
+class InterruptScope {
+public:
+    explicit InterruptScope(StopToken& stopToken) {
+        g_interruptToken.store(&stopToken);
+        m_previousInterrupt = std::signal(SIGINT, OnInterrupt);
+        m_previousTerminate = std::signal(SIGTERM, OnInterrupt);
+    }
+
+    ~InterruptScope() {
+        std::signal(SIGINT, m_previousInterrupt);
+        std::signal(SIGTERM, m_previousTerminate);
+        g_interruptToken.store(nullptr);
+    }
+
+    InterruptScope(const InterruptScope&) = delete;
+    InterruptScope& operator=(const InterruptScope&) = delete;
+
+private:
+    void (*m_previousInterrupt)(int);
+    void (*m_previousTerminate)(int);
+};
+
+constexpr std::chrono::milliseconds kWatchPollInterval(500);
+
+void WriteHunk(size_t firstLine, size_t removedLines, size_t addedLines, const std::wstring& text) {
+    std::printf("@@ -%zu,%zu +%zu,%zu @@\r\n", firstLine + 1, removedLines, firstLine + 1, addedLines);
+    const std::string encoded = TextEncoding::ToUtf8(text);
+    std::fwrite(encoded.data(), 1, encoded.size(), stdout);
+}
+
+// Prints the tree once, then every change as a hunk of replaced lines. A full rescan, when the
+// watch loses track, is printed as a hunk replacing everything. Runs until interrupted.
+int RunWatch(const CliOptions& options) {
+    LiveTreeModel live(DirectoryWatcher::CreateDefault(), options.threadCount);
+    BuildTreeResult result = live.Start(options.rootPath, options.depth, options.expandSymlinks);
+    if (!result.success) {
+        PrintError(result.errorMessage);
+        return kExitFailure;
+    }
+
+    StdoutOutputSink sink;
+    live.Render(sink);
+    sink.Flush();
+    std::fflush(stdout);
+
+    // Lines of the text as printed so far. After a failed update the model may already hold
+    // changes that were never printed, so the full-replace hunk cannot take its count from it.
+    size_t shownLines = live.LineCount();
+    std::vector<TreeTextPatch> patches;
+    for (;;) {
+        patches.clear();
+        if (!live.Update(kWatchPollInterval, patches)) {
+            // The rescan replaces everything; patches of the failed update do not apply to it.
+            patches.clear();
+            result = live.Start(options.rootPath, options.depth, options.expandSymlinks);
+            if (!result.success) {
+                PrintError(result.errorMessage);
+                return kExitFailure;
+            }
+
+            std::wstring text;
+            StringOutputSink textSink(text);
+            live.Render(textSink);
+            WriteHunk(0, shownLines, live.LineCount(), text);
+            shownLines = live.LineCount();
+        }
+
+        for (const TreeTextPatch& patch : patches) {
+            WriteHunk(patch.firstLine, patch.removedLines, patch.addedLines, patch.text);
+            shownLines = shownLines - patch.removedLines + patch.addedLines;
+        }
+        std::fflush(stdout);
+    }
+}
+
+int Run(const std::vector<std::wstring>& args) {
+    CliOptions options;
+    if (!ParseArguments(args, options)) {
+        std::fputs("Справка: dirtree --help\n", stderr);
+        return kExitUsage;
+    }
+    if (options.showHelp) {
+        std::fputs(kUsage, stdout);
+        return kExitSuccess;
+    }
+    if (options.watch) {
+        return RunWatch(options);
+    }
+
+    DirectoryTreeBuilder builder(options.threadCount);
+    TraversalRecorder recorder;
+    TraversalRecorder* statsRecorder = options.printStats ? &recorder : nullptr;
+    builder.SetStatsRecorder(statsRecorder);
+
+    StopToken stopToken;
+    if (options.timeoutMs > 0) {
+        stopToken.SetTimeout(std::chrono::milliseconds(options.timeoutMs));
+    }
+    if (options.maxEntries > 0) {
+        stopToken.SetEntryBudget(options.maxEntries);
+    }
+    InterruptScope interrupt(stopToken);
+
+    if (options.outputPath.empty()) {
+        StdoutOutputSink sink;
+        sink.SetStatsRecorder(statsRecorder);
+        BuildTreeResult result = Render(builder, options, stopToken, sink);
+        if (statsRecorder) {
+            PrintStats(recorder.Stats());
+        }
+        if (!result.success) {
+            PrintError(result.errorMessage);
+            return kExitFailure;
+        }
+        std::fflush(stdout);
+        return kExitSuccess;
+    }
+
+    Utf8FileOutputSink sink(options.outputPath);
+    if (!sink.IsOpen()) {
+        PrintError(L"Ошибка создания файла: " + options.outputPath);
+        return kExitFailure;
+    }
+
+    // Set on the sink itself so that the final flush in Close() is timed as well.
+    sink.SetStatsRecorder(statsRecorder);
+    BuildTreeResult result = Render(builder, options, stopToken, sink);
+    const bool written = sink.Close();
+    if (statsRecorder) {
+        PrintStats(recorder.Stats());
+    }
+    if (!result.success || !written) {
+        // Do not leave a truncated tree behind.
+        std::error_code ec;
+        std::filesystem::remove(ToNativePath(options.outputPath), ec);
+        PrintError(result.success ? std::wstring(L"Ошибка записи файла") : result.errorMessage);
+        return kExitFailure;
+    }
+    return kExitSuccess;
+}
+}
+
+#ifdef _WIN32
+int wmain(int argc, wchar_t* argv[]) {
+    _setmode(_fileno(stdout), _O_BINARY);
+    return Run(std::vector<std::wstring>(argv + 1, argv + argc));
+}
+#else
+int main(int argc, char* argv[]) {
+    std::vector<std::wstring> args;
+    args.reserve(argc > 0 ? static_cast<size_t>(argc - 1) : 0);
+    for (int i = 1; i < argc; ++i) {
+        // Paths are bytes; FromPathBytes() keeps those that are not UTF-8 for ToNativePath().
+        args.push_back(TextEncoding::FromPathBytes(argv[i]));
+    }
+    return Run(args);
+}
+#endif
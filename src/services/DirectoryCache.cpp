@@ -0,0 +1,122 @@
+#include "DirectoryCache.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#include <time.h>
+#endif
+
+namespace {
+// Timestamps within this distance of the current time are not trusted; it covers the two
+// second resolution of FAT and the coarse clocks of some network filesystems.
+constexpr int64_t kSettleNanoseconds = 2000000000;
+
+#ifdef _WIN32
+int64_t ToInt64(const FILETIME& time) {
+    return static_cast<int64_t>((static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime);
+}
+#else
+int64_t ToNanoseconds(const timespec& time) {
+    return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+DirectoryStamp StampFromStat(const struct stat& info) {
+    DirectoryStamp stamp{0, 0, 0, 0, true, false};
+#ifdef __APPLE__
+    stamp.modifiedTime = ToNanoseconds(info.st_mtimespec);
+    stamp.changedTime = ToNanoseconds(info.st_ctimespec);
+#else
+    stamp.modifiedTime = ToNanoseconds(info.st_mtim);
+    stamp.changedTime = ToNanoseconds(info.st_ctim);
+#endif
+    stamp.device = static_cast<uint64_t>(info.st_dev);
+    stamp.inode = static_cast<uint64_t>(info.st_ino);
+
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    const int64_t nowNanoseconds = ToNanoseconds(now);
+    stamp.settled = nowNanoseconds - stamp.modifiedTime >= kSettleNanoseconds &&
+                    nowNanoseconds - stamp.changedTime >= kSettleNanoseconds;
+    return stamp;
+}
+#endif
+}
+
+DirectoryStamp QueryDirectoryStamp(const std::filesystem::path& path) {
+#ifdef _WIN32
+    DirectoryStamp stamp{0, 0, 0, 0, false, false};
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data)) {
+        return stamp;
+    }
+    stamp.modifiedTime = ToInt64(data.ftLastWriteTime);
+    stamp.changedTime = ToInt64(data.ftCreationTime);
+    stamp.valid = true;
+
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    // FILETIME counts 100 ns intervals.
+    stamp.settled = ToInt64(now) - stamp.modifiedTime >= kSettleNanoseconds / 100;
+    return stamp;
+#else
+    struct stat info;
+    if (::stat(path.c_str(), &info) != 0) {
+        return DirectoryStamp{0, 0, 0, 0, false, false};
+    }
+    return StampFromStat(info);
+#endif
+}
+
+DirectoryStamp QueryDirectoryStamp(const DirectoryHandle& parent, const std::filesystem::path& name) {
+#ifdef _WIN32
+    static_cast<void>(parent);
+    static_cast<void>(name);
+    return DirectoryStamp{0, 0, 0, 0, false, false};
+#else
+    struct stat info;
+    if (!parent.Valid() || ::fstatat(parent.Fd(), name.c_str(), &info, 0) != 0) {
+        return DirectoryStamp{0, 0, 0, 0, false, false};
+    }
+    return StampFromStat(info);
+#endif
+}
+
+std::shared_ptr<const DirectoryContents> DirectoryCache::Lookup(const std::filesystem::path& path,
+                                                                const DirectoryStamp& stamp) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_entries.find(path.native());
+    if (it == m_entries.end() || it->second.stamp != stamp) {
+        return nullptr;
+    }
+    it->second.used = true;
+    return it->second.contents;
+}
+
+void DirectoryCache::Store(const std::filesystem::path& path, const DirectoryStamp& stamp,
+                           std::shared_ptr<const DirectoryContents> contents) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries[path.native()] = Entry{stamp, std::move(contents), true};
+}
+
+void DirectoryCache::Prune() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+        if (!it->second.used) {
+            it = m_entries.erase(it);
+        } else {
+            it->second.used = false;
+            ++it;
+        }
+    }
+}
+
+void DirectoryCache::Clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.clear();
+}
+
+size_t DirectoryCache::Size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_entries.size();
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "DirectoryContents.h"
+#include "DirectoryHandle.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+// Metadata that changes whenever entries are added to, removed from or renamed inside a
+// directory: modification and change time plus (device, inode) on POSIX, last write and
+// creation time on Windows.
+struct DirectoryStamp {
+    int64_t modifiedTime;
+    int64_t changedTime;
+    uint64_t device;
+    uint64_t inode;
+    bool valid;
+    // False while the modification time is too recent to be trusted: a change within the same
+    // timestamp tick would go unnoticed, so such listings are not cached.
+    bool settled;
+
+    bool operator==(const DirectoryStamp& other) const {
+        return valid && other.valid && modifiedTime == other.modifiedTime && changedTime == other.changedTime &&
+               device == other.device && inode == other.inode;
+    }
+
+    bool operator!=(const DirectoryStamp& other) const {
+        return !(*this == other);
+    }
+};
+
+// Follows symlinks, like the traversal itself.
+DirectoryStamp QueryDirectoryStamp(const std::filesystem::path& path);
+// The same for the entry name of an open directory, resolving only that one component.
+DirectoryStamp QueryDirectoryStamp(const DirectoryHandle& parent, const std::filesystem::path& name);
+
+// In-process cache of sorted directory contents for repeated builds of the same tree. A build
+// only stats each directory; its listing is re-read only when the stamp no longer matches.
+// Changes that leave the directory's own stamp alone, such as a symlink target turning from a
+// file into a directory, are not detected. Safe to use from several traversal threads.
+class DirectoryCache {
+public:
+    // The cached contents if path is cached with the same stamp, nullptr otherwise. They are
+    // shared, not copied: an entry replaced meanwhile stays alive for as long as it is held.
+    std::shared_ptr<const DirectoryContents> Lookup(const std::filesystem::path& path, const DirectoryStamp& stamp);
+    void Store(const std::filesystem::path& path, const DirectoryStamp& stamp,
+               std::shared_ptr<const DirectoryContents> contents);
+
+    // Drops every entry that was neither looked up nor stored since the previous Prune().
+    void Prune();
+    void Clear();
+    size_t Size() const;
+
+private:
+    struct Entry {
+        DirectoryStamp stamp;
+        std::shared_ptr<const DirectoryContents> contents;
+        bool used;
+    };
+
+    mutable std::mutex m_mutex;
+    std::unordered_map<std::filesystem::path::string_type, Entry> m_entries;
+};
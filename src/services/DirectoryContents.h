@@ -0,0 +1,29 @@
+#pragma once
+
+#include "DirectoryReader.h"
+#include "FileIdentity.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+struct EntryInfo {
+    bool isDirectory;
+    bool isSymlink;
+    // Filled while listing for symlinks only, as a by-product of resolving their target.
+    FileIdentity identity;
+};
+
+// One listed directory with resolved entry types. Names stay in the listing's packed buffer;
+// order holds the display order as a permutation of listing indices.
+struct DirectoryContents {
+    DirectoryListing listing;
+    std::vector<EntryInfo> entries;
+    std::vector<uint32_t> order;
+
+    size_t Size() const { return order.size(); }
+    bool Empty() const { return order.empty(); }
+    NameView Name(size_t position) const { return listing.Name(order[position]); }
+    const EntryInfo& Entry(size_t position) const { return entries[order[position]]; }
+};
@@ -0,0 +1,100 @@
+#include "DirectoryHandle.h"
+
+#include <algorithm>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+constexpr size_t kFallbackBudget = 64;
+constexpr size_t kMaxBudget = 4096;
+}
+
+DirectoryHandle& DirectoryHandle::operator=(DirectoryHandle&& other) noexcept {
+    if (this != &other) {
+        Reset();
+        m_fd = other.m_fd;
+        other.m_fd = -1;
+    }
+    return *this;
+}
+
+void DirectoryHandle::Reset() {
+#ifndef _WIN32
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+#endif
+    m_fd = -1;
+}
+
+FileIdentity DirectoryHandle::QueryIdentity(const std::filesystem::path& name, bool* isDirectory) const {
+    FileIdentity identity{0, 0, false};
+    if (isDirectory) {
+        *isDirectory = false;
+    }
+
+#ifndef _WIN32
+    struct stat info;
+    if (m_fd >= 0 && ::fstatat(m_fd, name.c_str(), &info, 0) == 0) {
+        identity.device = static_cast<uint64_t>(info.st_dev);
+        identity.index = static_cast<uint64_t>(info.st_ino);
+        identity.valid = true;
+        if (isDirectory) {
+            *isDirectory = S_ISDIR(info.st_mode);
+        }
+    }
+#else
+    static_cast<void>(name);
+#endif
+
+    return identity;
+}
+
+std::filesystem::file_type DirectoryHandle::QueryType(const std::filesystem::path& name) const {
+#ifndef _WIN32
+    struct stat info;
+    if (m_fd < 0 || ::fstatat(m_fd, name.c_str(), &info, AT_SYMLINK_NOFOLLOW) != 0) {
+        return std::filesystem::file_type::not_found;
+    }
+    if (S_ISLNK(info.st_mode)) {
+        return std::filesystem::file_type::symlink;
+    }
+    if (S_ISDIR(info.st_mode)) {
+        return std::filesystem::file_type::directory;
+    }
+    return S_ISREG(info.st_mode) ? std::filesystem::file_type::regular : std::filesystem::file_type::unknown;
+#else
+    static_cast<void>(name);
+    return std::filesystem::file_type::not_found;
+#endif
+}
+
+bool DescriptorBudget::TryAcquire() {
+    size_t left = m_left.load(std::memory_order_relaxed);
+    while (left > 0) {
+        if (m_left.compare_exchange_weak(left, left - 1, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t DescriptorBudget::Default() {
+#ifndef _WIN32
+    struct rlimit limit;
+    if (::getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        return kFallbackBudget;
+    }
+    if (limit.rlim_cur == RLIM_INFINITY) {
+        return kMaxBudget;
+    }
+    return std::min<size_t>(static_cast<size_t>(limit.rlim_cur) / 2, kMaxBudget);
+#else
+    return 0;
+#endif
+}
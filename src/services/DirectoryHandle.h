@@ -0,0 +1,51 @@
+#pragma once
+
+#include "FileIdentity.h"
+
+#include <atomic>
+#include <cstddef>
+#include <filesystem>
+
+// An open directory descriptor, closed with the object. Entries are queried relative to it, so
+// the kernel resolves a single component instead of walking a full path. POSIX only: on
+// Windows the readers work with paths and a handle is never valid.
+class DirectoryHandle {
+public:
+    DirectoryHandle() : m_fd(-1) {}
+    explicit DirectoryHandle(int fd) : m_fd(fd) {}
+    ~DirectoryHandle() { Reset(); }
+
+    DirectoryHandle(DirectoryHandle&& other) noexcept : m_fd(other.m_fd) { other.m_fd = -1; }
+    DirectoryHandle& operator=(DirectoryHandle&& other) noexcept;
+    DirectoryHandle(const DirectoryHandle&) = delete;
+    DirectoryHandle& operator=(const DirectoryHandle&) = delete;
+
+    bool Valid() const { return m_fd >= 0; }
+    int Fd() const { return m_fd; }
+    void Reset();
+
+    // QueryFileIdentity() for the entry name of this directory; follows a link.
+    FileIdentity QueryIdentity(const std::filesystem::path& name, bool* isDirectory = nullptr) const;
+    // Type of the entry name without following a link, as std::filesystem::symlink_status().
+    std::filesystem::file_type QueryType(const std::filesystem::path& name) const;
+
+private:
+    int m_fd;
+};
+
+// Caps the descriptors one traversal keeps open for relative opens. Once it is spent, further
+// directories are reached by full path again. Safe to share between traversal threads.
+class DescriptorBudget {
+public:
+    explicit DescriptorBudget(size_t count) : m_left(count) {}
+
+    bool TryAcquire();
+    void Release() { m_left.fetch_add(1, std::memory_order_relaxed); }
+
+    // A share of the process descriptor limit that leaves room for the output, the pool and
+    // whatever else the process has open.
+    static size_t Default();
+
+private:
+    std::atomic<size_t> m_left;
+};
@@ -0,0 +1,176 @@
+#include "DirectoryReader.h"
+
+#include "TextEncoding.h"
+
+#include <system_error>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#endif
+
+bool DirectoryReader::ReadAt(const DirectoryHandle& parent, const std::filesystem::path& name,
+                             const std::atomic<bool>& stopRequested, DirectoryListing& listing,
+                             DirectoryHandle* handle) const {
+    static_cast<void>(parent);
+    static_cast<void>(name);
+    static_cast<void>(stopRequested);
+    static_cast<void>(handle);
+    listing.SetError(std::make_error_code(std::errc::operation_not_supported));
+    return false;
+}
+
+bool FilesystemDirectoryReader::Read(const std::filesystem::path& directory, const std::atomic<bool>& stopRequested,
+                                     DirectoryListing& listing) const {
+    std::error_code ec;
+    std::filesystem::directory_iterator iterator(directory, ec);
+    if (ec) {
+        listing.SetError(ec);
+        // A directory we may not read lists as empty, as with skip_permission_denied.
+        return ec == std::errc::permission_denied;
+    }
+
+    for (; iterator != std::filesystem::directory_iterator(); iterator.increment(ec)) {
+        if (stopRequested.load(std::memory_order_relaxed)) {
+            return true;
+        }
+
+        // Both checks use the type cached by the iterator; neither follows a link.
+        const auto& entry = *iterator;
+        std::error_code typeEc;
+        DirectoryEntryType type = DirectoryEntryType::Other;
+        if (entry.is_symlink(typeEc) && !typeEc) {
+            type = DirectoryEntryType::Symlink;
+        } else {
+            typeEc.clear();
+            if (entry.is_directory(typeEc) && !typeEc) {
+                type = DirectoryEntryType::Directory;
+            }
+        }
+
+        listing.Add(entry.path().filename().native(), type);
+    }
+
+    if (ec) {
+        listing.SetError(ec);
+    }
+    return true;
+}
+
+#ifdef __linux__
+namespace {
+// Layout of the records returned by getdents64; glibc does not declare it.
+struct LinuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+DirectoryEntryType ToEntryType(unsigned char type) {
+    switch (type) {
+    case DT_DIR:
+        return DirectoryEntryType::Directory;
+    case DT_LNK:
+        return DirectoryEntryType::Symlink;
+    case DT_UNKNOWN:
+        return DirectoryEntryType::Unknown;
+    default:
+        return DirectoryEntryType::Other;
+    }
+}
+}
+
+bool Getdents64DirectoryReader::Read(const std::filesystem::path& directory, const std::atomic<bool>& stopRequested,
+                                     DirectoryListing& listing) const {
+    return ReadAt(DirectoryHandle(), directory, stopRequested, listing, nullptr);
+}
+
+bool Getdents64DirectoryReader::ReadAt(const DirectoryHandle& parent, const std::filesystem::path& name,
+                                       const std::atomic<bool>& stopRequested, DirectoryListing& listing,
+                                       DirectoryHandle* handle) const {
+    const int fd = ::openat(parent.Valid() ? parent.Fd() : AT_FDCWD, name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        const int error = errno;
+        listing.SetError(std::error_code(error, std::generic_category()));
+        // Same as the portable reader: a directory we may not read lists as empty.
+        return error == EACCES;
+    }
+    DirectoryHandle opened(fd);
+
+    // One buffer per traversal thread, reused for every directory it lists.
+    thread_local std::unique_ptr<char[]> buffer(new char[kBufferBytes]);
+
+    for (;;) {
+        if (stopRequested.load(std::memory_order_relaxed)) {
+            break;
+        }
+
+        const long bytesRead = ::syscall(SYS_getdents64, fd, buffer.get(), kBufferBytes);
+        if (bytesRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead <= 0) {
+            // Read errors part-way through end the listing, like directory_iterator::increment.
+            if (bytesRead < 0) {
+                listing.SetError(std::error_code(errno, std::generic_category()));
+            }
+            break;
+        }
+
+        for (long offset = 0; offset < bytesRead;) {
+            const auto* record = reinterpret_cast<const LinuxDirent64*>(buffer.get() + offset);
+            offset += record->d_reclen;
+
+            const char* entryName = record->d_name;
+            if (entryName[0] == '.' && (entryName[1] == '\0' || (entryName[1] == '.' && entryName[2] == '\0'))) {
+                continue;
+            }
+
+            NameString& names = listing.NameBuffer();
+            const size_t nameOffset = names.size();
+            names.append(entryName, std::strlen(entryName));
+            listing.CommitName(nameOffset, ToEntryType(record->d_type));
+        }
+    }
+
+    if (handle) {
+        *handle = std::move(opened);
+    }
+    return true;
+}
+#endif
+
+std::unique_ptr<DirectoryReader> DirectoryReader::CreateDefault() {
+#ifdef __linux__
+    return std::make_unique<Getdents64DirectoryReader>();
+#else
+    return std::make_unique<FilesystemDirectoryReader>();
+#endif
+}
+
+std::filesystem::path ToNativePath(std::wstring_view text) {
+#ifdef _WIN32
+    return std::filesystem::path(std::wstring(text));
+#else
+    return std::filesystem::path(TextEncoding::ToPathBytes(text));
+#endif
+}
+
+std::wstring FromNativePath(const std::filesystem::path& path) {
+#ifdef _WIN32
+    return path.wstring();
+#else
+    return TextEncoding::FromPathBytes(path.native());
+#endif
+}
+
+std::filesystem::path AppendPathComponent(const std::filesystem::path& directory, NameView name) {
+    return directory / std::filesystem::path(name);
+}
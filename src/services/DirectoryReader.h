@@ -0,0 +1,132 @@
+#pragma once
+
+#include "DirectoryHandle.h"
+#include "TreeName.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+// Entry type as reported by the listing itself, without following links. Unknown means the
+// filesystem did not say (DT_UNKNOWN) and the caller has to query it.
+enum class DirectoryEntryType : uint8_t {
+    Unknown,
+    Directory,
+    Symlink,
+    Other
+};
+
+// Names of one directory in the native encoding, packed back to back into a single buffer.
+class DirectoryListing {
+public:
+    void Clear() {
+        m_names.clear();
+        m_entries.clear();
+        m_error.clear();
+    }
+
+    void Add(NameView name, DirectoryEntryType type) {
+        const size_t offset = m_names.size();
+        m_names.append(name);
+        m_entries.push_back(Entry{static_cast<uint32_t>(offset), static_cast<uint32_t>(name.size()), type});
+    }
+
+    // For backends that copy names in place: append to NameBuffer(), then commit.
+    NameString& NameBuffer() { return m_names; }
+    void CommitName(size_t offset, DirectoryEntryType type) {
+        m_entries.push_back(Entry{static_cast<uint32_t>(offset), static_cast<uint32_t>(m_names.size() - offset), type});
+    }
+
+    size_t Size() const { return m_entries.size(); }
+    bool Empty() const { return m_entries.empty(); }
+    // Total length of all names.
+    size_t NameChars() const { return m_names.size(); }
+
+    NameView Name(size_t index) const {
+        const Entry& entry = m_entries[index];
+        return NameView(m_names.data() + entry.nameOffset, entry.nameLength);
+    }
+
+    DirectoryEntryType Type(size_t index) const { return m_entries[index].type; }
+
+    // Why the directory could not be opened or was only partly read; empty otherwise.
+    const std::error_code& Error() const { return m_error; }
+    void SetError(std::error_code error) { m_error = error; }
+
+private:
+    struct Entry {
+        uint32_t nameOffset;
+        uint32_t nameLength;
+        DirectoryEntryType type;
+    };
+
+    NameString m_names;
+    std::vector<Entry> m_entries;
+    std::error_code m_error;
+};
+
+// Source of directory listings for the tree builder. Implementations must be safe to call from
+// several traversal threads at once.
+class DirectoryReader {
+public:
+    virtual ~DirectoryReader() = default;
+
+    // Appends the entries of directory, excluding "." and "..", to listing. Returns false if the
+    // directory could not be opened, except when permission was denied: such a directory lists
+    // as empty, as with directory_options::skip_permission_denied. Stops early, keeping what was
+    // read, once stopRequested is set. Errors are also recorded with listing.SetError().
+    virtual bool Read(const std::filesystem::path& directory, const std::atomic<bool>& stopRequested,
+                      DirectoryListing& listing) const = 0;
+
+    // Descriptor-relative variant, for backends whose OpensRelative() is true: name is opened
+    // inside the open directory parent, so only that one component is resolved. With parent
+    // invalid, name is an ordinary path. If handle is non-null the directory is left open in it
+    // for reaching its own entries the same way. Otherwise as Read(); the default reports
+    // operation_not_supported.
+    virtual bool OpensRelative() const { return false; }
+    virtual bool ReadAt(const DirectoryHandle& parent, const std::filesystem::path& name,
+                        const std::atomic<bool>& stopRequested, DirectoryListing& listing,
+                        DirectoryHandle* handle) const;
+
+    // The fastest backend available on this platform.
+    static std::unique_ptr<DirectoryReader> CreateDefault();
+};
+
+// Portable backend on top of std::filesystem::directory_iterator.
+class FilesystemDirectoryReader : public DirectoryReader {
+public:
+    bool Read(const std::filesystem::path& directory, const std::atomic<bool>& stopRequested,
+              DirectoryListing& listing) const override;
+};
+
+#ifdef __linux__
+// Reads raw getdents64 records in large batches: one system call covers hundreds of entries
+// and names are copied straight into the listing, with no path object per entry.
+class Getdents64DirectoryReader : public DirectoryReader {
+public:
+    static constexpr size_t kBufferBytes = 256 * 1024;
+
+    bool Read(const std::filesystem::path& directory, const std::atomic<bool>& stopRequested,
+              DirectoryListing& listing) const override;
+
+    // openat() relative to the parent descriptor, then the same getdents64 reads.
+    bool OpensRelative() const override { return true; }
+    bool ReadAt(const DirectoryHandle& parent, const std::filesystem::path& name,
+                const std::atomic<bool>& stopRequested, DirectoryListing& listing,
+                DirectoryHandle* handle) const override;
+};
+#endif
+
+// Conversions between wide text and native paths. On POSIX the native encoding is taken to
+// be UTF-8 directly, without depending on the process locale.
+std::filesystem::path ToNativePath(std::wstring_view text);
+std::wstring FromNativePath(const std::filesystem::path& path);
+
+// Joins a directory and an entry name from a listing.
+std::filesystem::path AppendPathComponent(const std::filesystem::path& directory, NameView name);
@@ -1,500 +1,1079 @@
 #include "DirectoryTreeBuilder.h"
+#include "DirectoryCache.h"
+#include "TreeNameOrder.h"
+#include "TreeOutputSink.h"
+#include "WorkStealingPool.h"
+
 #include <algorithm>
-#include <cwctype>
+#include <chrono>
 #include <system_error>
 
-const wchar_t* DirectoryTreeBuilder::TREE_BRANCH = L"├── ";
-const wchar_t* DirectoryTreeBuilder::TREE_LAST = L"└── ";
-const wchar_t* DirectoryTreeBuilder::TREE_VERTICAL = L"│   ";
-const wchar_t* DirectoryTreeBuilder::TREE_SPACE = L"    ";
+namespace {
+constexpr std::chrono::milliseconds kProgressPollInterval(50);
+// The streaming walk looks at the clock for the progress callback only this often.
+constexpr uint64_t kProgressCheckMask = 15;
 
-DirectoryTreeBuilder::DirectoryTreeBuilder() {
-}
+// 16-byte sort key. folded points into the listing itself when the name has nothing to fold,
+// otherwise into the scratch buffer. rank is the listing index with the top bit set for
+// non-directories, so directories sort first.
+struct SortKey {
+    const NameChar* folded;
+    uint32_t length;
+    uint32_t rank;
+};
 
-DirectoryTreeBuilder::~DirectoryTreeBuilder() {
-}
+constexpr uint32_t kFileRankBit = 0x80000000u;
 
-BuildTreeResult DirectoryTreeBuilder::BuildTree(const std::wstring& rootPath, int maxDepth, TreeFormat format,
-                                                bool expandSymlinks,
-                                                std::function<bool()> shouldCancel,
-                                                std::function<void(const std::wstring&)> progressCallback) {
-    try {
-        std::filesystem::path path(rootPath);
-        if (!std::filesystem::exists(path)) {
-            return {false, L"", L"Путь не существует: " + rootPath};
-        }
+// Reused by every directory sorted on the same thread, so steady-state sorting allocates nothing.
+struct SortScratch {
+    NameString folded;
+    std::vector<SortKey> keys;
+};
 
-        if (shouldCancel && shouldCancel()) {
-            return {false, L"", L"Операция отменена"};
-        }
+void SortContents(DirectoryContents& contents) {
+    thread_local SortScratch scratch;
 
-        if (format == TreeFormat::TEXT) {
-            int processedCount = 0;
-            std::unordered_set<std::wstring> visitedPaths;
-            std::wstring result;
-            result.reserve(8192);
+    const DirectoryListing& listing = contents.listing;
+    const size_t count = contents.entries.size();
+    scratch.folded.clear();
+    // Reserved up front: keys point into this buffer, so it must not reallocate while filling.
+    scratch.folded.reserve(listing.NameChars());
+    scratch.keys.clear();
+    scratch.keys.reserve(count);
 
-            std::wstring rootName{path.filename().wstring()};
-            if (rootName.empty()) {
-                rootName = path.wstring();
+    for (size_t i = 0; i < count; ++i) {
+        const NameView name = listing.Name(i);
+        const NameChar* folded = name.data();
+        const auto firstFoldable = std::find_if(name.begin(), name.end(), TreeNameOrder::IsFoldable);
+        if (firstFoldable != name.end()) {
+            const size_t offset = scratch.folded.size();
+            for (NameChar ch : name) {
+                scratch.folded.push_back(TreeNameOrder::Fold(ch));
             }
+            folded = scratch.folded.data() + offset;
+        }
 
-            result = std::move(rootName);
-            result += L"/\r\n";
+        const uint32_t rank = static_cast<uint32_t>(i) | (contents.entries[i].isDirectory ? 0u : kFileRankBit);
+        scratch.keys.push_back(SortKey{folded, static_cast<uint32_t>(name.size()), rank});
+    }
 
-            struct SortableEntry {
-                std::filesystem::directory_entry entry;
-                bool isDirectory;
-                std::wstring lowerName;
-            };
+    // Same order as TreeNameOrder::CompareNames, on the pre-folded keys.
+    std::sort(scratch.keys.begin(), scratch.keys.end(),
+              [&listing](const SortKey& a, const SortKey& b) {
+                  if ((a.rank ^ b.rank) & kFileRankBit) {
+                      return (a.rank & kFileRankBit) == 0;
+                  }
+                  const int order = NameView(a.folded, a.length).compare(NameView(b.folded, b.length));
+                  if (order != 0) {
+                      return order < 0;
+                  }
+                  return listing.Name(a.rank & ~kFileRankBit) < listing.Name(b.rank & ~kFileRankBit);
+              });
 
-            std::error_code ec;
-            std::filesystem::directory_options options = std::filesystem::directory_options::skip_permission_denied;
-            std::filesystem::directory_iterator iterator(path, options, ec);
-            if (ec) {
-                return {false, L"", L"Не удалось открыть каталог: " + rootPath};
-            }
+    contents.order.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        contents.order[i] = scratch.keys[i].rank & ~kFileRankBit;
+    }
+}
 
-            std::vector<SortableEntry> entries;
-            for (const auto& entry : iterator) {
-                if (shouldCancel && shouldCancel()) {
-                    return {false, L"", L"Операция отменена"};
-                }
+bool IsPermissionDenied(const std::error_code& error) {
+    return error == std::errc::permission_denied || error == std::errc::operation_not_permitted;
+}
 
-                std::error_code typeEc;
-                const bool isEntryDirectory = entry.is_directory(typeEc) && !typeEc;
-                std::wstring lowerName = entry.path().filename().wstring();
-                std::transform(lowerName.begin(), lowerName.end(), lowerName.begin(),
-                               [](wchar_t ch) { return static_cast<wchar_t>(towlower(ch)); });
+void CountEntries(TraversalStats& stats, const DirectoryContents& contents) {
+    for (const EntryInfo& entry : contents.entries) {
+        ++(entry.isDirectory ? stats.directories : stats.files);
+        stats.symlinks += entry.isSymlink ? 1 : 0;
+    }
+}
 
-                entries.push_back(SortableEntry{entry, isEntryDirectory, std::move(lowerName)});
-            }
+const DirectoryHandle kNoDirectory;
 
-            std::sort(entries.begin(), entries.end(),
-                      [](const SortableEntry& a, const SortableEntry& b) {
-                          if (a.isDirectory != b.isDirectory) {
-                              return a.isDirectory > b.isDirectory;
-                          }
-                          return a.lowerName < b.lowerName;
-                      });
-
-            for (size_t i = 0; i < entries.size(); ++i) {
-                if (shouldCancel && shouldCancel()) {
-                    return {false, L"", L"Операция отменена"};
-                }
+// A directory as the walks reach it. While its parent is open it is opened by name relative to
+// the parent, so the kernel resolves a single component; the full path is joined only when
+// something still needs it, such as the cache key or a parent that is not open.
+class DirectoryPlace {
+public:
+    // A directory known by its full path.
+    explicit DirectoryPlace(const std::filesystem::path& path)
+        : m_parent(kNoDirectory)
+        , m_name(path) {
+    }
 
-                const bool isLast = (i == entries.size() - 1);
-                if (!RenderTreeFromPath(entries[i].entry.path(), L"", isLast, 1, maxDepth,
-                                        expandSymlinks,
-                                        result, shouldCancel, progressCallback, processedCount, visitedPaths)) {
-                    return {false, L"", L"Операция отменена"};
-                }
-            }
+    DirectoryPlace(const DirectoryHandle& parent, const std::filesystem::path& name,
+                   std::function<std::filesystem::path()> joinPath)
+        : m_parent(parent)
+        , m_name(name)
+        , m_joinPath(std::move(joinPath)) {
+    }
+
+    const DirectoryHandle& Parent() const { return m_parent; }
+    const std::filesystem::path& Name() const { return m_name; }
+
+    const std::filesystem::path& Path() const {
+        if (!m_joinPath) {
+            return m_name;
+        }
+        if (m_path.empty()) {
+            m_path = m_joinPath();
+        }
+        return m_path;
+    }
+
+private:
+    const DirectoryHandle& m_parent;
+    const std::filesystem::path& m_name;
+    std::function<std::filesystem::path()> m_joinPath;
+    mutable std::filesystem::path m_path;
+};
 
-            return {true, std::move(result), L""};
+bool ReadSortedEntries(const DirectoryReader& reader, const DirectoryPlace& place,
+                       const std::atomic<bool>& stopRequested, DirectoryContents& contents,
+                       TraversalRecorder* recorder, DirectoryHandle* handle) {
+    // contents may be reused from a previous directory; the readers append to the listing.
+    contents.listing.Clear();
+    contents.entries.clear();
+    contents.order.clear();
+    bool listed = false;
+    // Held open for the entry queries below even when the caller does not keep it.
+    DirectoryHandle directory;
+    {
+        PhaseScope listing(recorder, TraversalPhase::Listing);
+        if (!reader.OpensRelative()) {
+            listed = reader.Read(place.Path(), stopRequested, contents.listing);
+        } else if (place.Parent().Valid()) {
+            listed = reader.ReadAt(place.Parent(), place.Name(), stopRequested, contents.listing, &directory);
+        } else {
+            listed = reader.ReadAt(kNoDirectory, place.Path(), stopRequested, contents.listing, &directory);
         }
+    }
+    if (recorder && IsPermissionDenied(contents.listing.Error())) {
+        ++recorder->Stats().permissionDenied;
+    }
+    if (!listed) {
+        return false;
+    }
 
-        int processedCount = 0;
-        std::unordered_set<std::wstring> visitedPaths;
-        TreeNode root = BuildNodeTree(
-            path, 0, maxDepth, expandSymlinks,
-            shouldCancel, progressCallback, processedCount, visitedPaths
-        );
+    PhaseScope stat(recorder, TraversalPhase::Stat);
+    const DirectoryListing& listing = contents.listing;
+    contents.entries.reserve(listing.Size());
+    uint64_t statCalls = 0;
+    for (size_t i = 0; i < listing.Size(); ++i) {
+        if (stopRequested.load(std::memory_order_relaxed)) {
+            // The result is discarded on cancellation; leave nothing half-resolved behind.
+            contents.entries.clear();
+            contents.order.clear();
+            return true;
+        }
 
-        if (shouldCancel && shouldCancel()) {
-            return {false, L"", L"Операция отменена"};
+        // The listing already carries each entry's own type (d_type, or the find data on
+        // Windows). Only a symlink needs a query for its target, which also yields its identity.
+        const NameView name = listing.Name(i);
+        DirectoryEntryType type = listing.Type(i);
+        if (type == DirectoryEntryType::Unknown) {
+            ++statCalls;
+            std::error_code typeEc;
+            const std::filesystem::file_type fileType =
+                directory.Valid() ? directory.QueryType(std::filesystem::path(name))
+                                  : std::filesystem::symlink_status(AppendPathComponent(place.Path(), name), typeEc).type();
+            type = fileType == std::filesystem::file_type::symlink ? DirectoryEntryType::Symlink
+                 : fileType == std::filesystem::file_type::directory ? DirectoryEntryType::Directory
+                 : DirectoryEntryType::Other;
         }
 
-        if (format == TreeFormat::JSON) {
-            return {true, RenderTreeAsJson(root), L""};
+        const bool isEntrySymlink = type == DirectoryEntryType::Symlink;
+        bool isEntryDirectory = type == DirectoryEntryType::Directory;
+        FileIdentity identity{0, 0, false};
+        if (isEntrySymlink) {
+            ++statCalls;
+            identity = directory.Valid() ? directory.QueryIdentity(std::filesystem::path(name), &isEntryDirectory)
+                                         : QueryFileIdentity(AppendPathComponent(place.Path(), name), &isEntryDirectory);
         }
-        return {true, RenderTreeAsXml(root), L""};
+        contents.entries.push_back(EntryInfo{isEntryDirectory, isEntrySymlink, identity});
     }
-    catch (const std::exception&) {
-        return {false, L"", L"Ошибка при построении дерева директорий"};
+
+    if (recorder) {
+        CountEntries(recorder->Stats(), contents);
+        recorder->Stats().statCalls += statCalls;
+    }
+
+    PhaseScope sort(recorder, TraversalPhase::Sort);
+    SortContents(contents);
+    if (handle) {
+        *handle = std::move(directory);
     }
+    return true;
 }
 
-bool DirectoryTreeBuilder::RenderTreeFromPath(const std::filesystem::path& path,
-                                              const std::wstring& prefix,
-                                              bool isLast,
-                                              int currentDepth,
-                                              int maxDepth,
-                                              bool expandSymlinks,
-                                              std::wstring& out,
-                                              std::function<bool()> shouldCancel,
-                                              std::function<void(const std::wstring&)> progressCallback,
-                                              int& processedCount,
-                                              std::unordered_set<std::wstring>& visitedPaths) {
-    if (shouldCancel && shouldCancel()) {
+bool ShouldDescend(const EntryInfo& entry, int depth, int maxDepth, bool expandSymlinks) {
+    if (maxDepth >= 0 && depth >= maxDepth) {
         return false;
     }
+    return entry.isDirectory && (expandSymlinks || !entry.isSymlink);
+}
 
-    std::error_code ec;
-    const bool isSymlink = std::filesystem::is_symlink(path, ec) && !ec;
-    ec.clear();
-    const bool isDirectory = std::filesystem::is_directory(path, ec) && !ec;
-    const std::wstring nodeName = path.filename().wstring();
-
-    out += prefix;
-    out += isLast ? TREE_LAST : TREE_BRANCH;
-    out += nodeName;
-    if (isDirectory) {
-        out += L"/";
+// place is the entry's own, named relative to the directory listing it.
+FileIdentity EntryIdentity(const EntryInfo& entry, const DirectoryPlace& place, TraversalRecorder* recorder) {
+    if (entry.identity.valid) {
+        return entry.identity;
+    }
+    PhaseScope stat(recorder, TraversalPhase::Stat);
+    if (recorder) {
+        ++recorder->Stats().statCalls;
     }
-    out += L"\r\n";
+    return place.Parent().Valid() ? place.Parent().QueryIdentity(place.Name()) : QueryFileIdentity(place.Path());
+}
 
-    ++processedCount;
-    if (progressCallback && processedCount % 10 == 0) {
-        std::wstring progress{L"Обработано элементов: "};
-        progress.reserve(progress.length() + 10);
-        progress += std::to_wstring(processedCount);
-        progressCallback(progress);
+bool ReadSortedEntriesSafe(const DirectoryReader& reader, const DirectoryPlace& place,
+                           const std::atomic<bool>& stopRequested, DirectoryContents& contents,
+                           TraversalRecorder* recorder, DirectoryHandle* handle) {
+    try {
+        return ReadSortedEntries(reader, place, stopRequested, contents, recorder, handle);
     }
+    catch (const std::exception&) {
+        // Handle filesystem exceptions silently
+        contents.listing.Clear();
+        contents.entries.clear();
+        contents.order.clear();
+        return false;
+    }
+}
+
+// Contents of one listed directory: read into the caller's own buffers, or shared with the
+// cache without a copy.
+struct ListedContents {
+    DirectoryContents own;
+    std::shared_ptr<const DirectoryContents> shared;
+
+    const DirectoryContents& Get() const { return shared ? *shared : own; }
+};
 
-    if ((!expandSymlinks && isSymlink) || !isDirectory || (maxDepth >= 0 && currentDepth >= maxDepth)) {
-        return true;
+// Reads a directory through the cache when there is one: a directory whose stamp is unchanged
+// costs a single stat instead of a listing, per-entry type queries and a sort. The stamp is
+// taken relative to the parent's descriptor when it is open. If handle is non-null the
+// directory is left open in it, unless it came from the cache.
+bool ListDirectory(const DirectoryReader& reader, DirectoryCache* cache, const DirectoryPlace& place,
+                   const std::atomic<bool>& stopRequested, ListedContents& contents,
+                   TraversalRecorder* recorder, DirectoryHandle* handle) {
+    contents.shared.reset();
+    if (!cache) {
+        return ReadSortedEntriesSafe(reader, place, stopRequested, contents.own, recorder, handle);
     }
 
-    std::filesystem::path normalizedPath = std::filesystem::weakly_canonical(path, ec);
-    if (ec) {
-        ec.clear();
-        normalizedPath = std::filesystem::absolute(path, ec);
-        if (ec) {
-            normalizedPath = path;
+    DirectoryStamp stamp;
+    {
+        PhaseScope stat(recorder, TraversalPhase::Stat);
+        stamp = place.Parent().Valid() ? QueryDirectoryStamp(place.Parent(), place.Name())
+                                       : QueryDirectoryStamp(place.Path());
+        if (recorder) {
+            ++recorder->Stats().statCalls;
         }
     }
-    const std::wstring pathKey = normalizedPath.lexically_normal().wstring();
-    if (visitedPaths.find(pathKey) != visitedPaths.end()) {
-        return true;
+    // The full path is still the cache key.
+    const std::filesystem::path& path = place.Path();
+    if (stamp.valid) {
+        contents.shared = cache->Lookup(path, stamp);
+        if (contents.shared) {
+            if (recorder) {
+                ++recorder->Stats().cachedDirectories;
+                CountEntries(recorder->Stats(), *contents.shared);
+            }
+            return true;
+        }
     }
-    visitedPaths.insert(pathKey);
 
-    struct SortableEntry {
-        std::filesystem::directory_entry entry;
-        bool isDirectory;
-        std::wstring lowerName;
-    };
+    if (!ReadSortedEntriesSafe(reader, place, stopRequested, contents.own, recorder, handle)) {
+        return false;
+    }
+    // Cancelled and failed reads may be incomplete and are never cached.
+    if (stamp.settled && !contents.own.listing.Error() && !stopRequested.load(std::memory_order_relaxed)) {
+        contents.shared = std::make_shared<const DirectoryContents>(std::move(contents.own));
+        cache->Store(path, stamp, contents.shared);
+    }
+    return true;
+}
 
-    std::vector<SortableEntry> entries;
-    std::filesystem::directory_options options = std::filesystem::directory_options::skip_permission_denied;
-    std::filesystem::directory_iterator iterator(path, options, ec);
-    if (ec) {
-        visitedPaths.erase(pathKey);
-        return true;
+// Lets the listing hook see a directory before ListDirectory() reads it.
+void NotifyListing(const std::function<void(const std::filesystem::path&)>& hook, const DirectoryPlace& place) {
+    if (hook) {
+        hook(place.Path());
     }
+}
 
-    for (const auto& entry : iterator) {
-        if (shouldCancel && shouldCancel()) {
-            visitedPaths.erase(pathKey);
-            return false;
+// Cycles can only appear through links that are followed. Without expandSymlinks a POSIX
+// traversal never follows one, so no identities are needed; Windows junctions are descended
+// regardless and are always checked.
+bool TracksAncestors(bool expandSymlinks) {
+#ifdef _WIN32
+    static_cast<void>(expandSymlinks);
+    return true;
+#else
+    return expandSymlinks;
+#endif
+}
+
+// Formats "Обработано элементов: N" for callback users, at most once per interval. The text
+// buffer is reused, so reporting allocates nothing once it has grown to size.
+class ProgressReporter {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    ProgressReporter(const std::function<void(const std::wstring&)>& callback, std::chrono::milliseconds interval)
+        : m_callback(callback)
+        , m_interval(interval)
+        , m_lastReport(Clock::now())
+        , m_reportedCount(0) {
+    }
+
+    bool Enabled() const { return static_cast<bool>(m_callback); }
+
+    void Report(uint64_t processedCount) {
+        if (!m_callback || processedCount == m_reportedCount) {
+            return;
+        }
+        const Clock::time_point now = Clock::now();
+        if (now - m_lastReport < m_interval) {
+            return;
         }
+        m_lastReport = now;
+        m_reportedCount = processedCount;
 
-        std::error_code typeEc;
-        const bool isEntryDirectory = entry.is_directory(typeEc) && !typeEc;
-        std::wstring lowerName = entry.path().filename().wstring();
-        std::transform(lowerName.begin(), lowerName.end(), lowerName.begin(),
-                       [](wchar_t ch) { return static_cast<wchar_t>(towlower(ch)); });
+        wchar_t digits[20];
+        size_t digitCount = 0;
+        do {
+            digits[digitCount++] = static_cast<wchar_t>(L'0' + processedCount % 10);
+            processedCount /= 10;
+        } while (processedCount > 0);
 
-        entries.push_back(SortableEntry{entry, isEntryDirectory, std::move(lowerName)});
+        m_text.assign(L"Обработано элементов: ");
+        while (digitCount > 0) {
+            m_text.push_back(digits[--digitCount]);
+        }
+        m_callback(m_text);
     }
 
-    std::sort(entries.begin(), entries.end(),
-              [](const SortableEntry& a, const SortableEntry& b) {
-                  if (a.isDirectory != b.isDirectory) {
-                      return a.isDirectory > b.isDirectory;
-                  }
-                  return a.lowerName < b.lowerName;
-              });
+private:
+    const std::function<void(const std::wstring&)>& m_callback;
+    std::chrono::milliseconds m_interval;
+    Clock::time_point m_lastReport;
+    uint64_t m_reportedCount;
+    std::wstring m_text;
+};
 
-    const std::wstring childPrefix = prefix + (isLast ? TREE_SPACE : TREE_VERTICAL);
-    for (size_t i = 0; i < entries.size(); ++i) {
-        if (shouldCancel && shouldCancel()) {
-            visitedPaths.erase(pathKey);
-            return false;
+// An open directory of the streaming walk: its sorted listing, the position of the next
+// entry to emit, the length of its path and, within the descriptor budget, its descriptor.
+struct StreamFrame {
+    ListedContents contents;
+    size_t next;
+    size_t pathLength;
+    DirectoryHandle handle;
+};
+
+struct StreamContext {
+    int maxDepth;
+    bool expandSymlinks;
+    const DirectoryReader& reader;
+    DirectoryCache* cache;
+    TreeRenderer* renderer;
+    StopToken& stop;
+    ProgressReporter reporter;
+    bool trackAncestors;
+    TraversalRecorder* recorder;
+    TraversalProgress& progress;
+    DescriptorBudget& descriptors;
+    const std::function<void(const std::filesystem::path&)>& listingHook;
+    // Single writer, so the shared counter is published with plain stores.
+    uint64_t processedCount;
+    std::vector<FileIdentity> ancestors;
+};
+
+// Lends the builder's recorder and progress counters to the caller's sink for one build,
+// unless the sink already has its own.
+template <typename CharT>
+class SinkInstrumentationScope {
+public:
+    SinkInstrumentationScope(BasicTreeOutputSink<CharT>& sink, TraversalRecorder* recorder, TraversalProgress* progress)
+        : m_sink(sink)
+        , m_lendsRecorder(recorder && !sink.StatsRecorder())
+        , m_lendsProgress(progress && !sink.Progress()) {
+        if (m_lendsRecorder) {
+            m_sink.SetStatsRecorder(recorder);
+        }
+        if (m_lendsProgress) {
+            m_sink.SetProgress(progress);
         }
+    }
 
-        const bool childIsLast = (i == entries.size() - 1);
-        if (!RenderTreeFromPath(entries[i].entry.path(), childPrefix, childIsLast,
-                                currentDepth + 1, maxDepth, expandSymlinks, out, shouldCancel,
-                                progressCallback, processedCount, visitedPaths)) {
-            visitedPaths.erase(pathKey);
+    ~SinkInstrumentationScope() {
+        if (m_lendsRecorder) {
+            m_sink.SetStatsRecorder(nullptr);
+        }
+        if (m_lendsProgress) {
+            m_sink.SetProgress(nullptr);
+        }
+    }
+
+    SinkInstrumentationScope(const SinkInstrumentationScope&) = delete;
+    SinkInstrumentationScope& operator=(const SinkInstrumentationScope&) = delete;
+
+private:
+    BasicTreeOutputSink<CharT>& m_sink;
+    bool m_lendsRecorder;
+    bool m_lendsProgress;
+};
+
+// Adds the wall time of one build to the recorder.
+class TotalTimeScope {
+public:
+    explicit TotalTimeScope(TraversalRecorder* recorder)
+        : m_recorder(recorder)
+        , m_start(recorder ? TraversalRecorder::Clock::now() : TraversalRecorder::Clock::time_point()) {
+    }
+
+    ~TotalTimeScope() {
+        if (m_recorder) {
+            m_recorder->Stats().totalTime += TraversalRecorder::Clock::now() - m_start;
+        }
+    }
+
+    TotalTimeScope(const TotalTimeScope&) = delete;
+    TotalTimeScope& operator=(const TotalTimeScope&) = delete;
+
+private:
+    TraversalRecorder* m_recorder;
+    TraversalRecorder::Clock::time_point m_start;
+};
+
+// Walks the subtree below an already emitted root with an explicit stack of open
+// directories, so the depth is bounded by the heap rather than the call stack. Frames keep
+// their listing buffers when they are closed and reuse them for the next directory at the
+// same depth.
+bool StreamChildren(StreamContext& context, const std::filesystem::path& root, ListedContents& rootContents,
+                    DirectoryHandle& rootHandle) {
+    std::vector<StreamFrame> frames(1);
+    frames[0].contents = std::move(rootContents);
+    frames[0].next = 0;
+    frames[0].pathLength = root.native().size();
+    frames[0].handle = std::move(rootHandle);
+
+    // Path of the directory being listed; each frame remembers where its own path ends.
+    std::filesystem::path::string_type pathText = root.native();
+    size_t openCount = 1;
+    context.progress.currentDepth.store(0, std::memory_order_relaxed);
+
+    while (openCount > 0) {
+        const size_t frameIndex = openCount - 1;
+        if (frames[frameIndex].next == frames[frameIndex].contents.Get().Size()) {
+            --openCount;
+            if (frames[frameIndex].handle.Valid()) {
+                frames[frameIndex].handle.Reset();
+                context.descriptors.Release();
+            }
+            if (openCount > 0) {
+                // The last child of a directory is done: close the directory itself.
+                context.ancestors.pop_back();
+                context.renderer->EndNode();
+                context.progress.currentDepth.store(static_cast<uint32_t>(openCount - 1), std::memory_order_relaxed);
+            }
+            continue;
+        }
+
+        if (context.stop.StopRequested()) {
             return false;
         }
+
+        // The frame a descent would fill exists up front, so the references below stay valid.
+        if (frames.size() == openCount) {
+            frames.emplace_back();
+        }
+        StreamFrame& frame = frames[frameIndex];
+        StreamFrame& child = frames[openCount];
+
+        const int depth = static_cast<int>(openCount);
+        const size_t i = frame.next++;
+        const DirectoryContents& contents = frame.contents.Get();
+        const EntryInfo& entry = contents.Entry(i);
+        const NameView name = contents.Name(i);
+
+        // A directory is listed before its own node is emitted: the renderers need to know
+        // whether it has children.
+        bool descended = false;
+        FileIdentity childIdentity{0, 0, false};
+        if (ShouldDescend(entry, depth, context.maxDepth, context.expandSymlinks)) {
+            const std::filesystem::path childName(name);
+            pathText.resize(frame.pathLength);
+            if (frameIndex == 0) {
+                // The root path is the caller's; only the first step needs operator/ rules.
+                pathText = (root / childName).native();
+            } else {
+                pathText.push_back(std::filesystem::path::preferred_separator);
+                pathText += childName.native();
+            }
+            const DirectoryPlace childPlace(frame.handle, childName,
+                                            [&pathText]() { return std::filesystem::path(pathText); });
+            if (context.trackAncestors) {
+                childIdentity = EntryIdentity(entry, childPlace, context.recorder);
+            }
+            if (std::find(context.ancestors.begin(), context.ancestors.end(), childIdentity) == context.ancestors.end()) {
+                // Only a directory whose own subdirectories may be walked is worth keeping open.
+                const bool keepOpen = context.reader.OpensRelative() &&
+                                      (context.maxDepth < 0 || depth + 1 < context.maxDepth) &&
+                                      context.descriptors.TryAcquire();
+                NotifyListing(context.listingHook, childPlace);
+                ListDirectory(context.reader, context.cache, childPlace, context.stop.Flag(), child.contents, context.recorder,
+                              keepOpen ? &child.handle : nullptr);
+                if (keepOpen && !child.handle.Valid()) {
+                    context.descriptors.Release();
+                }
+                child.next = 0;
+                child.pathLength = pathText.size();
+                descended = true;
+            } else if (context.recorder) {
+                ++context.recorder->Stats().cyclesBroken;
+            }
+        } else if (context.recorder && entry.isDirectory) {
+            ++context.recorder->Stats().skipped;
+        }
+
+        context.renderer->BeginNode(name, entry.isDirectory, descended && !child.contents.Get().Empty(),
+                                    i + 1 == contents.Size());
+
+        ++context.processedCount;
+        context.progress.processedEntries.store(context.processedCount, std::memory_order_relaxed);
+        if ((context.processedCount & kProgressCheckMask) == 0) {
+            context.stop.CheckLimits(context.processedCount);
+            context.reporter.Report(context.processedCount);
+        } else {
+            context.stop.CheckBudget(context.processedCount);
+        }
+
+        if (descended) {
+            context.ancestors.push_back(childIdentity);
+            ++openCount;
+            context.progress.currentDepth.store(static_cast<uint32_t>(openCount - 1), std::memory_order_relaxed);
+        } else {
+            context.renderer->EndNode();
+        }
     }
 
-    visitedPaths.erase(pathKey);
     return true;
 }
+}
+
+DirectoryTreeBuilder::DirectoryTreeBuilder(size_t workerCount, std::unique_ptr<DirectoryReader> reader)
+    : m_workerCount(workerCount)
+    , m_reader(reader ? std::move(reader) : DirectoryReader::CreateDefault())
+    , m_cache(nullptr)
+    , m_recorder(nullptr)
+    , m_progress(nullptr)
+    , m_progressInterval(kProgressPollInterval)
+    , m_descriptorBudget(DescriptorBudget::Default()) {
+}
 
-TreeNode DirectoryTreeBuilder::BuildNodeTree(const std::filesystem::path& path, int currentDepth, int maxDepth,
-                                                   bool expandSymlinks,
-                                                   std::function<bool()> shouldCancel,
-                                                   std::function<void(const std::wstring&)> progressCallback,
-                                                   int& processedCount,
-                                                   std::unordered_set<std::wstring>& visitedPaths) {
-    std::error_code ec;
-    const bool isDirectory = std::filesystem::is_directory(path, ec) && !ec;
+DirectoryTreeBuilder::~DirectoryTreeBuilder() {
+}
+
+DirectoryTreeBuilder::DirectoryLink::DirectoryLink(std::filesystem::path linkName, FileIdentity linkIdentity,
+                                                   std::shared_ptr<DirectoryLink> linkParent)
+    : name(std::move(linkName))
+    , identity(linkIdentity)
+    , pendingOpens(1)
+    , parent(std::move(linkParent)) {
+}
 
-    std::wstring nodeName = path.filename().wstring();
-    if (nodeName.empty()) {
-        nodeName = path.wstring();
+DirectoryTreeBuilder::DirectoryLink::~DirectoryLink() {
+    // Releases the links this one owned alone iteratively; the implicit destructor would
+    // recurse once per level of a deep tree.
+    std::shared_ptr<DirectoryLink> next = std::move(parent);
+    while (next && next.use_count() == 1) {
+        next = std::move(next->parent);
     }
+}
 
-    TreeNode node(std::move(nodeName), isDirectory);
-    
-    // Check for cancellation
-    if (shouldCancel && shouldCancel()) {
-        return node;
+std::filesystem::path DirectoryTreeBuilder::DirectoryLink::Path() const {
+    std::vector<const DirectoryLink*> chain;
+    for (const DirectoryLink* link = this; link; link = link->parent.get()) {
+        chain.push_back(link);
     }
-    
-    if (!node.isDirectory || (maxDepth >= 0 && currentDepth >= maxDepth)) {
-        return node;
+    std::filesystem::path path = chain.back()->name;
+    for (size_t i = chain.size() - 1; i > 0; --i) {
+        path /= chain[i - 1]->name;
     }
+    return path;
+}
 
-    // Avoid recursive loops through symlinks/junctions and repeated reparse targets.
-    std::filesystem::path normalizedPath = std::filesystem::weakly_canonical(path, ec);
-    if (ec) {
-        ec.clear();
-        normalizedPath = std::filesystem::absolute(path, ec);
-        if (ec) {
-            normalizedPath = path;
-        }
+void DirectoryTreeBuilder::DirectoryLink::ReleaseOpen(DescriptorBudget& descriptors) {
+    if (pendingOpens.fetch_sub(1, std::memory_order_acq_rel) == 1 && handle.Valid()) {
+        handle.Reset();
+        descriptors.Release();
+    }
+}
+
+void DirectoryTreeBuilder::SetDirectoryCache(DirectoryCache* cache) {
+    m_cache = cache;
+}
+
+void DirectoryTreeBuilder::SetStatsRecorder(TraversalRecorder* recorder) {
+    m_recorder = recorder;
+}
+
+void DirectoryTreeBuilder::SetProgress(TraversalProgress* progress) {
+    m_progress = progress;
+}
+
+void DirectoryTreeBuilder::SetProgressInterval(std::chrono::milliseconds interval) {
+    m_progressInterval = interval;
+}
+
+void DirectoryTreeBuilder::SetDescriptorBudget(size_t count) {
+    m_descriptorBudget = count;
+}
+
+void DirectoryTreeBuilder::SetListingHook(std::function<void(const std::filesystem::path&)> hook) {
+    m_listingHook = std::move(hook);
+}
+
+BuildTreeResult DirectoryTreeBuilder::BuildTree(const std::wstring& rootPath, int maxDepth, TreeFormat format,
+                                                bool expandSymlinks,
+                                                StopToken* stopToken,
+                                                std::function<void(const std::wstring&)> progressCallback) {
+    std::wstring content;
+    content.reserve(8192);
+    StringOutputSink sink(content);
+
+    BuildTreeResult result = BuildTreeToSink(rootPath, maxDepth, format, sink, expandSymlinks,
+                                             stopToken, std::move(progressCallback));
+    if (result.success) {
+        result.content = std::move(content);
     }
-    const std::wstring pathKey = normalizedPath.lexically_normal().wstring();
-    if (visitedPaths.find(pathKey) != visitedPaths.end()) {
-        return node;
+    return result;
+}
+
+BuildTreeResult DirectoryTreeBuilder::BuildTreeToSink(const std::wstring& rootPath, int maxDepth, TreeFormat format,
+                                                      TreeOutputSink& sink,
+                                                      bool expandSymlinks,
+                                                      StopToken* stopToken,
+                                                      std::function<void(const std::wstring&)> progressCallback) {
+    SinkInstrumentationScope instrumentation(sink, m_recorder, m_progress);
+    std::unique_ptr<TreeRenderer> renderer = TreeRenderer::Create(format, sink);
+    return BuildTreeWithRenderer(rootPath, maxDepth, format, *renderer, expandSymlinks, stopToken, progressCallback);
+}
+
+BuildTreeResult DirectoryTreeBuilder::BuildTreeToSink(const std::wstring& rootPath, int maxDepth, TreeFormat format,
+                                                      Utf8OutputSink& sink,
+                                                      bool expandSymlinks,
+                                                      StopToken* stopToken,
+                                                      std::function<void(const std::wstring&)> progressCallback) {
+    SinkInstrumentationScope instrumentation(sink, m_recorder, m_progress);
+    std::unique_ptr<TreeRenderer> renderer = TreeRenderer::Create(format, sink);
+    return BuildTreeWithRenderer(rootPath, maxDepth, format, *renderer, expandSymlinks, stopToken, progressCallback);
+}
+
+BuildTreeResult DirectoryTreeBuilder::StreamTreeToSink(const std::wstring& rootPath, int maxDepth, TreeFormat format,
+                                                       TreeOutputSink& sink,
+                                                       bool expandSymlinks,
+                                                       StopToken* stopToken,
+                                                       std::function<void(const std::wstring&)> progressCallback) {
+    SinkInstrumentationScope instrumentation(sink, m_recorder, m_progress);
+    std::unique_ptr<TreeRenderer> renderer = TreeRenderer::Create(format, sink);
+    return StreamTreeWithRenderer(rootPath, maxDepth, format, *renderer, expandSymlinks, stopToken, progressCallback);
+}
+
+BuildTreeResult DirectoryTreeBuilder::StreamTreeToSink(const std::wstring& rootPath, int maxDepth, TreeFormat format,
+                                                       Utf8OutputSink& sink,
+                                                       bool expandSymlinks,
+                                                       StopToken* stopToken,
+                                                       std::function<void(const std::wstring&)> progressCallback) {
+    SinkInstrumentationScope instrumentation(sink, m_recorder, m_progress);
+    std::unique_ptr<TreeRenderer> renderer = TreeRenderer::Create(format, sink);
+    return StreamTreeWithRenderer(rootPath, maxDepth, format, *renderer, expandSymlinks, stopToken, progressCallback);
+}
+
+BuildTreeResult DirectoryTreeBuilder::BuildTreeModel(const std::wstring& rootPath, int maxDepth, TreeFormat format,
+                                                     TreeModel& model,
+                                                     bool expandSymlinks,
+                                                     StopToken* stopToken,
+                                                     std::function<void(const std::wstring&)> progressCallback) {
+    TotalTimeScope totalTime(m_recorder);
+    try {
+        return ScanIntoModel(rootPath, maxDepth, format, model, expandSymlinks, stopToken, progressCallback);
     }
-    visitedPaths.insert(pathKey);
-    
+    catch (const std::exception&) {
+        model.Clear();
+        return {false, L"", L"Ошибка при построении дерева директорий"};
+    }
+}
+
+BuildTreeResult DirectoryTreeBuilder::BuildSubtreeModel(const std::wstring& rootPath, int maxDepth,
+                                                        const SubtreeAncestry& ancestry, TreeModel& model,
+                                                        bool expandSymlinks, StopToken* stopToken) {
+    TotalTimeScope totalTime(m_recorder);
     try {
-        struct SortableEntry {
-            std::filesystem::directory_entry entry;
-            bool isDirectory;
-            std::wstring lowerName;
-        };
-
-        std::vector<SortableEntry> entries;
-        std::filesystem::directory_options options = std::filesystem::directory_options::skip_permission_denied;
-        std::filesystem::directory_iterator iterator(path, options, ec);
-        if (ec) {
-            visitedPaths.erase(pathKey);
-            return node;
-        }
-
-        for (const auto& entry : iterator) {
-            // Check for cancellation during directory iteration
-            if (shouldCancel && shouldCancel()) {
-                visitedPaths.erase(pathKey);
-                return node;
-            }
+        return ScanIntoModel(rootPath, maxDepth, TreeFormat::TEXT, model, expandSymlinks, stopToken, nullptr, &ancestry);
+    }
+    catch (const std::exception&) {
+        model.Clear();
+        return {false, L"", L"Ошибка при построении дерева директорий"};
+    }
+}
 
-            std::error_code typeEc;
-            const bool isEntryDirectory = entry.is_directory(typeEc) && !typeEc;
-            std::wstring lowerName = entry.path().filename().wstring();
-            std::transform(lowerName.begin(), lowerName.end(), lowerName.begin(),
-                           [](wchar_t ch) { return static_cast<wchar_t>(towlower(ch)); });
-
-            entries.push_back(SortableEntry{entry, isEntryDirectory, std::move(lowerName)});
-        }
-        
-        std::sort(entries.begin(), entries.end(), 
-                 [](const SortableEntry& a, const SortableEntry& b) {
-                     if (a.isDirectory != b.isDirectory) {
-                         return a.isDirectory > b.isDirectory;
-                     }
-
-                     return a.lowerName < b.lowerName;
-                 });
-        
-        node.children.reserve(entries.size());
-
-        for (const auto& sortableEntry : entries) {
-            // Check for cancellation before processing each entry
-            if (shouldCancel && shouldCancel()) {
-                visitedPaths.erase(pathKey);
-                return node;
-            }
+BuildTreeResult DirectoryTreeBuilder::BuildTreeWithRenderer(const std::wstring& rootPath, int maxDepth, TreeFormat format,
+                                                            TreeRenderer& renderer, bool expandSymlinks,
+                                                            StopToken* stopToken,
+                                                            const std::function<void(const std::wstring&)>& progressCallback) {
+    TotalTimeScope totalTime(m_recorder);
+    try {
+        TreeModel model;
+        BuildTreeResult result = ScanIntoModel(rootPath, maxDepth, format, model, expandSymlinks, stopToken, progressCallback);
+        if (!result.success) {
+            return result;
+        }
 
-            std::error_code symlinkEc;
-            if (!expandSymlinks && sortableEntry.entry.is_symlink(symlinkEc) && !symlinkEc) {
-                std::error_code targetTypeEc;
-                const bool targetIsDirectory = sortableEntry.entry.is_directory(targetTypeEc) && !targetTypeEc;
-                node.children.emplace_back(sortableEntry.entry.path().filename().wstring(), targetIsDirectory);
-                ++processedCount;
-                if (progressCallback && processedCount % 10 == 0) {
-                    std::wstring progress{L"Обработано элементов: "};
-                    progress.reserve(progress.length() + 10);
-                    progress += std::to_wstring(processedCount);
-                    progressCallback(progress);
-                }
-                continue;
-            }
-            
-            node.children.emplace_back(BuildNodeTree(sortableEntry.entry.path(), currentDepth + 1, maxDepth,
-                                                         expandSymlinks,
-                                                         shouldCancel, progressCallback, processedCount, visitedPaths));
-            
-            // Update progress
-            ++processedCount;
-            if (progressCallback && processedCount % 10 == 0) { // Report progress every 10 items
-                std::wstring progress{L"Обработано элементов: "};
-                progress.reserve(progress.length() + 10); // Reserve space for number
-                progress += std::to_wstring(processedCount);
-                progressCallback(progress);
-            }
+        PhaseScope render(m_recorder, TraversalPhase::Render);
+        // Only a stop token can cut the replay short.
+        renderer.SetStopToken(stopToken);
+        if (!renderer.RenderModel(model)) {
+            return {false, L"", StopMessage(*stopToken)};
+        }
+        if (!renderer.Flush()) {
+            return {false, L"", L"Ошибка записи результата"};
         }
+        return {true, L"", L""};
     }
     catch (const std::exception&) {
-        // Handle filesystem exceptions silently
+        return {false, L"", L"Ошибка при построении дерева директорий"};
     }
+}
 
-    visitedPaths.erase(pathKey);
-    
-    return node;
-}
-
-void DirectoryTreeBuilder::RenderTreeToBuffer(const TreeNode& node, const std::wstring& prefix, bool isLast, std::wstring& out) {
-    out += prefix;
-    out += isLast ? TREE_LAST : TREE_BRANCH;
-    out += node.name;
-    if (node.isDirectory) {
-        out += L"/";
-    }
-    out += L"\r\n";
-
-    std::wstring newPrefix{prefix + (isLast ? TREE_SPACE : TREE_VERTICAL)};
-    for (size_t i = 0; i < node.children.size(); ++i) {
-        bool childIsLast = (i == node.children.size() - 1);
-        RenderTreeToBuffer(node.children[i], newPrefix, childIsLast, out);
-    }
-}
-
-std::wstring DirectoryTreeBuilder::RenderTreeAsJson(const TreeNode& root, int indent) {
-    std::wstring result;
-    result.reserve(1024); // JSON needs more space due to structure overhead
-    
-    const std::wstring indentStr = GetIndent(indent);
-    
-    result += indentStr;
-    result += L"{\r\n";
-    result += indentStr;
-    result += L"  \"name\": \"";
-    result += EscapeJsonString(root.name);
-    result += L"\",\r\n";
-    result += indentStr;
-    result += L"  \"type\": \"";
-    result += (root.isDirectory ? L"directory" : L"file");
-    result += L"\"";
-    
-    if (!root.children.empty()) {
-        result += L",\r\n";
-        result += indentStr;
-        result += L"  \"children\": [\r\n";
-        
-        for (size_t i = 0; i < root.children.size(); ++i) {
-            result += RenderTreeAsJson(root.children[i], indent + 2);
-            if (i < root.children.size() - 1) {
-                result += L",";
-            }
-            result += L"\r\n";
+BuildTreeResult DirectoryTreeBuilder::ScanIntoModel(const std::wstring& rootPath, int maxDepth, TreeFormat format,
+                                                    TreeModel& model, bool expandSymlinks,
+                                                    StopToken* stopToken,
+                                                    const std::function<void(const std::wstring&)>& progressCallback,
+                                                    const SubtreeAncestry* ancestry) {
+    StopToken localStop;
+    StopToken& stop = stopToken ? *stopToken : localStop;
+    model.Clear();
+
+    std::filesystem::path path(ToNativePath(rootPath));
+    if (!std::filesystem::exists(path)) {
+        return {false, L"", L"Путь не существует: " + rootPath};
+    }
+
+    if (stop.StopRequested()) {
+        return {false, L"", StopMessage(stop)};
+    }
+
+    NameString rootName = path.filename().native();
+    if (rootName.empty()) {
+        rootName = path.native();
+    }
+
+    TraversalProgress localProgress;
+    TraversalProgress& progress = m_progress ? *m_progress : localProgress;
+    progress.Reset();
+
+    if (format == TreeFormat::TEXT) {
+        // The text view always lists the root, whatever the depth limit is. The structured
+        // formats do not at depth 0, which the mark leaves to their renderers.
+        model.AddRoot(rootName, true);
+        if (maxDepth == 0) {
+            model.SetTextOnlyChildren(model.Root());
+        }
+        bool rootListed = false;
+        if (!BuildNodeTree(model, path, false, rootListed, maxDepth, expandSymlinks, progress, stop, progressCallback,
+                           ancestry)) {
+            model.Clear();
+            return {false, L"", StopMessage(stop)};
+        }
+        if (!rootListed) {
+            model.Clear();
+            return {false, L"", L"Не удалось открыть каталог: " + rootPath};
         }
-        
-        result += indentStr;
-        result += L"  ]\r\n";
     } else {
-        result += L"\r\n";
+        std::error_code ec;
+        const uint32_t root = model.AddRoot(rootName, std::filesystem::is_directory(path, ec) && !ec);
+        if (model.Node(root).isDirectory && (maxDepth < 0 || maxDepth > 0)) {
+            bool rootListed = false;
+            BuildNodeTree(model, path, true, rootListed, maxDepth, expandSymlinks, progress, stop, progressCallback,
+                          nullptr);
+        }
+
+        if (stop.StopRequested()) {
+            model.Clear();
+            return {false, L"", StopMessage(stop)};
+        }
     }
-    
-    result += indentStr;
-    result += L"}";
-    return result;
+    return {true, L"", L""};
 }
 
-std::wstring DirectoryTreeBuilder::RenderTreeAsXml(const TreeNode& root, int indent) {
-    std::wstring result;
-    result.reserve(512); // XML needs more space for tags and attributes
-    
-    if (indent == 0) {
-        result += L"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\r\n";
-    }
-    
-    const std::wstring indentStr = GetIndent(indent);
-    const std::wstring elementName = root.isDirectory ? L"directory" : L"file";
-    
-    result += indentStr;
-    result += L"<";
-    result += elementName;
-    result += L" name=\"";
-    result += EscapeXmlString(root.name);
-    result += L"\"";
-    
-    if (root.children.empty()) {
-        result += L"/>";
-    } else {
-        result += L">\r\n";
-        
-        for (const auto& child : root.children) {
-            result += RenderTreeAsXml(child, indent + 1);
-            result += L"\r\n";
-        }
-        
-        result += indentStr;
-        result += L"</";
-        result += elementName;
-        result += L">";
-    }
-    
-    return result;
+BuildTreeResult DirectoryTreeBuilder::StreamTreeWithRenderer(const std::wstring& rootPath, int maxDepth, TreeFormat format,
+                                                             TreeRenderer& renderer, bool expandSymlinks,
+                                                             StopToken* stopToken,
+                                                             const std::function<void(const std::wstring&)>& progressCallback) {
+    TotalTimeScope totalTime(m_recorder);
+    StopToken localStop;
+    StopToken& stop = stopToken ? *stopToken : localStop;
+    try {
+        std::filesystem::path path(ToNativePath(rootPath));
+        if (!std::filesystem::exists(path)) {
+            return {false, L"", L"Путь не существует: " + rootPath};
+        }
+
+        TraversalProgress localProgress;
+        TraversalProgress& progress = m_progress ? *m_progress : localProgress;
+        progress.Reset();
+
+        DescriptorBudget descriptors(m_descriptorBudget);
+        StreamContext context{maxDepth, expandSymlinks, *m_reader, m_cache, &renderer, stop,
+                              ProgressReporter(progressCallback, m_progressInterval),
+                              TracksAncestors(expandSymlinks), m_recorder, progress, descriptors, m_listingHook, 0, {}};
+        if (stop.CheckLimits(0)) {
+            return {false, L"", StopMessage(stop)};
+        }
+
+        NameString rootName = path.filename().native();
+        if (rootName.empty()) {
+            rootName = path.native();
+        }
+
+        // Same root rules as BuildTreeToSink: the text view always lists the root and does not
+        // count it as an ancestor, the structured formats honour the depth limit for it.
+        bool rootIsDirectory = true;
+        bool listRoot = true;
+        if (format != TreeFormat::TEXT) {
+            std::error_code ec;
+            rootIsDirectory = std::filesystem::is_directory(path, ec) && !ec;
+            listRoot = rootIsDirectory && (maxDepth < 0 || maxDepth > 0);
+        }
+
+        // Listing, stat and sort time is carved out of the render phase as it happens.
+        PhaseScope render(m_recorder, TraversalPhase::Render);
+        ListedContents rootContents;
+        DirectoryHandle rootHandle;
+        if (listRoot) {
+            const bool keepOpen = m_reader->OpensRelative() && (maxDepth < 0 || maxDepth > 1) &&
+                                  descriptors.TryAcquire();
+            const DirectoryPlace rootPlace(path);
+            NotifyListing(m_listingHook, rootPlace);
+            const bool rootListed = ListDirectory(*m_reader, m_cache, rootPlace, stop.Flag(), rootContents,
+                                                  m_recorder, keepOpen ? &rootHandle : nullptr);
+            if (keepOpen && !rootHandle.Valid()) {
+                descriptors.Release();
+            }
+            if (format == TreeFormat::TEXT && !rootListed) {
+                return {false, L"", L"Не удалось открыть каталог: " + rootPath};
+            }
+            if (format != TreeFormat::TEXT && context.trackAncestors) {
+                context.ancestors.push_back(QueryFileIdentity(path));
+            }
+        }
+
+        renderer.BeginNode(rootName, rootIsDirectory, !rootContents.Get().Empty(), true);
+        if (!StreamChildren(context, path, rootContents, rootHandle)) {
+            return {false, L"", StopMessage(stop)};
+        }
+        renderer.EndNode();
+
+        if (!renderer.Flush()) {
+            return {false, L"", L"Ошибка записи результата"};
+        }
+        return {true, L"", L""};
+    }
+    catch (const std::exception&) {
+        return {false, L"", L"Ошибка при построении дерева директорий"};
+    }
 }
 
-std::wstring DirectoryTreeBuilder::EscapeJsonString(const std::wstring& str) {
-    std::wstring result;
-    result.reserve(str.length() * 2);
-    
-    for (wchar_t c : str) {
-        switch (c) {
-            case L'"': result += L"\\\""; break;
-            case L'\\': result += L"\\\\"; break;
-            case L'/': result += L"\\/"; break;
-            case L'\b': result += L"\\b"; break;
-            case L'\f': result += L"\\f"; break;
-            case L'\n': result += L"\\n"; break;
-            case L'\r': result += L"\\r"; break;
-            case L'\t': result += L"\\t"; break;
-            default:
-                if (c < 32) {
-                    wchar_t unicodeEscape[10];
-                    swprintf_s(unicodeEscape, L"\\u%04X", static_cast<unsigned int>(c));
-                    result += unicodeEscape;
-                } else {
-                    result += c;
-                }
-                break;
+bool DirectoryTreeBuilder::BuildNodeTree(TreeModel& model, const std::filesystem::path& path, bool trackRoot, bool& rootListed,
+                                         int maxDepth, bool expandSymlinks, TraversalProgress& progress, StopToken& stop,
+                                         const std::function<void(const std::wstring&)>& progressCallback,
+                                         const SubtreeAncestry* ancestry) {
+    // Declared before the pool: its tasks release descriptors until they finish.
+    DescriptorBudget descriptors(m_descriptorBudget);
+    WorkStealingPool pool(m_workerCount);
+    ScanContext context{maxDepth, expandSymlinks, TracksAncestors(expandSymlinks), m_reader.get(), m_cache, &pool, &model,
+                        m_recorder != nullptr, {}, {}, &stop, &progress, &descriptors, &m_listingHook,
+                        FileIdentity{0, 0, false}, nullptr, nullptr, {false}};
+
+    // The root is listed on the calling thread so that a failure to open it can be reported;
+    // every subdirectory below it becomes a pool task.
+    FileIdentity rootIdentity{0, 0, false};
+    if (context.trackAncestors) {
+        if (trackRoot) {
+            rootIdentity = QueryFileIdentity(path);
+        } else if (ancestry) {
+            // The scanned directory is one of the outer build's ancestors, its root is not.
+            context.outerAncestors = &ancestry->ancestors;
+            context.textRootIdentity = ancestry->root;
+        } else {
+            context.textRootIdentity = QueryFileIdentity(path);
         }
     }
-    
-    return result;
+    rootListed = ScanDirectoryTask(context, model.Root(), std::make_shared<DirectoryLink>(path, rootIdentity, nullptr), 0);
+
+    // The workers only bump the counters; the callback is driven from this polling loop.
+    ProgressReporter reporter(progressCallback, m_progressInterval);
+    for (;;) {
+        const bool idle = pool.WaitIdle(kProgressPollInterval);
+
+        // Cancellation needs no polling; deadlines are checked at this loop's rate.
+        stop.CheckLimits(progress.processedEntries.load(std::memory_order_relaxed));
+
+        reporter.Report(progress.processedEntries.load(std::memory_order_relaxed));
+
+        if (idle) {
+            break;
+        }
+    }
+
+    if (context.failed.load()) {
+        std::rethrow_exception(context.failure);
+    }
+    if (m_recorder) {
+        m_recorder->Stats().Merge(context.stats);
+    }
+    return !stop.StopRequested();
 }
 
-std::wstring DirectoryTreeBuilder::EscapeXmlString(const std::wstring& str) {
-    std::wstring result;
-    result.reserve(str.length() * 2);
-    
-    for (wchar_t c : str) {
-        switch (c) {
-            case L'&': result += L"&amp;"; break;
-            case L'<': result += L"&lt;"; break;
-            case L'>': result += L"&gt;"; break;
-            case L'"': result += L"&quot;"; break;
-            case L'\'': result += L"&apos;"; break;
-            default: result += c; break;
+bool DirectoryTreeBuilder::ScanDirectoryTask(ScanContext& context, uint32_t nodeIndex,
+                                             const std::shared_ptr<DirectoryLink>& link, int depth) {
+    try {
+        return ScanDirectory(context, nodeIndex, link, depth);
+    }
+    catch (...) {
+        std::lock_guard<std::mutex> lock(context.modelMutex);
+        if (!context.failure) {
+            context.failure = std::current_exception();
         }
+        context.failed.store(true);
+        return false;
     }
-    
-    return result;
 }
 
-std::wstring DirectoryTreeBuilder::GetIndent(int level) {
-    return std::wstring(level * 2, L' ');
+bool DirectoryTreeBuilder::ScanDirectory(ScanContext& context, uint32_t nodeIndex, const std::shared_ptr<DirectoryLink>& link,
+                                         int depth) {
+    // This directory opening, or failing to, settles one pending open of the parent.
+    PendingOpenScope parentOpen(link->parent.get(), *context.descriptors);
+    if (context.stop->StopRequested() || context.failed.load(std::memory_order_relaxed)) {
+        return false;
+    }
+
+    context.progress->currentDepth.store(static_cast<uint32_t>(depth), std::memory_order_relaxed);
+
+    // Each task records into its own recorder; the totals are merged under the model lock.
+    TraversalRecorder localRecorder;
+    TraversalRecorder* recorder = context.collectStats ? &localRecorder : nullptr;
+
+    // Only a directory whose own subdirectories may be scanned is worth keeping open.
+    const int childDepth = depth + 1;
+    const bool keepOpen = context.reader->OpensRelative() &&
+                          (context.maxDepth < 0 || childDepth < context.maxDepth) &&
+                          context.descriptors->TryAcquire();
+    const DirectoryLink* parent = link->parent.get();
+    const DirectoryPlace place = parent ? DirectoryPlace(parent->handle, link->name, [&link]() { return link->Path(); })
+                                        : DirectoryPlace(link->name);
+    NotifyListing(*context.listingHook, place);
+    ListedContents listedContents;
+    const bool listed = ListDirectory(*context.reader, context.cache, place, context.stop->Flag(), listedContents, recorder,
+                                      keepOpen ? &link->handle : nullptr);
+    const DirectoryContents& contents = listedContents.Get();
+    // This directory is open now, or failed to open: the parent's descriptor is done with it.
+    parentOpen.Release();
+    // The directory's own scan; released last, it closes the descriptor if no child was queued.
+    PendingOpenScope ownOpen(link.get(), *context.descriptors);
+    if (keepOpen && !link->handle.Valid()) {
+        context.descriptors->Release();
+    }
+    if (!listed) {
+        if (recorder) {
+            std::lock_guard<std::mutex> lock(context.modelMutex);
+            context.stats.Merge(localRecorder.Stats());
+        }
+        return false;
+    }
+
+    if (recorder) {
+        for (size_t i = 0; i < contents.Size(); ++i) {
+            const EntryInfo& entry = contents.Entry(i);
+            if (entry.isDirectory && !ShouldDescend(entry, childDepth, context.maxDepth, context.expandSymlinks)) {
+                ++localRecorder.Stats().skipped;
+            }
+        }
+    }
+
+    // All children of a directory are appended in one critical section, so they occupy
+    // consecutive indices starting at firstChild.
+    uint32_t firstChild = TreeModel::kNoNode;
+    {
+        std::lock_guard<std::mutex> lock(context.modelMutex);
+        uint32_t previousSibling = TreeModel::kNoNode;
+        for (size_t i = 0; i < contents.Size(); ++i) {
+            previousSibling = context.model->AddChild(nodeIndex, previousSibling,
+                                                      contents.Name(i),
+                                                      contents.Entry(i).isDirectory,
+                                                      contents.Entry(i).isSymlink);
+            if (firstChild == TreeModel::kNoNode) {
+                firstChild = previousSibling;
+            }
+        }
+    }
+    const uint64_t processedEntries = context.progress->processedEntries.fetch_add(contents.Size(), std::memory_order_relaxed) + contents.Size();
+    // Children already queued see the tripped flag as soon as they start.
+    context.stop->CheckBudget(processedEntries);
+
+    for (size_t i = 0; i < contents.Size(); ++i) {
+        const EntryInfo& entry = contents.Entry(i);
+        if (!ShouldDescend(entry, childDepth, context.maxDepth, context.expandSymlinks)) {
+            continue;
+        }
+
+        std::filesystem::path childName(contents.Name(i));
+        FileIdentity childIdentity{0, 0, false};
+        if (context.trackAncestors) {
+            const DirectoryPlace childPlace(link->handle, childName,
+                                            [&link, &childName]() { return link->Path() / childName; });
+            childIdentity = EntryIdentity(entry, childPlace, recorder);
+            bool isCycle = false;
+            for (const DirectoryLink* ancestor = link.get(); ancestor; ancestor = ancestor->parent.get()) {
+                if (ancestor->identity == childIdentity) {
+                    isCycle = true;
+                    break;
+                }
+            }
+            if (!isCycle && context.outerAncestors) {
+                isCycle = std::find(context.outerAncestors->begin(), context.outerAncestors->end(), childIdentity) !=
+                          context.outerAncestors->end();
+            }
+            if (isCycle) {
+                if (recorder) {
+                    ++localRecorder.Stats().cyclesBroken;
+                }
+                continue;
+            }
+        }
+
+        const uint32_t childIndex = firstChild + static_cast<uint32_t>(i);
+        if (childIdentity == context.textRootIdentity) {
+            std::lock_guard<std::mutex> lock(context.modelMutex);
+            context.model->SetTextOnlyChildren(childIndex);
+        }
+        auto childLink = std::make_shared<DirectoryLink>(std::move(childName), childIdentity, link);
+        link->pendingOpens.fetch_add(1, std::memory_order_relaxed);
+        try {
+            context.pool->Submit([this, &context, childIndex, childDepth, childLink = std::move(childLink)]() {
+                ScanDirectoryTask(context, childIndex, childLink, childDepth);
+            });
+        }
+        catch (...) {
+            // The child will never open; its pending open is given back here.
+            link->ReleaseOpen(*context.descriptors);
+            throw;
+        }
+    }
+
+    if (recorder) {
+        std::lock_guard<std::mutex> lock(context.modelMutex);
+        context.stats.Merge(localRecorder.Stats());
+    }
+    return true;
 }
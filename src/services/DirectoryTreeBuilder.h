@@ -1,28 +1,23 @@
 #pragma once
 
+#include "DirectoryReader.h"
+#include "FileIdentity.h"
+#include "StopToken.h"
+#include "TraversalProgress.h"
+#include "TraversalStats.h"
+#include "TreeModel.h"
+#include "TreeRenderer.h"
+
+#include <atomic>
+#include <chrono>
+#include <exception>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <filesystem>
 #include <functional>
-#include <unordered_set>
-
-enum class TreeFormat {
-    TEXT,
-    JSON,
-    XML
-};
-
-struct TreeNode {
-    std::wstring name;
-    bool isDirectory;
-    std::vector<TreeNode> children;
-    
-    TreeNode(const std::wstring& nodeName, bool isDir) 
-        : name(nodeName), isDirectory(isDir) {}
-    
-    TreeNode(std::wstring&& nodeName, bool isDir) 
-        : name(std::move(nodeName)), isDirectory(isDir) {}
-};
+#include <memory>
+#include <mutex>
 
 struct BuildTreeResult {
     bool success;
@@ -30,45 +25,204 @@ struct BuildTreeResult {
     std::wstring errorMessage;
 };
 
+// Where a directory sits inside a larger text build, for scanning it on its own with that
+// build's cycle rules (see DirectoryTreeBuilder::BuildSubtreeModel()).
+struct SubtreeAncestry {
+    // The directory itself and the directories above it, outermost first, the root excluded
+    // as the text view does not count it as an ancestor.
+    std::vector<FileIdentity> ancestors;
+    FileIdentity root;
+};
+
+class DirectoryCache;
+class WorkStealingPool;
+
 class DirectoryTreeBuilder {
 public:
-    DirectoryTreeBuilder();
+    // workerCount == 0 sizes the traversal pool to the hardware concurrency. Without a reader
+    // the platform default from DirectoryReader::CreateDefault() is used.
+    explicit DirectoryTreeBuilder(size_t workerCount = 0, std::unique_ptr<DirectoryReader> reader = nullptr);
     ~DirectoryTreeBuilder();
 
+    // Listings of the following builds are looked up in and added to cache, which must outlive
+    // them; nullptr, the default, reads every directory afresh.
+    void SetDirectoryCache(DirectoryCache* cache);
+
+    // Statistics of every following build are added to recorder, which must outlive them. The
+    // recorder is also lent to the output sink unless the sink already has one. nullptr, the
+    // default, turns collection off.
+    void SetStatsRecorder(TraversalRecorder* recorder);
+
+    // Counters of the following builds are published to progress, which must outlive them and
+    // may be polled from any thread. Like the recorder, it is lent to the output sink.
+    void SetProgress(TraversalProgress* progress);
+    // Minimum time between two progressCallback calls; the default is 50 ms.
+    void SetProgressInterval(std::chrono::milliseconds interval);
+
+    // Most directories a build keeps open at once, so that their entries are opened and queried
+    // relative to them instead of by full path; past it the build falls back to paths, and 0
+    // always uses them. Only readers with DirectoryReader::OpensRelative() use descriptors.
+    // Defaults to DescriptorBudget::Default().
+    void SetDescriptorBudget(size_t count);
+
+    // Called with the path of every directory the following builds list, before its listing
+    // starts; from the traversal threads, so possibly concurrently. nullptr, the default, turns
+    // it off.
+    void SetListingHook(std::function<void(const std::filesystem::path&)> hook);
+
     BuildTreeResult BuildTree(const std::wstring& rootPath, int maxDepth, TreeFormat format,
                               bool expandSymlinks = false,
-                              std::function<bool()> shouldCancel = nullptr,
+                              StopToken* stopToken = nullptr,
                               std::function<void(const std::wstring&)> progressCallback = nullptr);
 
+    // Renders straight into sink; the returned result carries no content.
+    BuildTreeResult BuildTreeToSink(const std::wstring& rootPath, int maxDepth, TreeFormat format,
+                                    TreeOutputSink& sink,
+                                    bool expandSymlinks = false,
+                                    StopToken* stopToken = nullptr,
+                                    std::function<void(const std::wstring&)> progressCallback = nullptr);
+
+    // Single pass: walks, renders and writes depth-first without materializing the tree, so
+    // memory stays proportional to the depth and the width of the open directories.
+    BuildTreeResult StreamTreeToSink(const std::wstring& rootPath, int maxDepth, TreeFormat format,
+                                     TreeOutputSink& sink,
+                                     bool expandSymlinks = false,
+                                     StopToken* stopToken = nullptr,
+                                     std::function<void(const std::wstring&)> progressCallback = nullptr);
+
+    // UTF-8 variants: the renderers write encoded bytes directly, no wide intermediate text.
+    BuildTreeResult BuildTreeToSink(const std::wstring& rootPath, int maxDepth, TreeFormat format,
+                                    Utf8OutputSink& sink,
+                                    bool expandSymlinks = false,
+                                    StopToken* stopToken = nullptr,
+                                    std::function<void(const std::wstring&)> progressCallback = nullptr);
+    BuildTreeResult StreamTreeToSink(const std::wstring& rootPath, int maxDepth, TreeFormat format,
+                                     Utf8OutputSink& sink,
+                                     bool expandSymlinks = false,
+                                     StopToken* stopToken = nullptr,
+                                     std::function<void(const std::wstring&)> progressCallback = nullptr);
+
+    // Scans into model without rendering it, following the root rules of format: a TEXT model
+    // always has the root listed, JSON and XML honour the depth limit for it. The model can be
+    // rendered in any format later or saved as a snapshot; it is left empty on failure. A TEXT
+    // model marks what only its rules list, so its JSON and XML renders match those builds.
+    BuildTreeResult BuildTreeModel(const std::wstring& rootPath, int maxDepth, TreeFormat format,
+                                   TreeModel& model,
+                                   bool expandSymlinks = false,
+                                   StopToken* stopToken = nullptr,
+                                   std::function<void(const std::wstring&)> progressCallback = nullptr);
+
+    // TEXT model of a directory inside a larger text build of the same settings: links back to
+    // ancestry's directories are cut and links to its root marked exactly as that build does,
+    // so the result matches the directory's part of a fresh build of the whole tree. Only
+    // builds that track ancestors, that is that follow links, look at ancestry.
+    BuildTreeResult BuildSubtreeModel(const std::wstring& rootPath, int maxDepth, const SubtreeAncestry& ancestry,
+                                      TreeModel& model,
+                                      bool expandSymlinks = false,
+                                      StopToken* stopToken = nullptr);
+
 private:
-    bool RenderTreeFromPath(const std::filesystem::path& path,
-                            const std::wstring& prefix,
-                            bool isLast,
-                            int currentDepth,
-                            int maxDepth,
-                            bool expandSymlinks,
-                            std::wstring& out,
-                            std::function<bool()> shouldCancel,
-                            std::function<void(const std::wstring&)> progressCallback,
-                            int& processedCount,
-                            std::unordered_set<std::wstring>& visitedPaths);
-
-    TreeNode BuildNodeTree(const std::filesystem::path& path, int currentDepth, int maxDepth,
-                                 bool expandSymlinks,
-                                 std::function<bool()> shouldCancel,
-                                 std::function<void(const std::wstring&)> progressCallback,
-                                 int& processedCount,
-                                 std::unordered_set<std::wstring>& visitedPaths);
-    void RenderTreeToBuffer(const TreeNode& node, const std::wstring& prefix, bool isLast, std::wstring& out);
-    std::wstring RenderTreeAsJson(const TreeNode& root, int indent = 0);
-    std::wstring RenderTreeAsXml(const TreeNode& root, int indent = 0);
-    
-    std::wstring EscapeJsonString(const std::wstring& str);
-    std::wstring EscapeXmlString(const std::wstring& str);
-    std::wstring GetIndent(int level);
-
-    static const wchar_t* TREE_BRANCH;
-    static const wchar_t* TREE_LAST;
-    static const wchar_t* TREE_VERTICAL;
-    static const wchar_t* TREE_SPACE;
+    // A directory of the parallel scan and, through parent, the chain of directories above it;
+    // shared between the tasks of one branch. Each link names its directory relative to the
+    // parent (the root's link holds the whole path), so full paths are joined only when needed.
+    struct DirectoryLink {
+        std::filesystem::path name;
+        // Valid only when ancestors are tracked; compared along the chain to break cycles.
+        FileIdentity identity;
+        // Kept open while the children are opened relative to it. pendingOpens counts the
+        // directory's own scan and the children that have not opened yet; the last one closes it.
+        DirectoryHandle handle;
+        std::atomic<uint32_t> pendingOpens;
+        std::shared_ptr<DirectoryLink> parent;
+
+        DirectoryLink(std::filesystem::path linkName, FileIdentity linkIdentity, std::shared_ptr<DirectoryLink> linkParent);
+        ~DirectoryLink();
+
+        std::filesystem::path Path() const;
+        void ReleaseOpen(DescriptorBudget& descriptors);
+    };
+
+    // Gives back one pending open of a link when the scope is left, by an exception too,
+    // unless Release() has done so already.
+    class PendingOpenScope {
+    public:
+        PendingOpenScope(DirectoryLink* link, DescriptorBudget& descriptors)
+            : m_link(link)
+            , m_descriptors(descriptors) {
+        }
+        ~PendingOpenScope() { Release(); }
+
+        PendingOpenScope(const PendingOpenScope&) = delete;
+        PendingOpenScope& operator=(const PendingOpenScope&) = delete;
+
+        void Release() {
+            if (m_link) {
+                m_link->ReleaseOpen(m_descriptors);
+                m_link = nullptr;
+            }
+        }
+
+    private:
+        DirectoryLink* m_link;
+        DescriptorBudget& m_descriptors;
+    };
+
+    struct ScanContext {
+        int maxDepth;
+        bool expandSymlinks;
+        bool trackAncestors;
+        const DirectoryReader* reader;
+        DirectoryCache* cache;
+        WorkStealingPool* pool;
+        TreeModel* model;
+        bool collectStats;
+        // Guarded by modelMutex.
+        TraversalStats stats;
+        std::mutex modelMutex;
+        StopToken* stop;
+        TraversalProgress* progress;
+        DescriptorBudget* descriptors;
+        const std::function<void(const std::filesystem::path&)>* listingHook;
+        // Text builds only, where the root is no ancestor: directories with this identity lead
+        // back to the root and are marked with textOnlyChildren.
+        FileIdentity textRootIdentity;
+        // Subtree builds only: the directories above the scanned one, also checked for cycles.
+        const std::vector<FileIdentity>* outerAncestors;
+        // The first exception of a scan task, guarded by modelMutex. Once failed is set the
+        // remaining tasks wind down and BuildNodeTree() rethrows it.
+        std::exception_ptr failure;
+        std::atomic<bool> failed;
+    };
+
+    BuildTreeResult BuildTreeWithRenderer(const std::wstring& rootPath, int maxDepth, TreeFormat format,
+                                          TreeRenderer& renderer, bool expandSymlinks,
+                                          StopToken* stopToken,
+                                          const std::function<void(const std::wstring&)>& progressCallback);
+    BuildTreeResult ScanIntoModel(const std::wstring& rootPath, int maxDepth, TreeFormat format,
+                                  TreeModel& model, bool expandSymlinks,
+                                  StopToken* stopToken,
+                                  const std::function<void(const std::wstring&)>& progressCallback,
+                                  const SubtreeAncestry* ancestry = nullptr);
+    BuildTreeResult StreamTreeWithRenderer(const std::wstring& rootPath, int maxDepth, TreeFormat format,
+                                           TreeRenderer& renderer, bool expandSymlinks,
+                                           StopToken* stopToken,
+                                           const std::function<void(const std::wstring&)>& progressCallback);
+    bool BuildNodeTree(TreeModel& model, const std::filesystem::path& path, bool trackRoot, bool& rootListed,
+                       int maxDepth, bool expandSymlinks, TraversalProgress& progress, StopToken& stop,
+                       const std::function<void(const std::wstring&)>& progressCallback,
+                       const SubtreeAncestry* ancestry);
+    bool ScanDirectory(ScanContext& context, uint32_t nodeIndex, const std::shared_ptr<DirectoryLink>& link, int depth);
+    // ScanDirectory() that records an exception in the context instead of throwing, so that a
+    // failed task fails the whole scan rather than leaving a silently truncated tree.
+    bool ScanDirectoryTask(ScanContext& context, uint32_t nodeIndex, const std::shared_ptr<DirectoryLink>& link,
+                           int depth);
+
+    size_t m_workerCount;
+    std::unique_ptr<DirectoryReader> m_reader;
+    DirectoryCache* m_cache;
+    TraversalRecorder* m_recorder;
+    TraversalProgress* m_progress;
+    std::chrono::milliseconds m_progressInterval;
+    size_t m_descriptorBudget;
+    std::function<void(const std::filesystem::path&)> m_listingHook;
 };
@@ -0,0 +1,97 @@
+#include "DirectoryWatcher.h"
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+std::unique_ptr<DirectoryWatcher> DirectoryWatcher::CreateDefault() {
+#ifdef __linux__
+    auto watcher = std::make_unique<InotifyDirectoryWatcher>();
+    if (watcher->IsOpen()) {
+        return watcher;
+    }
+#endif
+    return nullptr;
+}
+
+#ifdef __linux__
+namespace {
+constexpr uint32_t kWatchMask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+                                IN_ONLYDIR;
+// Room for many events per read; a single event never exceeds sizeof(inotify_event) + NAME_MAX + 1.
+constexpr size_t kEventBufferBytes = 64 * 1024;
+}
+
+InotifyDirectoryWatcher::InotifyDirectoryWatcher()
+    : m_fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+    , m_buffer(kEventBufferBytes) {
+}
+
+InotifyDirectoryWatcher::~InotifyDirectoryWatcher() {
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+int InotifyDirectoryWatcher::Add(const std::filesystem::path& directory) {
+    const int watch = inotify_add_watch(m_fd, directory.c_str(), kWatchMask);
+    return watch < 0 ? kInvalidWatch : watch;
+}
+
+void InotifyDirectoryWatcher::Remove(int watch) {
+    // Fails harmlessly when the kernel already dropped the watch with its directory.
+    inotify_rm_watch(m_fd, watch);
+}
+
+bool InotifyDirectoryWatcher::Wait(std::vector<WatchEvent>& events, std::chrono::milliseconds timeout) {
+    pollfd descriptor{m_fd, POLLIN, 0};
+    const int ready = poll(&descriptor, 1, static_cast<int>(timeout.count()));
+    if (ready < 0) {
+        return errno == EINTR;
+    }
+    if (ready == 0) {
+        return true;
+    }
+
+    for (;;) {
+        const ssize_t length = read(m_fd, m_buffer.data(), m_buffer.size());
+        if (length < 0) {
+            return errno == EAGAIN || errno == EINTR;
+        }
+
+        for (ssize_t offset = 0; offset < length;) {
+            inotify_event header;
+            std::memcpy(&header, m_buffer.data() + offset, sizeof(header));
+            const char* name = m_buffer.data() + offset + sizeof(header);
+            offset += static_cast<ssize_t>(sizeof(header) + header.len);
+
+            WatchEventType type;
+            if (header.mask & IN_Q_OVERFLOW) {
+                type = WatchEventType::Overflow;
+            } else if (header.mask & IN_CREATE) {
+                type = WatchEventType::Created;
+            } else if (header.mask & IN_DELETE) {
+                type = WatchEventType::Deleted;
+            } else if (header.mask & IN_MOVED_FROM) {
+                type = WatchEventType::MovedFrom;
+            } else if (header.mask & IN_MOVED_TO) {
+                type = WatchEventType::MovedTo;
+            } else if (header.mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                type = WatchEventType::DirectoryGone;
+            } else {
+                // IN_IGNORED and friends: the watch is already accounted for.
+                continue;
+            }
+
+            // The name is padded with NULs up to header.len.
+            const size_t nameLength = header.len > 0 ? strnlen(name, header.len) : 0;
+            events.push_back(WatchEvent{type, header.wd, (header.mask & IN_ISDIR) != 0, header.cookie,
+                                        NameString(name, nameLength)});
+        }
+    }
+}
+#endif
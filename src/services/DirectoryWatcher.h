@@ -0,0 +1,70 @@
+#pragma once
+
+#include "TreeName.h"
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum class WatchEventType : uint8_t {
+    Created,
+    Deleted,
+    MovedFrom,
+    MovedTo,
+    // The watched directory itself was deleted or moved; its watch is gone.
+    DirectoryGone,
+    // Events were dropped, so nothing watched can be trusted until it is read again.
+    Overflow
+};
+
+// One change inside a watched directory. name is the affected entry, empty for the events
+// about the directory itself.
+struct WatchEvent {
+    WatchEventType type;
+    int watch;
+    bool isDirectory;
+    // Pairs a MovedFrom with its MovedTo; 0 for the other events.
+    uint32_t cookie;
+    NameString name;
+};
+
+// Source of change notifications for the entries directly inside a set of directories.
+// A watcher is used from one thread at a time.
+class DirectoryWatcher {
+public:
+    static constexpr int kInvalidWatch = -1;
+
+    virtual ~DirectoryWatcher() = default;
+
+    // Starts reporting changes inside directory. Returns kInvalidWatch if it cannot be watched.
+    virtual int Add(const std::filesystem::path& directory) = 0;
+    virtual void Remove(int watch) = 0;
+
+    // Waits up to timeout for changes and appends everything pending to events. Returns false
+    // if the watcher itself failed.
+    virtual bool Wait(std::vector<WatchEvent>& events, std::chrono::milliseconds timeout) = 0;
+
+    // The backend of this platform, or nullptr where there is none.
+    static std::unique_ptr<DirectoryWatcher> CreateDefault();
+};
+
+#ifdef __linux__
+class InotifyDirectoryWatcher : public DirectoryWatcher {
+public:
+    InotifyDirectoryWatcher();
+    ~InotifyDirectoryWatcher() override;
+
+    bool IsOpen() const { return m_fd >= 0; }
+
+    int Add(const std::filesystem::path& directory) override;
+    void Remove(int watch) override;
+    bool Wait(std::vector<WatchEvent>& events, std::chrono::milliseconds timeout) override;
+
+private:
+    int m_fd;
+    std::vector<char> m_buffer;
+};
+#endif
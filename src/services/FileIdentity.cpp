@@ -0,0 +1,47 @@
+#include "FileIdentity.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+FileIdentity QueryFileIdentity(const std::filesystem::path& path, bool* isDirectory) {
+    FileIdentity identity{0, 0, false};
+    if (isDirectory) {
+        *isDirectory = false;
+    }
+
+#ifdef _WIN32
+    // FILE_FLAG_BACKUP_SEMANTICS is required to open a directory handle; no access rights are
+    // needed to read the file index.
+    HANDLE hFile = CreateFileW(path.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                               nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return identity;
+    }
+
+    BY_HANDLE_FILE_INFORMATION info;
+    if (GetFileInformationByHandle(hFile, &info)) {
+        identity.device = info.dwVolumeSerialNumber;
+        identity.index = (static_cast<uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+        identity.valid = true;
+        if (isDirectory) {
+            *isDirectory = (info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        }
+    }
+    CloseHandle(hFile);
+#else
+    struct stat info;
+    if (::stat(path.c_str(), &info) == 0) {
+        identity.device = static_cast<uint64_t>(info.st_dev);
+        identity.index = static_cast<uint64_t>(info.st_ino);
+        identity.valid = true;
+        if (isDirectory) {
+            *isDirectory = S_ISDIR(info.st_mode);
+        }
+    }
+#endif
+
+    return identity;
+}
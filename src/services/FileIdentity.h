@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+
+// Identity of a file object independent of the path used to reach it: (st_dev, st_ino) on
+// POSIX, volume serial number and file index on Windows.
+struct FileIdentity {
+    uint64_t device;
+    uint64_t index;
+    bool valid;
+
+    bool operator==(const FileIdentity& other) const {
+        return valid && other.valid && device == other.device && index == other.index;
+    }
+
+    bool operator!=(const FileIdentity& other) const {
+        return !(*this == other);
+    }
+};
+
+// Resolves symlinks. An identity that could not be read is never equal to anything. The
+// same query reports whether the target is a directory, so a followed link costs one call.
+FileIdentity QueryFileIdentity(const std::filesystem::path& path, bool* isDirectory = nullptr);
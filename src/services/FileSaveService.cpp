@@ -1,73 +1,86 @@
 #include "FileSaveService.h"
 
-#include "DirectoryTreeBuilder.h"
-
-#include <windows.h>
+#include "DirectoryReader.h"
+#include "RenderedTreeText.h"
+#include "TreeModel.h"
+#include "TreeOutputSink.h"
+#include "TreeRenderer.h"
 
 #include <cstring>
 #include <exception>
+#include <filesystem>
+#include <system_error>
 
 FileSaveService::FileSaveService()
-    : m_cancelRequested(false)
-    , m_running(false) {
+    : m_running(false) {
 }
 
 FileSaveService::~FileSaveService() {
     Cancel();
 }
 
-bool FileSaveService::SaveTextFileSync(const std::wstring& fileName, const std::wstring& content, std::wstring* errorMessage) const {
+bool FileSaveService::SaveTextFileSync(const std::wstring& fileName, const RenderedTreeText& content, std::wstring* errorMessage) const {
     return WriteUtf8File(fileName, content, errorMessage);
 }
 
-void FileSaveService::SaveTreeAsync(const std::wstring& fileName, const std::wstring& rootPath, int depth, TreeFormat format, bool expandSymlinks, CompletionCallback onCompleted, ErrorCallback onError) {
+void FileSaveService::SaveTreeAsync(const std::wstring& fileName, std::shared_ptr<const TreeModel> model, TreeFormat format, CompletionCallback onCompleted, ErrorCallback onError) {
     Cancel();
 
-    m_cancelRequested.store(false);
+    m_stopToken.Reset();
     m_running.store(true);
 
-    m_worker = std::thread([this, fileName, rootPath, depth, format, expandSymlinks, onCompleted = std::move(onCompleted), onError = std::move(onError)]() mutable {
+    m_worker = std::thread([this, fileName, model = std::move(model), format, onCompleted = std::move(onCompleted), onError = std::move(onError)]() mutable {
+        bool created = false;
         try {
-            DirectoryTreeBuilder builder;
-            BuildTreeResult buildResult = builder.BuildTree(rootPath, depth, format, expandSymlinks);
-            if (m_cancelRequested.load()) {
+            Utf8FileOutputSink sink(fileName);
+            if (!sink.IsOpen()) {
+                if (onError) {
+                    onError(L"Ошибка создания файла");
+                }
                 m_running.store(false);
                 return;
             }
-
-            if (!buildResult.success) {
-                if (onError) {
-                    onError(std::move(buildResult.errorMessage));
+            created = true;
+
+            // Cancel() stops the render between two nodes; the sink writes at most one buffer after that.
+            bool rendered = true;
+            if (model && !model->Empty()) {
+                std::unique_ptr<TreeRenderer> renderer = TreeRenderer::Create(format, sink);
+                renderer->SetStopToken(&m_stopToken);
+                rendered = renderer->RenderModel(*model);
+            }
+            const bool written = sink.Close();
+            if (rendered && written) {
+                if (onCompleted) {
+                    onCompleted();
                 }
                 m_running.store(false);
                 return;
             }
 
-            std::wstring errorMessage;
-            if (WriteUtf8File(fileName, buildResult.content, &errorMessage)) {
-                if (!m_cancelRequested.load() && onCompleted) {
-                    onCompleted();
-                }
-            } else {
-                if (!m_cancelRequested.load() && onError) {
-                    onError(std::move(errorMessage));
-                }
+            if (!m_stopToken.StopRequested() && onError) {
+                onError(L"Ошибка записи файла");
             }
         }
         catch (const std::exception& e) {
-            if (!m_cancelRequested.load() && onError) {
+            if (!m_stopToken.StopRequested() && onError) {
                 std::wstring error = L"Ошибка сохранения: ";
                 error += std::wstring(e.what(), e.what() + strlen(e.what()));
                 onError(std::move(error));
             }
         }
 
+        if (created) {
+            // Do not leave a truncated tree behind.
+            std::error_code ec;
+            std::filesystem::remove(ToNativePath(fileName), ec);
+        }
         m_running.store(false);
     });
 }
 
 void FileSaveService::Cancel() {
-    m_cancelRequested.store(true);
+    m_stopToken.RequestStop();
 
     if (m_worker.joinable()) {
         m_worker.join();
@@ -76,46 +89,22 @@ void FileSaveService::Cancel() {
     m_running.store(false);
 }
 
-bool FileSaveService::WriteUtf8File(const std::wstring& fileName, const std::wstring& content, std::wstring* errorMessage) {
-    HANDLE hFile = CreateFile(fileName.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
-    if (hFile == INVALID_HANDLE_VALUE) {
+bool FileSaveService::WriteUtf8File(const std::wstring& fileName, const RenderedTreeText& content, std::wstring* errorMessage) {
+    Utf8FileOutputSink sink(fileName);
+    if (!sink.IsOpen()) {
         if (errorMessage) {
             *errorMessage = L"Ошибка создания файла";
         }
         return false;
     }
 
-    const auto closeHandle = [&hFile]() {
-        if (hFile != INVALID_HANDLE_VALUE) {
-            CloseHandle(hFile);
-            hFile = INVALID_HANDLE_VALUE;
-        }
-    };
-
-    const int utf8Length = WideCharToMultiByte(CP_UTF8, 0, content.c_str(), -1, nullptr, 0, nullptr, nullptr);
-    if (utf8Length <= 0) {
-        closeHandle();
-        if (errorMessage) {
-            *errorMessage = L"Ошибка конвертации текста в UTF-8";
-        }
-        return false;
-    }
-
-    std::string utf8Content(static_cast<size_t>(utf8Length), '\0');
-    const int convertedLength = WideCharToMultiByte(CP_UTF8, 0, content.c_str(), -1, utf8Content.data(), utf8Length, nullptr, nullptr);
-    if (convertedLength != utf8Length) {
-        closeHandle();
-        if (errorMessage) {
-            *errorMessage = L"Ошибка конвертации текста в UTF-8";
-        }
-        return false;
-    }
-
-    const DWORD bytesToWrite = static_cast<DWORD>(utf8Content.size() - 1);
-    DWORD bytesWritten = 0;
-    const BOOL writeOk = WriteFile(hFile, utf8Content.data(), bytesToWrite, &bytesWritten, nullptr);
-    closeHandle();
-    if (!writeOk || bytesWritten != bytesToWrite) {
+    // Encoded chunk by chunk: the text is never joined, and no full-size UTF-8 copy is made.
+    Utf8EncodingSink encoder(sink);
+    content.WriteTo(encoder);
+    const bool encoded = encoder.Finish();
+    if (!sink.Close() || !encoded) {
+        std::error_code ec;
+        std::filesystem::remove(ToNativePath(fileName), ec);
         if (errorMessage) {
             *errorMessage = L"Ошибка записи файла";
         }
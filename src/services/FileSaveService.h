@@ -1,10 +1,15 @@
 #pragma once
 
+#include "StopToken.h"
+
 #include <atomic>
 #include <functional>
+#include <memory>
 #include <string>
 #include <thread>
 
+class RenderedTreeText;
+class TreeModel;
 enum class TreeFormat;
 
 class FileSaveService {
@@ -15,14 +20,15 @@ public:
     FileSaveService();
     ~FileSaveService();
 
-    bool SaveTextFileSync(const std::wstring& fileName, const std::wstring& content, std::wstring* errorMessage = nullptr) const;
-    void SaveTreeAsync(const std::wstring& fileName, const std::wstring& rootPath, int depth, TreeFormat format, bool expandSymlinks, CompletionCallback onCompleted, ErrorCallback onError);
+    bool SaveTextFileSync(const std::wstring& fileName, const RenderedTreeText& content, std::wstring* errorMessage = nullptr) const;
+    // Renders an already built tree in format; the file system is not read again.
+    void SaveTreeAsync(const std::wstring& fileName, std::shared_ptr<const TreeModel> model, TreeFormat format, CompletionCallback onCompleted, ErrorCallback onError);
     void Cancel();
 
 private:
-    static bool WriteUtf8File(const std::wstring& fileName, const std::wstring& content, std::wstring* errorMessage);
+    static bool WriteUtf8File(const std::wstring& fileName, const RenderedTreeText& content, std::wstring* errorMessage);
 
     std::thread m_worker;
-    std::atomic<bool> m_cancelRequested;
+    StopToken m_stopToken;
     std::atomic<bool> m_running;
 };
@@ -0,0 +1,586 @@
+#include "LiveTreeModel.h"
+
+#include "DirectoryReader.h"
+#include "TreeNameOrder.h"
+#include "TreeRenderer.h"
+
+#include <algorithm>
+#include <system_error>
+#include <utility>
+
+namespace {
+// Compaction is not worth it for small amounts of garbage.
+constexpr size_t kMinimumCompactionWaste = 4096;
+}
+
+LiveTreeModel::LiveTreeModel(std::unique_ptr<DirectoryWatcher> watcher, size_t workerCount)
+    : m_watcher(std::move(watcher))
+    , m_builder(workerCount)
+    , m_subtreeBuilder(1)
+    , m_maxDepth(-1)
+    , m_expandSymlinks(false) {
+    const auto hook = [this](const std::filesystem::path& directory) { WatchBeforeListing(directory); };
+    m_builder.SetListingHook(hook);
+    m_subtreeBuilder.SetListingHook(hook);
+}
+
+LiveTreeModel::~LiveTreeModel() {
+    Stop();
+}
+
+BuildTreeResult LiveTreeModel::Start(const std::wstring& rootPath, int maxDepth, bool expandSymlinks,
+                                     StopToken* stopToken) {
+    Stop();
+    if (!m_watcher) {
+        return {false, L"", L"Отслеживание изменений недоступно на этой платформе"};
+    }
+
+    BuildTreeResult result = m_builder.BuildTreeModel(rootPath, maxDepth, TreeFormat::TEXT, m_model,
+                                                      expandSymlinks, stopToken);
+    if (!result.success) {
+        DropPendingWatches();
+        return result;
+    }
+
+    m_rootPath = ToNativePath(rootPath);
+    m_maxDepth = maxDepth;
+    m_expandSymlinks = expandSymlinks;
+
+    // A fresh build appends children after their parents, so one backward pass sums the sizes.
+    ResizeNodeData();
+    for (size_t i = m_model.Size(); i-- > 1;) {
+        m_subtreeSizes[m_model.Node(static_cast<uint32_t>(i)).parent] += m_subtreeSizes[i];
+    }
+
+    WatchSubtree(m_model.Root(), 0, m_rootPath);
+    DropPendingWatches();
+    if (m_nodeWatches[m_model.Root()] == DirectoryWatcher::kInvalidWatch) {
+        Stop();
+        return {false, L"", L"Не удалось отслеживать каталог: " + rootPath};
+    }
+    return result;
+}
+
+void LiveTreeModel::Stop() {
+    // Watches exist only after Start() found a watcher.
+    for (const auto& watch : m_watchNodes) {
+        m_watcher->Remove(watch.first);
+    }
+    m_watchNodes.clear();
+    m_nodeWatches.clear();
+    m_unresolvedEntries.clear();
+    m_subtreeSizes.clear();
+    m_model.Clear();
+}
+
+bool LiveTreeModel::Update(std::chrono::milliseconds timeout, std::vector<TreeTextPatch>& patches) {
+    if (!m_watcher || m_model.Empty()) {
+        return false;
+    }
+
+    std::vector<WatchEvent> events;
+    if (!m_watcher->Wait(events, timeout)) {
+        return false;
+    }
+
+    // A rename inside the tree arrives as MovedFrom and MovedTo with a shared cookie; the pair
+    // becomes one move, which keeps the subtree instead of reading it again.
+    std::unordered_map<uint32_t, size_t> movedTo;
+    for (size_t i = 0; i < events.size(); ++i) {
+        if (events[i].type == WatchEventType::MovedTo) {
+            movedTo.emplace(events[i].cookie, i);
+        }
+    }
+    std::vector<bool> consumed(events.size(), false);
+    const size_t firstPatch = patches.size();
+
+    for (size_t i = 0; i < events.size(); ++i) {
+        const WatchEvent& event = events[i];
+        if (event.type == WatchEventType::Overflow) {
+            patches.resize(firstPatch);
+            return false;
+        }
+        if (consumed[i]) {
+            continue;
+        }
+
+        // Events of directories removed earlier in the batch have no node any more.
+        const auto watched = m_watchNodes.find(event.watch);
+        if (watched == m_watchNodes.end()) {
+            continue;
+        }
+        const uint32_t parent = watched->second;
+
+        switch (event.type) {
+        case WatchEventType::Created:
+        case WatchEventType::MovedTo:
+            Insert(parent, event.name, patches);
+            break;
+        case WatchEventType::Deleted: {
+            const uint32_t child = FindChild(parent, event.name);
+            if (child != TreeModel::kNoNode) {
+                Remove(child, patches);
+            }
+            break;
+        }
+        case WatchEventType::MovedFrom: {
+            const uint32_t child = FindChild(parent, event.name);
+            const auto pair = movedTo.find(event.cookie);
+            const auto target = pair != movedTo.end() && pair->second > i ? m_watchNodes.find(events[pair->second].watch)
+                                                                          : m_watchNodes.end();
+            if (target != m_watchNodes.end()) {
+                consumed[pair->second] = true;
+                if (child != TreeModel::kNoNode) {
+                    Move(child, target->second, events[pair->second].name, patches);
+                } else {
+                    Insert(target->second, events[pair->second].name, patches);
+                }
+            } else if (child != TreeModel::kNoNode) {
+                Remove(child, patches);
+            }
+            break;
+        }
+        case WatchEventType::DirectoryGone:
+            // Other directories also leave an event in their parent, which removes them.
+            if (parent == m_model.Root()) {
+                patches.resize(firstPatch);
+                return false;
+            }
+            break;
+        case WatchEventType::Overflow:
+            break;
+        }
+    }
+
+    InsertUnresolved(patches);
+    CompactIfWasteful();
+    return true;
+}
+
+bool LiveTreeModel::Render(TreeOutputSink& sink) const {
+    std::unique_ptr<TreeRenderer> renderer = TreeRenderer::Create(TreeFormat::TEXT, sink);
+    renderer->RenderModel(m_model);
+    return renderer->Flush();
+}
+
+bool LiveTreeModel::Render(Utf8OutputSink& sink) const {
+    std::unique_ptr<TreeRenderer> renderer = TreeRenderer::Create(TreeFormat::TEXT, sink);
+    renderer->RenderModel(m_model);
+    return renderer->Flush();
+}
+
+uint32_t LiveTreeModel::Depth(uint32_t node) const {
+    uint32_t depth = 0;
+    for (uint32_t parent = m_model.Node(node).parent; parent != TreeModel::kNoNode; parent = m_model.Node(parent).parent) {
+        ++depth;
+    }
+    return depth;
+}
+
+// Detached subtrees keep their parent links, so each step checks the parent still lists the node.
+bool LiveTreeModel::IsLinked(uint32_t node) const {
+    for (; node != m_model.Root(); node = m_model.Node(node).parent) {
+        uint32_t sibling = m_model.Node(m_model.Node(node).parent).firstChild;
+        while (sibling != node && sibling != TreeModel::kNoNode) {
+            sibling = m_model.Node(sibling).nextSibling;
+        }
+        if (sibling == TreeModel::kNoNode) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::filesystem::path LiveTreeModel::NodePath(uint32_t node) const {
+    std::vector<uint32_t> chain;
+    for (; node != m_model.Root(); node = m_model.Node(node).parent) {
+        chain.push_back(node);
+    }
+
+    std::filesystem::path path = m_rootPath;
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+        path = AppendPathComponent(path, m_model.Name(*it));
+    }
+    return path;
+}
+
+// Same rule as the builder's text view: the root is always listed, other directories while
+// they are within the depth limit and not symlinks that are left unexpanded.
+bool LiveTreeModel::IsListed(uint32_t node, uint32_t depth) const {
+    if (depth == 0) {
+        return true;
+    }
+    const TreeNode& entry = m_model.Node(node);
+    if (m_maxDepth >= 0 && depth >= static_cast<uint32_t>(m_maxDepth)) {
+        return false;
+    }
+    return entry.isDirectory && (m_expandSymlinks || !entry.isSymlink);
+}
+
+// Each node is one line in pre-order, so a node's line is its parent's plus one plus the
+// lines of the siblings before it.
+size_t LiveTreeModel::LineOf(uint32_t node) const {
+    size_t line = 0;
+    while (node != m_model.Root()) {
+        const uint32_t parent = m_model.Node(node).parent;
+        line += 1;
+        for (uint32_t sibling = m_model.Node(parent).firstChild; sibling != node; sibling = m_model.Node(sibling).nextSibling) {
+            line += m_subtreeSizes[sibling];
+        }
+        node = parent;
+    }
+    return line;
+}
+
+uint32_t LiveTreeModel::FindChild(uint32_t parent, NameView name) const {
+    for (uint32_t child = m_model.Node(parent).firstChild; child != TreeModel::kNoNode; child = m_model.Node(child).nextSibling) {
+        if (m_model.Name(child) == name) {
+            return child;
+        }
+    }
+    return TreeModel::kNoNode;
+}
+
+uint32_t LiveTreeModel::InsertPosition(uint32_t parent, bool isDirectory, NameView name) const {
+    uint32_t previous = TreeModel::kNoNode;
+    for (uint32_t child = m_model.Node(parent).firstChild; child != TreeModel::kNoNode; child = m_model.Node(child).nextSibling) {
+        const bool childIsDirectory = m_model.Node(child).isDirectory;
+        if (childIsDirectory != isDirectory) {
+            if (!childIsDirectory) {
+                break;
+            }
+        } else if (TreeNameOrder::CompareNames(m_model.Name(child), name) > 0) {
+            break;
+        }
+        previous = child;
+    }
+    return previous;
+}
+
+void LiveTreeModel::Insert(uint32_t parent, NameView name, std::vector<TreeTextPatch>& patches) {
+    // The entry may already be gone again; then there is nothing to show. If its directory is
+    // gone too, a later event moved or removed the directory and the entry is tried again.
+    const std::filesystem::path directory = NodePath(parent);
+    const std::filesystem::path path = AppendPathComponent(directory, name);
+    std::error_code ec;
+    const std::filesystem::file_status linkStatus = std::filesystem::symlink_status(path, ec);
+    if (ec || !std::filesystem::exists(linkStatus)) {
+        if (!std::filesystem::is_directory(directory, ec)) {
+            m_unresolvedEntries.push_back(UnresolvedEntry{parent, NameString(name)});
+        }
+        return;
+    }
+    const bool isSymlink = std::filesystem::is_symlink(linkStatus);
+    const bool isDirectory = isSymlink ? std::filesystem::is_directory(path, ec) && !ec
+                                       : std::filesystem::is_directory(linkStatus);
+
+    const uint32_t existing = FindChild(parent, name);
+    if (existing != TreeModel::kNoNode) {
+        const TreeNode& node = m_model.Node(existing);
+        if (node.isDirectory == isDirectory && node.isSymlink == isSymlink) {
+            return;
+        }
+        Remove(existing, patches);
+    }
+
+    const uint32_t node = m_model.AddUnlinked(name, isDirectory, isSymlink);
+    ResizeNodeData();
+
+    const uint32_t depth = Depth(parent) + 1;
+    if (IsListed(node, depth)) {
+        ScanInto(node, parent, depth, path);
+    }
+    Attach(node, parent, patches);
+}
+
+// Runs once a batch is applied, when the model has the directories at their new paths. Entries
+// whose directory moved again since stay for the next batch; removed directories drop theirs.
+void LiveTreeModel::InsertUnresolved(std::vector<TreeTextPatch>& patches) {
+    std::vector<UnresolvedEntry> unresolved;
+    unresolved.swap(m_unresolvedEntries);
+    for (const UnresolvedEntry& entry : unresolved) {
+        if (IsLinked(entry.parent)) {
+            Insert(entry.parent, entry.name, patches);
+        }
+    }
+}
+
+void LiveTreeModel::Remove(uint32_t node, std::vector<TreeTextPatch>& patches) {
+    Detach(node, patches);
+    UnwatchSubtree(node);
+}
+
+void LiveTreeModel::Move(uint32_t node, uint32_t parent, NameView name, std::vector<TreeTextPatch>& patches) {
+    // Under a depth limit a move to another level changes what is listed below it.
+    if (m_maxDepth >= 0 && Depth(parent) + 1 != Depth(node)) {
+        Remove(node, patches);
+        Insert(parent, name, patches);
+        return;
+    }
+
+    const uint32_t existing = FindChild(parent, name);
+    if (existing != TreeModel::kNoNode && existing != node) {
+        Remove(existing, patches);
+    }
+    Detach(node, patches);
+    m_model.Rename(node, name);
+    Attach(node, parent, patches);
+}
+
+void LiveTreeModel::Attach(uint32_t node, uint32_t parent, std::vector<TreeTextPatch>& patches) {
+    const TreeNode& entry = m_model.Node(node);
+    const uint32_t previous = InsertPosition(parent, entry.isDirectory, m_model.Name(node));
+    m_model.Link(node, parent, previous);
+    AddSubtreeSize(parent, m_subtreeSizes[node]);
+
+    // A new last child turns the previous last one's connector and the column below it.
+    if (m_model.Node(node).nextSibling == TreeModel::kNoNode && previous != TreeModel::kNoNode) {
+        patches.push_back(TreeTextPatch{LineOf(previous), m_subtreeSizes[previous],
+                                        m_subtreeSizes[previous] + m_subtreeSizes[node], RenderLines(previous, node)});
+    } else {
+        patches.push_back(TreeTextPatch{LineOf(node), 0, m_subtreeSizes[node], RenderLines(node, node)});
+    }
+}
+
+void LiveTreeModel::Detach(uint32_t node, std::vector<TreeTextPatch>& patches) {
+    const uint32_t parent = m_model.Node(node).parent;
+    uint32_t previous = TreeModel::kNoNode;
+    for (uint32_t sibling = m_model.Node(parent).firstChild; sibling != node; sibling = m_model.Node(sibling).nextSibling) {
+        previous = sibling;
+    }
+
+    const bool wasLast = m_model.Node(node).nextSibling == TreeModel::kNoNode;
+    const size_t firstLine = wasLast && previous != TreeModel::kNoNode ? LineOf(previous) : LineOf(node);
+    m_model.Unlink(node);
+    AddSubtreeSize(parent, -static_cast<int64_t>(m_subtreeSizes[node]));
+
+    if (wasLast && previous != TreeModel::kNoNode) {
+        patches.push_back(TreeTextPatch{firstLine, m_subtreeSizes[previous] + m_subtreeSizes[node],
+                                        m_subtreeSizes[previous], RenderLines(previous, previous)});
+    } else {
+        patches.push_back(TreeTextPatch{firstLine, m_subtreeSizes[node], 0, L""});
+    }
+}
+
+void LiveTreeModel::ScanInto(uint32_t node, uint32_t parent, uint32_t depth, const std::filesystem::path& path) {
+    const int maxDepth = m_maxDepth < 0 ? -1 : m_maxDepth - static_cast<int>(depth);
+
+    // Following links, a fresh build cuts a directory found again below itself and marks links
+    // to the root, so the scan gets node's place in the tree to apply the same rules.
+    SubtreeAncestry ancestry;
+    if (m_expandSymlinks) {
+        std::vector<uint32_t> chain;
+        for (uint32_t ancestor = parent; ancestor != m_model.Root();
+             ancestor = m_model.Node(ancestor).parent) {
+            chain.push_back(ancestor);
+        }
+        std::filesystem::path ancestorPath = m_rootPath;
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+            ancestorPath = AppendPathComponent(ancestorPath, m_model.Name(*it));
+            ancestry.ancestors.push_back(QueryFileIdentity(ancestorPath));
+        }
+
+        const FileIdentity identity = QueryFileIdentity(path);
+        if (std::find(ancestry.ancestors.begin(), ancestry.ancestors.end(), identity) != ancestry.ancestors.end()) {
+            return;
+        }
+        ancestry.ancestors.push_back(identity);
+        ancestry.root = QueryFileIdentity(m_rootPath);
+        if (identity == ancestry.root) {
+            m_model.SetTextOnlyChildren(node);
+        }
+    }
+
+    TreeModel scanned;
+    if (!m_subtreeBuilder.BuildSubtreeModel(FromNativePath(path), maxDepth, ancestry, scanned, m_expandSymlinks).success) {
+        DropPendingWatches();
+        return;
+    }
+
+    // The scan appends every child after its parent and siblings in order, so copying in table
+    // order needs only the last copied child of each node.
+    const uint32_t firstCopy = static_cast<uint32_t>(m_model.Size());
+    std::vector<uint32_t> copies(scanned.Size(), TreeModel::kNoNode);
+    std::vector<uint32_t> lastChildren(scanned.Size(), TreeModel::kNoNode);
+    copies[scanned.Root()] = node;
+    for (uint32_t i = 1; i < scanned.Size(); ++i) {
+        const TreeNode& entry = scanned.Node(i);
+        copies[i] = m_model.AddChild(copies[entry.parent], lastChildren[entry.parent], scanned.Name(i),
+                                     entry.isDirectory, entry.isSymlink);
+        if (entry.textOnlyChildren) {
+            m_model.SetTextOnlyChildren(copies[i]);
+        }
+        lastChildren[entry.parent] = copies[i];
+    }
+    ResizeNodeData();
+
+    for (uint32_t i = static_cast<uint32_t>(m_model.Size()); i-- > firstCopy;) {
+        m_subtreeSizes[m_model.Node(i).parent] += m_subtreeSizes[i];
+    }
+    WatchSubtree(node, depth, path);
+    DropPendingWatches();
+}
+
+void LiveTreeModel::WatchBeforeListing(const std::filesystem::path& directory) {
+    std::lock_guard<std::mutex> lock(m_pendingWatchesMutex);
+    if (m_pendingWatches.count(directory.native()) != 0) {
+        return;
+    }
+    const int watch = m_watcher->Add(directory);
+    if (watch != DirectoryWatcher::kInvalidWatch) {
+        m_pendingWatches.emplace(directory.native(), watch);
+    }
+}
+
+void LiveTreeModel::WatchSubtree(uint32_t node, uint32_t depth, const std::filesystem::path& path) {
+    struct Pending {
+        uint32_t node;
+        uint32_t depth;
+        std::filesystem::path path;
+    };
+
+    std::vector<Pending> pending;
+    pending.push_back(Pending{node, depth, path});
+    while (!pending.empty()) {
+        Pending current = std::move(pending.back());
+        pending.pop_back();
+        if (!IsListed(current.node, current.depth)) {
+            continue;
+        }
+
+        // Directories the scan did not list are links it cut as cycles. Their watch would be
+        // the one of the directory they lead to, and its events would land on them.
+        const auto pendingWatch = m_pendingWatches.find(current.path.native());
+        if (pendingWatch == m_pendingWatches.end()) {
+            continue;
+        }
+        const int watch = pendingWatch->second;
+        m_pendingWatches.erase(pendingWatch);
+        m_nodeWatches[current.node] = watch;
+        m_watchNodes[watch] = current.node;
+        for (uint32_t child = m_model.Node(current.node).firstChild; child != TreeModel::kNoNode; child = m_model.Node(child).nextSibling) {
+            if (m_model.Node(child).isDirectory) {
+                pending.push_back(Pending{child, current.depth + 1, AppendPathComponent(current.path, m_model.Name(child))});
+            }
+        }
+    }
+}
+
+void LiveTreeModel::DropPendingWatches() {
+    // Paths reaching one directory twice share a watch, which may belong to a node already.
+    for (const auto& pending : m_pendingWatches) {
+        if (m_watchNodes.count(pending.second) == 0) {
+            m_watcher->Remove(pending.second);
+        }
+    }
+    m_pendingWatches.clear();
+}
+
+void LiveTreeModel::UnwatchSubtree(uint32_t node) {
+    std::vector<uint32_t> pending(1, node);
+    while (!pending.empty()) {
+        const uint32_t current = pending.back();
+        pending.pop_back();
+
+        int& watch = m_nodeWatches[current];
+        if (watch != DirectoryWatcher::kInvalidWatch) {
+            m_watcher->Remove(watch);
+            m_watchNodes.erase(watch);
+            watch = DirectoryWatcher::kInvalidWatch;
+        }
+        for (uint32_t child = m_model.Node(current).firstChild; child != TreeModel::kNoNode; child = m_model.Node(child).nextSibling) {
+            pending.push_back(child);
+        }
+    }
+}
+
+void LiveTreeModel::AddSubtreeSize(uint32_t node, int64_t delta) {
+    for (; node != TreeModel::kNoNode; node = m_model.Node(node).parent) {
+        m_subtreeSizes[node] = static_cast<uint32_t>(m_subtreeSizes[node] + delta);
+    }
+}
+
+void LiveTreeModel::ResizeNodeData() {
+    m_subtreeSizes.resize(m_model.Size(), 1);
+    m_nodeWatches.resize(m_model.Size(), DirectoryWatcher::kInvalidWatch);
+}
+
+void LiveTreeModel::CompactIfWasteful() {
+    const size_t live = LineCount();
+    const size_t waste = m_model.Size() - live;
+    if (waste < kMinimumCompactionWaste || waste < live) {
+        return;
+    }
+
+    TreeModel compacted;
+    compacted.Reserve(live);
+    std::vector<uint32_t> subtreeSizes;
+    std::vector<int> nodeWatches;
+    subtreeSizes.reserve(live);
+    nodeWatches.reserve(live);
+    std::vector<uint32_t> copies(m_model.Size(), TreeModel::kNoNode);
+    std::vector<uint32_t> lastChildren;
+    lastChildren.reserve(live);
+
+    // Pre-order copy of the linked nodes; watches follow their directories to the new indices.
+    uint32_t node = m_model.Root();
+    for (;;) {
+        const TreeNode& entry = m_model.Node(node);
+        uint32_t copy;
+        if (node == m_model.Root()) {
+            copy = compacted.AddRoot(m_model.Name(node), entry.isDirectory);
+        } else {
+            const uint32_t parent = copies[entry.parent];
+            copy = compacted.AddChild(parent, lastChildren[parent], m_model.Name(node), entry.isDirectory, entry.isSymlink);
+            lastChildren[parent] = copy;
+        }
+        if (entry.textOnlyChildren) {
+            compacted.SetTextOnlyChildren(copy);
+        }
+        copies[node] = copy;
+        lastChildren.push_back(TreeModel::kNoNode);
+        subtreeSizes.push_back(m_subtreeSizes[node]);
+        nodeWatches.push_back(m_nodeWatches[node]);
+        if (m_nodeWatches[node] != DirectoryWatcher::kInvalidWatch) {
+            m_watchNodes[m_nodeWatches[node]] = copy;
+        }
+
+        if (entry.firstChild != TreeModel::kNoNode) {
+            node = entry.firstChild;
+            continue;
+        }
+        while (node != m_model.Root() && m_model.Node(node).nextSibling == TreeModel::kNoNode) {
+            node = m_model.Node(node).parent;
+        }
+        if (node == m_model.Root()) {
+            break;
+        }
+        node = m_model.Node(node).nextSibling;
+    }
+
+    std::vector<UnresolvedEntry> unresolved;
+    for (UnresolvedEntry& entry : m_unresolvedEntries) {
+        if (copies[entry.parent] != TreeModel::kNoNode) {
+            unresolved.push_back(UnresolvedEntry{copies[entry.parent], std::move(entry.name)});
+        }
+    }
+    m_unresolvedEntries = std::move(unresolved);
+
+    m_model = std::move(compacted);
+    m_subtreeSizes = std::move(subtreeSizes);
+    m_nodeWatches = std::move(nodeWatches);
+}
+
+std::wstring LiveTreeModel::RenderLines(uint32_t first, uint32_t last) const {
+    std::wstring text;
+    StringOutputSink sink(text);
+    std::unique_ptr<TreeRenderer> renderer = TreeRenderer::Create(TreeFormat::TEXT, sink);
+    for (uint32_t node = first;; node = m_model.Node(node).nextSibling) {
+        renderer->RenderSubtree(m_model, node);
+        if (node == last) {
+            break;
+        }
+    }
+    renderer->Flush();
+    return text;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "DirectoryTreeBuilder.h"
+#include "DirectoryWatcher.h"
+#include "TreeModel.h"
+#include "TreeOutputSink.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A change of the text view: lines [firstLine, firstLine + removedLines) are replaced by
+// addedLines complete lines of text. Patches apply in the order they were produced.
+struct TreeTextPatch {
+    size_t firstLine;
+    size_t removedLines;
+    size_t addedLines;
+    std::wstring text;
+};
+
+// Text-format tree model of one directory that follows the directory's changes. The first scan
+// is a regular build; afterwards every listed directory is watched, and created, deleted and
+// renamed entries are applied to the model in place. Each change produces a patch covering only
+// the lines it affects, so a view of the tree is kept current without rendering it again.
+//
+// Each directory is watched before the scan lists it, so changes made while Start() scans are
+// not lost: they arrive as the first events and are applied to the scanned state.
+class LiveTreeModel {
+public:
+    explicit LiveTreeModel(std::unique_ptr<DirectoryWatcher> watcher, size_t workerCount = 0);
+    ~LiveTreeModel();
+
+    LiveTreeModel(const LiveTreeModel&) = delete;
+    LiveTreeModel& operator=(const LiveTreeModel&) = delete;
+
+    // Scans rootPath with the text view's rules and starts watching it. Any previous state is dropped.
+    BuildTreeResult Start(const std::wstring& rootPath, int maxDepth, bool expandSymlinks,
+                          StopToken* stopToken = nullptr);
+    void Stop();
+
+    // Waits up to timeout for changes and applies them, appending a patch per change. Returns
+    // false once the model can no longer follow the directory (dropped events, the root is gone,
+    // the watcher failed); Start() has to scan it again then. A false return appends no patches:
+    // those of the events applied before the failure are taken back.
+    bool Update(std::chrono::milliseconds timeout, std::vector<TreeTextPatch>& patches);
+
+    const TreeModel& Model() const { return m_model; }
+    size_t LineCount() const { return m_model.Empty() ? 0 : m_subtreeSizes[m_model.Root()]; }
+
+    // Renders the whole text view.
+    bool Render(TreeOutputSink& sink) const;
+    bool Render(Utf8OutputSink& sink) const;
+
+private:
+    // An entry whose event named a directory that a later event of the same batch moved; it
+    // is looked up again under the directory's new path.
+    struct UnresolvedEntry {
+        uint32_t parent;
+        NameString name;
+    };
+
+    uint32_t Depth(uint32_t node) const;
+    bool IsLinked(uint32_t node) const;
+    std::filesystem::path NodePath(uint32_t node) const;
+    bool IsListed(uint32_t node, uint32_t depth) const;
+    size_t LineOf(uint32_t node) const;
+    uint32_t FindChild(uint32_t parent, NameView name) const;
+    uint32_t InsertPosition(uint32_t parent, bool isDirectory, NameView name) const;
+
+    void Insert(uint32_t parent, NameView name, std::vector<TreeTextPatch>& patches);
+    void InsertUnresolved(std::vector<TreeTextPatch>& patches);
+    void Remove(uint32_t node, std::vector<TreeTextPatch>& patches);
+    void Move(uint32_t node, uint32_t parent, NameView name, std::vector<TreeTextPatch>& patches);
+
+    // Link/unlink a subtree with its line bookkeeping and the text patch.
+    void Attach(uint32_t node, uint32_t parent, std::vector<TreeTextPatch>& patches);
+    void Detach(uint32_t node, std::vector<TreeTextPatch>& patches);
+
+    // Lists a directory about to be attached below parent, grafts its contents below node and
+    // watches them all.
+    void ScanInto(uint32_t node, uint32_t parent, uint32_t depth, const std::filesystem::path& path);
+    // The builders' listing hook: watches a directory before it is listed.
+    void WatchBeforeListing(const std::filesystem::path& directory);
+    // Hands the watches added during a scan to their nodes; path is node's own path and the
+    // node may not be linked into the tree yet.
+    void WatchSubtree(uint32_t node, uint32_t depth, const std::filesystem::path& path);
+    // Removes the watches of a scan that no node took, such as directories gone meanwhile.
+    void DropPendingWatches();
+    void UnwatchSubtree(uint32_t node);
+    void AddSubtreeSize(uint32_t node, int64_t delta);
+    void ResizeNodeData();
+    // Rebuilds the model without the unlinked nodes once they outweigh the live ones.
+    void CompactIfWasteful();
+
+    std::wstring RenderLines(uint32_t first, uint32_t last) const;
+
+    std::unique_ptr<DirectoryWatcher> m_watcher;
+    DirectoryTreeBuilder m_builder;
+    // Scans created directories, which are usually small enough for a single worker.
+    DirectoryTreeBuilder m_subtreeBuilder;
+    TreeModel m_model;
+    // Lines of each node's subtree in the text view, the node's own line included.
+    std::vector<uint32_t> m_subtreeSizes;
+    std::vector<int> m_nodeWatches;
+    std::unordered_map<int, uint32_t> m_watchNodes;
+    std::vector<UnresolvedEntry> m_unresolvedEntries;
+    // Watches added by the current scan, by directory path; filled from the traversal threads.
+    std::mutex m_pendingWatchesMutex;
+    std::unordered_map<std::filesystem::path::string_type, int> m_pendingWatches;
+    std::filesystem::path m_rootPath;
+    int m_maxDepth;
+    bool m_expandSymlinks;
+};
@@ -0,0 +1,156 @@
+#include "RenderedTreeText.h"
+
+#include <algorithm>
+#include <cstring>
+
+RenderedTreeText::RenderedTreeText(size_t chunkChars)
+    : TreeOutputSink(kDefaultBufferChars)
+    , m_chunkChars(std::max<size_t>(chunkChars, 1))
+    , m_charCount(0)
+    , m_lineOpen(false) {
+}
+
+void RenderedTreeText::Clear() {
+    Flush();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_chunks.clear();
+    m_charCount = 0;
+    m_lineOpen = false;
+}
+
+size_t RenderedTreeText::LineCount() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return LineCountLocked();
+}
+
+size_t RenderedTreeText::CharCount() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_charCount;
+}
+
+size_t RenderedTreeText::CopyLines(size_t first, size_t count, std::wstring& target) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const size_t lineCount = LineCountLocked();
+    if (first >= lineCount) {
+        return 0;
+    }
+    count = std::min(count, lineCount - first);
+
+    // Lines of one chunk are contiguous, so each chunk contributes a single append.
+    size_t chunkIndex = FindChunk(first);
+    size_t line = first;
+    const size_t end = first + count;
+    while (line < end) {
+        const Chunk& chunk = m_chunks[chunkIndex++];
+        const size_t localFirst = line - chunk.firstLine;
+        const size_t localEnd = std::min(end - chunk.firstLine, chunk.lineStarts.size());
+        const size_t from = chunk.lineStarts[localFirst];
+        const size_t to = LineEnd(chunk, localEnd - 1);
+        target.append(chunk.text.get() + from, to - from);
+        line = chunk.firstLine + localEnd;
+    }
+    return count;
+}
+
+std::wstring RenderedTreeText::Line(size_t index) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (index >= LineCountLocked()) {
+        return std::wstring();
+    }
+
+    const Chunk& chunk = m_chunks[FindChunk(index)];
+    const size_t localLine = index - chunk.firstLine;
+    const wchar_t* begin = chunk.text.get() + chunk.lineStarts[localLine];
+    const wchar_t* end = chunk.text.get() + LineEnd(chunk, localLine);
+    if (end != begin && end[-1] == L'\n') {
+        --end;
+        if (end != begin && end[-1] == L'\r') {
+            --end;
+        }
+    }
+    return std::wstring(begin, end);
+}
+
+std::wstring RenderedTreeText::Text() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::wstring text;
+    text.reserve(m_charCount);
+    for (const Chunk& chunk : m_chunks) {
+        text.append(chunk.text.get(), chunk.used);
+    }
+    return text;
+}
+
+void RenderedTreeText::WriteTo(TreeOutputSink& sink) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const Chunk& chunk : m_chunks) {
+        sink.Append(chunk.text.get(), chunk.used);
+    }
+}
+
+bool RenderedTreeText::WriteChunk(const wchar_t* data, size_t length) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const wchar_t* const end = data + length;
+    while (data != end) {
+        const wchar_t* lineBreak = std::find(data, end, L'\n');
+        const wchar_t* partEnd = lineBreak == end ? end : lineBreak + 1;
+        AppendLinePart(data, static_cast<size_t>(partEnd - data));
+        data = partEnd;
+    }
+    return true;
+}
+
+void RenderedTreeText::AppendLinePart(const wchar_t* data, size_t length) {
+    if (m_chunks.empty() || m_chunks.back().capacity - m_chunks.back().used < length) {
+        Chunk* last = m_chunks.empty() ? nullptr : &m_chunks.back();
+        const size_t openChars = m_lineOpen ? last->used - last->lineStarts.back() : 0;
+
+        if (m_lineOpen && last->lineStarts.size() == 1) {
+            // The open line already fills its chunk on its own: grow the chunk instead.
+            const size_t capacity = std::max(last->capacity * 2, last->used + length);
+            std::unique_ptr<wchar_t[]> text(new wchar_t[capacity]);
+            std::memcpy(text.get(), last->text.get(), last->used * sizeof(wchar_t));
+            last->text = std::move(text);
+            last->capacity = capacity;
+        } else {
+            Chunk chunk;
+            chunk.capacity = std::max(m_chunkChars, openChars + length);
+            chunk.text.reset(new wchar_t[chunk.capacity]);
+            chunk.used = 0;
+            chunk.firstLine = last ? last->firstLine + last->lineStarts.size() : 0;
+            if (openChars > 0) {
+                // Lines never straddle chunks: the unfinished line moves along.
+                std::memcpy(chunk.text.get(), last->text.get() + last->lineStarts.back(), openChars * sizeof(wchar_t));
+                chunk.used = openChars;
+                chunk.lineStarts.push_back(0);
+                chunk.firstLine -= 1;
+                last->used -= openChars;
+                last->lineStarts.pop_back();
+            }
+            m_chunks.push_back(std::move(chunk));
+        }
+    }
+
+    Chunk& chunk = m_chunks.back();
+    if (!m_lineOpen) {
+        chunk.lineStarts.push_back(static_cast<uint32_t>(chunk.used));
+    }
+    std::memcpy(chunk.text.get() + chunk.used, data, length * sizeof(wchar_t));
+    chunk.used += length;
+    m_charCount += length;
+    m_lineOpen = data[length - 1] != L'\n';
+}
+
+size_t RenderedTreeText::FindChunk(size_t line) const {
+    const auto next = std::upper_bound(m_chunks.begin(), m_chunks.end(), line,
+                                       [](size_t value, const Chunk& chunk) { return value < chunk.firstLine; });
+    return static_cast<size_t>(next - m_chunks.begin()) - 1;
+}
+
+size_t RenderedTreeText::LineEnd(const Chunk& chunk, size_t localLine) const {
+    return localLine + 1 < chunk.lineStarts.size() ? chunk.lineStarts[localLine + 1] : chunk.used;
+}
+
+size_t RenderedTreeText::LineCountLocked() const {
+    return m_chunks.empty() ? 0 : m_chunks.back().firstLine + m_chunks.back().lineStarts.size();
+}
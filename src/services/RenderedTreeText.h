@@ -0,0 +1,69 @@
+#pragma once
+
+#include "TreeOutputSink.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Rendered tree text kept as lines: the output is stored in large chunks that never split a
+// line, and every chunk indexes where its lines start. Any range of lines is found in
+// O(log n) without materializing the whole text, so a front end can page through outputs
+// of millions of lines and copy out only what it shows.
+//
+// Filled as a sink, typically by DirectoryTreeBuilder::BuildTreeToSink(); the readers below
+// may run on other threads while it is filled and see the lines written so far. A line ends
+// after '\n'; a trailing unterminated line counts as well.
+class RenderedTreeText : public TreeOutputSink {
+public:
+    static constexpr size_t kDefaultChunkChars = 256 * 1024;
+
+    explicit RenderedTreeText(size_t chunkChars = kDefaultChunkChars);
+
+    // Drops the text written so far, pending appends included.
+    void Clear();
+
+    size_t LineCount() const;
+    // Characters of all lines, line breaks included.
+    size_t CharCount() const;
+
+    // Appends lines [first, first + count) with their line breaks to target, clipped to the
+    // lines present. Returns the number of lines appended.
+    size_t CopyLines(size_t first, size_t count, std::wstring& target) const;
+    // A single line without its line break; empty past the end.
+    std::wstring Line(size_t index) const;
+    std::wstring Text() const;
+
+    // Appends the whole text to sink without joining it first. Does not flush sink.
+    void WriteTo(TreeOutputSink& sink) const;
+
+protected:
+    bool WriteChunk(const wchar_t* data, size_t length) override;
+
+private:
+    struct Chunk {
+        std::unique_ptr<wchar_t[]> text;
+        size_t capacity;
+        size_t used;
+        // Index of the chunk's first line in the whole text.
+        size_t firstLine;
+        std::vector<uint32_t> lineStarts;
+    };
+
+    // Appends part of one line, ending at or before its '\n'. Caller holds m_mutex.
+    void AppendLinePart(const wchar_t* data, size_t length);
+    // Chunk holding line; line < LineCount(). Caller holds m_mutex.
+    size_t FindChunk(size_t line) const;
+    size_t LineEnd(const Chunk& chunk, size_t localLine) const;
+    size_t LineCountLocked() const;
+
+    mutable std::mutex m_mutex;
+    std::vector<Chunk> m_chunks;
+    size_t m_chunkChars;
+    size_t m_charCount;
+    // The last line has not seen its '\n' yet.
+    bool m_lineOpen;
+};
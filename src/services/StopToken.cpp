@@ -0,0 +1,44 @@
+#include "StopToken.h"
+
+StopToken::StopToken()
+    : m_stopRequested(false)
+    , m_reason(StopReason::None)
+    , m_hasDeadline(false)
+    , m_entryBudget(kUnlimitedEntries) {
+}
+
+void StopToken::RequestStop(StopReason reason) {
+    StopReason expected = StopReason::None;
+    m_reason.compare_exchange_strong(expected, reason, std::memory_order_acq_rel);
+    m_stopRequested.store(true, std::memory_order_release);
+}
+
+void StopToken::SetDeadline(Clock::time_point deadline) {
+    m_hasDeadline = true;
+    m_deadline = deadline;
+}
+
+bool StopToken::CheckLimits(uint64_t processedEntries) {
+    if (m_hasDeadline && !StopRequested() && Clock::now() >= m_deadline) {
+        RequestStop(StopReason::DeadlineExceeded);
+    }
+    return CheckBudget(processedEntries);
+}
+
+void StopToken::Reset() {
+    m_stopRequested.store(false, std::memory_order_relaxed);
+    m_reason.store(StopReason::None, std::memory_order_relaxed);
+    m_hasDeadline = false;
+    m_entryBudget = kUnlimitedEntries;
+}
+
+std::wstring StopMessage(const StopToken& stop) {
+    switch (stop.Reason()) {
+    case StopReason::DeadlineExceeded:
+        return L"Превышено время построения дерева";
+    case StopReason::EntryBudgetExhausted:
+        return L"Превышено допустимое число элементов";
+    default:
+        return L"Операция отменена";
+    }
+}
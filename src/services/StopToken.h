@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <string>
+
+enum class StopReason : uint8_t {
+    None,
+    Cancelled,
+    DeadlineExceeded,
+    EntryBudgetExhausted
+};
+
+// Cooperative stop signal for a build, shared by reference. RequestStop() may be called from
+// any thread; the traversal tests the flag inline with a relaxed load. A deadline and an entry
+// budget trip the same flag, so every stage reacts to them without knowing which it was.
+class StopToken {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr uint64_t kUnlimitedEntries = (std::numeric_limits<uint64_t>::max)();
+
+    StopToken();
+
+    StopToken(const StopToken&) = delete;
+    StopToken& operator=(const StopToken&) = delete;
+
+    // The first reason wins; later requests only keep the flag set.
+    void RequestStop(StopReason reason = StopReason::Cancelled);
+
+    bool StopRequested() const { return m_stopRequested.load(std::memory_order_relaxed); }
+    StopReason Reason() const { return m_reason.load(std::memory_order_acquire); }
+
+    // The flag polled by directory readers and other inline checks.
+    const std::atomic<bool>& Flag() const { return m_stopRequested; }
+
+    // Limits are set before the build starts and are not synchronized.
+    void SetDeadline(Clock::time_point deadline);
+    void SetTimeout(std::chrono::milliseconds timeout) { SetDeadline(Clock::now() + timeout); }
+    void SetEntryBudget(uint64_t maxEntries) { m_entryBudget = maxEntries; }
+
+    // No clock read: cheap enough to call for every entry.
+    bool CheckBudget(uint64_t processedEntries) {
+        if (processedEntries > m_entryBudget) {
+            RequestStop(StopReason::EntryBudgetExhausted);
+        }
+        return StopRequested();
+    }
+
+    // Also reads the clock for the deadline; meant for periodic checks.
+    bool CheckLimits(uint64_t processedEntries);
+
+    // Clears the flag and the limits for the next build.
+    void Reset();
+
+private:
+    std::atomic<bool> m_stopRequested;
+    std::atomic<StopReason> m_reason;
+    bool m_hasDeadline;
+    Clock::time_point m_deadline;
+    uint64_t m_entryBudget;
+};
+
+// Error text for a build that stop cut short.
+std::wstring StopMessage(const StopToken& stop);
@@ -0,0 +1,45 @@
+#include "StringArena.h"
+
+#include <algorithm>
+#include <cstring>
+
+StringArena::StringArena(size_t chunkChars)
+    : m_chunkChars(std::max<size_t>(chunkChars, 1)) {
+}
+
+StringRef StringArena::Intern(NameView text) {
+    Chunk* chunk = m_chunks.empty() ? nullptr : &m_chunks.back();
+    if (!chunk || chunk->capacity - chunk->used < text.size()) {
+        // Oversized strings get a dedicated chunk, so a string never straddles two chunks.
+        chunk = &AllocateChunk(text.size());
+    }
+
+    const StringRef ref{
+        static_cast<uint32_t>(m_chunks.size() - 1),
+        static_cast<uint32_t>(chunk->used),
+        static_cast<uint32_t>(text.size())
+    };
+    if (!text.empty()) {
+        std::memcpy(chunk->data.get() + chunk->used, text.data(), text.size() * sizeof(NameChar));
+    }
+    chunk->used += text.size();
+    return ref;
+}
+
+void StringArena::Clear() {
+    m_chunks.clear();
+}
+
+size_t StringArena::BytesReserved() const {
+    size_t total = 0;
+    for (const auto& chunk : m_chunks) {
+        total += chunk.capacity * sizeof(NameChar);
+    }
+    return total;
+}
+
+StringArena::Chunk& StringArena::AllocateChunk(size_t minimumChars) {
+    const size_t capacity = std::max(m_chunkChars, minimumChars);
+    m_chunks.push_back(Chunk{std::unique_ptr<NameChar[]>(new NameChar[capacity]), capacity, 0});
+    return m_chunks.back();
+}
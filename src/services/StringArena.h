@@ -0,0 +1,50 @@
+#pragma once
+
+#include "TreeName.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Location of an interned string inside a StringArena.
+struct StringRef {
+    uint32_t chunk;
+    uint32_t offset;
+    uint32_t length;
+};
+
+// Append-only name storage carved out of large fixed-size chunks. Interned strings are
+// never moved, so views handed out stay valid for the lifetime of the arena.
+class StringArena {
+public:
+    static constexpr size_t kDefaultChunkChars = 64 * 1024;
+
+    explicit StringArena(size_t chunkChars = kDefaultChunkChars);
+
+    StringArena(StringArena&&) noexcept = default;
+    StringArena& operator=(StringArena&&) noexcept = default;
+
+    StringRef Intern(NameView text);
+
+    NameView View(const StringRef& ref) const {
+        return NameView(m_chunks[ref.chunk].data.get() + ref.offset, ref.length);
+    }
+
+    void Clear();
+    size_t ChunkCount() const { return m_chunks.size(); }
+    size_t BytesReserved() const;
+
+private:
+    struct Chunk {
+        std::unique_ptr<NameChar[]> data;
+        size_t capacity;
+        size_t used;
+    };
+
+    Chunk& AllocateChunk(size_t minimumChars);
+
+    std::vector<Chunk> m_chunks;
+    size_t m_chunkChars;
+};
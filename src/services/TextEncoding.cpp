@@ -0,0 +1,247 @@
+#include "TextEncoding.h"
+
+namespace {
+constexpr char32_t kReplacementCharacter = 0xFFFD;
+
+bool IsHighSurrogate(char32_t value) {
+    return value >= 0xD800 && value <= 0xDBFF;
+}
+
+bool IsLowSurrogate(char32_t value) {
+    return value >= 0xDC00 && value <= 0xDFFF;
+}
+
+// Stand-ins of FromPathBytes() for the bytes of invalid UTF-8, only ever at or above 0x80.
+constexpr char32_t kEscapedByteBase = 0xDC00;
+
+bool IsEscapedByte(char32_t value) {
+    return value >= kEscapedByteBase + 0x80 && value <= kEscapedByteBase + 0xFF;
+}
+
+void AppendCodePoint(std::string& out, char32_t codePoint) {
+    if (codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF)) {
+        codePoint = kReplacementCharacter;
+    }
+
+    if (codePoint < 0x80) {
+        out += static_cast<char>(codePoint);
+    } else if (codePoint < 0x800) {
+        out += static_cast<char>(0xC0 | (codePoint >> 6));
+        out += static_cast<char>(0x80 | (codePoint & 0x3F));
+    } else if (codePoint < 0x10000) {
+        out += static_cast<char>(0xE0 | (codePoint >> 12));
+        out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (codePoint & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (codePoint >> 18));
+        out += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (codePoint & 0x3F));
+    }
+}
+
+void AppendWideCodePoint(std::wstring& out, char32_t codePoint) {
+    if (sizeof(wchar_t) == 2 && codePoint >= 0x10000) {
+        codePoint -= 0x10000;
+        out += static_cast<wchar_t>(0xD800 + (codePoint >> 10));
+        out += static_cast<wchar_t>(0xDC00 + (codePoint & 0x3FF));
+        return;
+    }
+    out += static_cast<wchar_t>(codePoint);
+}
+
+// Decodes one multi-byte sequence starting at data[index]; advances index past it. Overlong
+// forms, surrogates and truncated sequences consume one byte and yield U+FFFD.
+char32_t DecodeUtf8Sequence(const unsigned char* data, size_t length, size_t& index) {
+    const unsigned char lead = data[index];
+    size_t continuationCount = 0;
+    char32_t codePoint = 0;
+    char32_t minimum = 0;
+    if (lead >= 0xC2 && lead <= 0xDF) {
+        continuationCount = 1;
+        codePoint = lead & 0x1F;
+        minimum = 0x80;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+        continuationCount = 2;
+        codePoint = lead & 0x0F;
+        minimum = 0x800;
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+        continuationCount = 3;
+        codePoint = lead & 0x07;
+        minimum = 0x10000;
+    } else {
+        ++index;
+        return kReplacementCharacter;
+    }
+
+    if (length - index <= continuationCount) {
+        ++index;
+        return kReplacementCharacter;
+    }
+
+    for (size_t i = 1; i <= continuationCount; ++i) {
+        const unsigned char next = data[index + i];
+        if ((next & 0xC0) != 0x80) {
+            ++index;
+            return kReplacementCharacter;
+        }
+        codePoint = (codePoint << 6) | (next & 0x3F);
+    }
+
+    if (codePoint < minimum || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF)) {
+        ++index;
+        return kReplacementCharacter;
+    }
+
+    index += continuationCount + 1;
+    return codePoint;
+}
+}
+
+namespace TextEncoding {
+void AppendUtf8(std::string& out, const wchar_t* data, size_t length, wchar_t& pendingHighSurrogate) {
+    out.reserve(out.size() + length + length / 2);
+
+    size_t index = 0;
+    if (pendingHighSurrogate != 0 && length > 0) {
+        const char32_t next = static_cast<char32_t>(data[0]);
+        if (IsLowSurrogate(next)) {
+            AppendCodePoint(out, 0x10000 + ((static_cast<char32_t>(pendingHighSurrogate) - 0xD800) << 10) + (next - 0xDC00));
+            index = 1;
+        } else {
+            AppendCodePoint(out, kReplacementCharacter);
+        }
+        pendingHighSurrogate = 0;
+    }
+
+    for (; index < length; ++index) {
+        const char32_t value = static_cast<char32_t>(data[index]);
+        if (value < 0x80) {
+            out += static_cast<char>(value);
+            continue;
+        }
+
+        if (sizeof(wchar_t) == 2 && IsHighSurrogate(value)) {
+            if (index + 1 == length) {
+                pendingHighSurrogate = data[index];
+                break;
+            }
+            const char32_t next = static_cast<char32_t>(data[index + 1]);
+            if (IsLowSurrogate(next)) {
+                AppendCodePoint(out, 0x10000 + ((value - 0xD800) << 10) + (next - 0xDC00));
+                ++index;
+                continue;
+            }
+        }
+
+        AppendCodePoint(out, value);
+    }
+}
+
+std::string ToUtf8(std::wstring_view text) {
+    std::string result;
+    wchar_t pendingHighSurrogate = 0;
+    AppendUtf8(result, text.data(), text.size(), pendingHighSurrogate);
+    if (pendingHighSurrogate != 0) {
+        AppendCodePoint(result, kReplacementCharacter);
+    }
+    return result;
+}
+
+void AppendWide(std::wstring& out, const char* data, size_t length) {
+    out.reserve(out.size() + length);
+
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+    size_t index = 0;
+    while (index < length) {
+        if (bytes[index] < 0x80) {
+            out += static_cast<wchar_t>(bytes[index]);
+            ++index;
+            continue;
+        }
+        AppendWideCodePoint(out, DecodeUtf8Sequence(bytes, length, index));
+    }
+}
+
+std::wstring FromUtf8(std::string_view text) {
+    std::wstring result;
+    AppendWide(result, text.data(), text.size());
+    return result;
+}
+
+bool IsValidUtf8(std::string_view text) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(text.data());
+    size_t index = 0;
+    while (index < text.size()) {
+        if (bytes[index] < 0x80) {
+            ++index;
+            continue;
+        }
+        // A genuine U+FFFD takes three bytes; a replacement for bad input consumes one.
+        const size_t start = index;
+        if (DecodeUtf8Sequence(bytes, text.size(), index) == kReplacementCharacter && index == start + 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::wstring FromPathBytes(std::string_view bytes) {
+    std::wstring result;
+    result.reserve(bytes.size());
+
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(bytes.data());
+    size_t index = 0;
+    while (index < bytes.size()) {
+        if (data[index] < 0x80) {
+            result += static_cast<wchar_t>(data[index]);
+            ++index;
+            continue;
+        }
+        const size_t start = index;
+        const char32_t codePoint = DecodeUtf8Sequence(data, bytes.size(), index);
+        if (codePoint == kReplacementCharacter && index == start + 1) {
+            result += static_cast<wchar_t>(kEscapedByteBase + data[start]);
+        } else {
+            AppendWideCodePoint(result, codePoint);
+        }
+    }
+    return result;
+}
+
+std::string ToPathBytes(std::wstring_view text) {
+    std::string result;
+    wchar_t pendingHighSurrogate = 0;
+    size_t runStart = 0;
+    for (size_t i = 0; i <= text.size(); ++i) {
+        if (i < text.size() && !IsEscapedByte(static_cast<char32_t>(text[i]))) {
+            continue;
+        }
+        AppendUtf8(result, text.data() + runStart, i - runStart, pendingHighSurrogate);
+        if (pendingHighSurrogate != 0) {
+            AppendCodePoint(result, kReplacementCharacter);
+            pendingHighSurrogate = 0;
+        }
+        if (i < text.size()) {
+            result += static_cast<char>(static_cast<char32_t>(text[i]) - kEscapedByteBase);
+        }
+        runStart = i + 1;
+    }
+    return result;
+}
+
+void AppendValidUtf8(std::string& out, std::string_view text) {
+    out.reserve(out.size() + text.size());
+
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(text.data());
+    size_t index = 0;
+    while (index < text.size()) {
+        if (bytes[index] < 0x80) {
+            out += static_cast<char>(bytes[index]);
+            ++index;
+            continue;
+        }
+        AppendCodePoint(out, DecodeUtf8Sequence(bytes, text.size(), index));
+    }
+}
+} // namespace TextEncoding
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace TextEncoding {
+// Appends the UTF-8 form of a UTF-16 (Windows) or UTF-32 (POSIX) buffer to out.
+// A high surrogate at the end of the buffer is kept in pendingHighSurrogate and completed by
+// the next call, so text may be encoded in arbitrary chunks. Unpaired surrogates become U+FFFD.
+void AppendUtf8(std::string& out, const wchar_t* data, size_t length, wchar_t& pendingHighSurrogate);
+
+std::string ToUtf8(std::wstring_view text);
+
+// Appends the wide form of complete UTF-8 text to out; invalid sequences become U+FFFD.
+void AppendWide(std::wstring& out, const char* data, size_t length);
+
+std::wstring FromUtf8(std::string_view text);
+
+// Whether text is well-formed UTF-8, by the same rules AppendWide() decodes with.
+bool IsValidUtf8(std::string_view text);
+
+// Appends text to out with every invalid sequence replaced by U+FFFD, exactly as a round trip
+// through AppendWide() and AppendUtf8() would.
+void AppendValidUtf8(std::string& out, std::string_view text);
+
+// Lossless wide form of POSIX path bytes, which need not be UTF-8: each byte of an invalid
+// sequence becomes the lone surrogate U+DC00 + byte, which no well-formed UTF-8 decodes to.
+// ToPathBytes() turns those back into the bytes and encodes everything else as ToUtf8() does;
+// displayed through ToUtf8() they show as U+FFFD.
+std::wstring FromPathBytes(std::string_view bytes);
+std::string ToPathBytes(std::wstring_view text);
+} // namespace TextEncoding
@@ -0,0 +1,149 @@
+#include "TextEscaping.h"
+
+#include <cstdint>
+#include <iterator>
+#include <type_traits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXT_ESCAPING_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace {
+struct JsonSpecials {
+    static constexpr bool kControl = true;
+    static constexpr char kChars[] = {'"', '\\', '/'};
+};
+
+struct XmlSpecials {
+    static constexpr bool kControl = false;
+    static constexpr char kChars[] = {'&', '<', '>', '"', '\''};
+};
+
+template <typename Specials, typename Unit>
+bool IsSpecial(Unit ch) {
+    using UnsignedUnit = std::make_unsigned_t<Unit>;
+    const UnsignedUnit value = static_cast<UnsignedUnit>(ch);
+    if constexpr (Specials::kControl) {
+        if (value < 0x20) {
+            return true;
+        }
+    }
+    for (char special : Specials::kChars) {
+        if (value == static_cast<UnsignedUnit>(special)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#ifdef TEXT_ESCAPING_SSE2
+unsigned CountTrailingZeros(uint32_t mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+#endif
+
+#ifdef TEXT_ESCAPING_SSE2
+// Per-lane-width SSE2 operations. BelowSpace yields all-ones lanes for values below U+0020,
+// compared as unsigned.
+template <size_t kUnitSize>
+struct Sse2Lanes;
+
+template <>
+struct Sse2Lanes<1> {
+    static __m128i Set(char value) { return _mm_set1_epi8(value); }
+    static __m128i Equal(__m128i a, __m128i b) { return _mm_cmpeq_epi8(a, b); }
+    static __m128i BelowSpace(__m128i x) {
+        return _mm_cmpeq_epi8(_mm_subs_epu8(x, _mm_set1_epi8(0x1F)), _mm_setzero_si128());
+    }
+};
+
+template <>
+struct Sse2Lanes<2> {
+    static __m128i Set(char value) { return _mm_set1_epi16(static_cast<short>(value)); }
+    static __m128i Equal(__m128i a, __m128i b) { return _mm_cmpeq_epi16(a, b); }
+    static __m128i BelowSpace(__m128i x) {
+        return _mm_cmpeq_epi16(_mm_subs_epu16(x, _mm_set1_epi16(0x1F)), _mm_setzero_si128());
+    }
+};
+
+template <>
+struct Sse2Lanes<4> {
+    static __m128i Set(char value) { return _mm_set1_epi32(value); }
+    static __m128i Equal(__m128i a, __m128i b) { return _mm_cmpeq_epi32(a, b); }
+    static __m128i BelowSpace(__m128i x) {
+        // No unsigned 32-bit compare: take 0 <= x < 0x20 as signed instead.
+        return _mm_andnot_si128(_mm_cmplt_epi32(x, _mm_setzero_si128()), _mm_cmplt_epi32(x, _mm_set1_epi32(0x20)));
+    }
+};
+#endif
+
+template <typename Specials, typename Unit>
+size_t FindSpecial(const Unit* data, size_t length) {
+    constexpr size_t kSpecialCount = std::size(Specials::kChars);
+    size_t index = 0;
+
+#ifdef TEXT_ESCAPING_SSE2
+    {
+        using Lanes = Sse2Lanes<sizeof(Unit)>;
+        constexpr size_t kUnitsPerVector = sizeof(__m128i) / sizeof(Unit);
+        __m128i needles[kSpecialCount];
+        for (size_t i = 0; i < kSpecialCount; ++i) {
+            needles[i] = Lanes::Set(Specials::kChars[i]);
+        }
+
+        for (; index + kUnitsPerVector <= length; index += kUnitsPerVector) {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + index));
+            __m128i hits = _mm_setzero_si128();
+            if constexpr (Specials::kControl) {
+                hits = Lanes::BelowSpace(chunk);
+            }
+            for (size_t i = 0; i < kSpecialCount; ++i) {
+                hits = _mm_or_si128(hits, Lanes::Equal(chunk, needles[i]));
+            }
+
+            const uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(hits));
+            if (mask != 0) {
+                return index + CountTrailingZeros(mask) / sizeof(Unit);
+            }
+        }
+    }
+#endif
+
+    // Tail shorter than a vector, or the whole text without SIMD support.
+    for (; index < length; ++index) {
+        if (IsSpecial<Specials>(data[index])) {
+            return index;
+        }
+    }
+    return length;
+}
+}
+
+namespace TextEscaping {
+size_t FindJsonEscape(const char* data, size_t length) {
+    return FindSpecial<JsonSpecials>(data, length);
+}
+
+size_t FindJsonEscape(const wchar_t* data, size_t length) {
+    return FindSpecial<JsonSpecials>(data, length);
+}
+
+size_t FindXmlEscape(const char* data, size_t length) {
+    return FindSpecial<XmlSpecials>(data, length);
+}
+
+size_t FindXmlEscape(const wchar_t* data, size_t length) {
+    return FindSpecial<XmlSpecials>(data, length);
+}
+} // namespace TextEscaping
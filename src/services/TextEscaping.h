@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+
+// Scanners used by the JSON and XML renderers to find the next code unit that has to be
+// escaped, so that the clean runs in between can be copied to the sink in bulk. Each returns
+// the index of the first such code unit, or length if the text needs no escaping at all.
+// SSE2 is used on x86, with a scalar loop everywhere else.
+namespace TextEscaping {
+// '"', '\\', '/' and control characters below U+0020.
+size_t FindJsonEscape(const char* data, size_t length);
+size_t FindJsonEscape(const wchar_t* data, size_t length);
+
+// '&', '<', '>', '"' and '\''.
+size_t FindXmlEscape(const char* data, size_t length);
+size_t FindXmlEscape(const wchar_t* data, size_t length);
+} // namespace TextEscaping
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Live counters of a running build. The traversal only stores into them and never formats or
+// allocates; a consumer reads them from any thread at its own pace. They are reset when a
+// build starts.
+struct TraversalProgress {
+    std::atomic<uint64_t> processedEntries{0};
+    // Depth of the directory listed most recently; the root is depth 0.
+    std::atomic<uint32_t> currentDepth{0};
+    // Output handed to the sink so far, in bytes of the sink's code unit.
+    std::atomic<uint64_t> bytesEmitted{0};
+
+    void Reset() {
+        processedEntries.store(0, std::memory_order_relaxed);
+        currentDepth.store(0, std::memory_order_relaxed);
+        bytesEmitted.store(0, std::memory_order_relaxed);
+    }
+};
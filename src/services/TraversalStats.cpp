@@ -0,0 +1,36 @@
+#include "TraversalStats.h"
+
+void TraversalStats::Merge(const TraversalStats& other) {
+    directories += other.directories;
+    files += other.files;
+    symlinks += other.symlinks;
+    skipped += other.skipped;
+    permissionDenied += other.permissionDenied;
+    cyclesBroken += other.cyclesBroken;
+    cachedDirectories += other.cachedDirectories;
+    statCalls += other.statCalls;
+    for (size_t i = 0; i < kTraversalPhaseCount; ++i) {
+        phaseTimes[i] += other.phaseTimes[i];
+    }
+    totalTime += other.totalTime;
+}
+
+const char* TraversalStats::PhaseName(TraversalPhase phase) {
+    switch (phase) {
+    case TraversalPhase::Listing:
+        return "listing";
+    case TraversalPhase::Stat:
+        return "stat";
+    case TraversalPhase::Sort:
+        return "sort";
+    case TraversalPhase::Render:
+        return "render";
+    case TraversalPhase::Encode:
+        return "encode";
+    case TraversalPhase::Write:
+        return "write";
+    case TraversalPhase::None:
+    default:
+        return "none";
+    }
+}
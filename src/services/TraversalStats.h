@@ -0,0 +1,100 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Where the time of a tree build goes. Encode is the wide-to-UTF-8 conversion when it runs as
+// a separate stage; renderers that emit UTF-8 directly count it under Render.
+enum class TraversalPhase : uint8_t {
+    Listing,
+    Stat,
+    Sort,
+    Render,
+    Encode,
+    Write,
+    None
+};
+
+constexpr size_t kTraversalPhaseCount = static_cast<size_t>(TraversalPhase::None);
+
+struct TraversalStats {
+    // Every listed entry is either a directory or a file; symlinks are counted in addition,
+    // under the kind of their target.
+    uint64_t directories = 0;
+    uint64_t files = 0;
+    uint64_t symlinks = 0;
+    // Directories that were not descended: beyond the depth limit or behind an unfollowed link.
+    uint64_t skipped = 0;
+    uint64_t permissionDenied = 0;
+    uint64_t cyclesBroken = 0;
+    // Directories served from a DirectoryCache instead of being listed.
+    uint64_t cachedDirectories = 0;
+    // Metadata queries (stat and its variants) for listed entries, identities and cache stamps;
+    // the checks of the root path itself are not counted.
+    uint64_t statCalls = 0;
+
+    // Exclusive time per phase. Listing, Stat and Sort are summed over all traversal threads,
+    // so with several workers they can add up to more than totalTime.
+    std::chrono::nanoseconds phaseTimes[kTraversalPhaseCount] = {};
+    std::chrono::nanoseconds totalTime{0};
+
+    std::chrono::nanoseconds PhaseTime(TraversalPhase phase) const {
+        return phaseTimes[static_cast<size_t>(phase)];
+    }
+
+    void Merge(const TraversalStats& other);
+
+    static const char* PhaseName(TraversalPhase phase);
+};
+
+// Collects TraversalStats on one thread. Time is charged to the current phase until the next
+// phase change, so nested phases are never counted twice. Components take a recorder pointer
+// and skip all bookkeeping when it is null.
+class TraversalRecorder {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    TraversalStats& Stats() { return m_stats; }
+    const TraversalStats& Stats() const { return m_stats; }
+    void Reset() { m_stats = TraversalStats{}; }
+
+    // Switches to phase and returns the phase that was active before.
+    TraversalPhase Enter(TraversalPhase phase) {
+        const Clock::time_point now = Clock::now();
+        if (m_phase != TraversalPhase::None) {
+            m_stats.phaseTimes[static_cast<size_t>(m_phase)] += now - m_phaseStart;
+        }
+        const TraversalPhase previous = m_phase;
+        m_phase = phase;
+        m_phaseStart = now;
+        return previous;
+    }
+
+private:
+    TraversalStats m_stats;
+    TraversalPhase m_phase = TraversalPhase::None;
+    Clock::time_point m_phaseStart;
+};
+
+// Charges the enclosed scope to a phase; a single branch when recorder is null.
+class PhaseScope {
+public:
+    PhaseScope(TraversalRecorder* recorder, TraversalPhase phase)
+        : m_recorder(recorder)
+        , m_previous(recorder ? recorder->Enter(phase) : TraversalPhase::None) {
+    }
+
+    ~PhaseScope() {
+        if (m_recorder) {
+            m_recorder->Enter(m_previous);
+        }
+    }
+
+    PhaseScope(const PhaseScope&) = delete;
+    PhaseScope& operator=(const PhaseScope&) = delete;
+
+private:
+    TraversalRecorder* m_recorder;
+    TraversalPhase m_previous;
+};
@@ -0,0 +1,310 @@
+#include "TreeDiff.h"
+
+#include "TreeNameOrder.h"
+#include "TreeSnapshot.h"
+
+namespace {
+bool IsDirectoryNode(const TreeNode& node) {
+    return node.isDirectory;
+}
+
+bool IsDirectoryNode(const SnapshotNode& node) {
+    return node.IsDirectory();
+}
+
+bool IsSymlinkNode(const TreeNode& node) {
+    return node.isSymlink;
+}
+
+bool IsSymlinkNode(const SnapshotNode& node) {
+    return node.IsSymlink();
+}
+
+bool HasTextOnlyChildren(const TreeNode& node) {
+    return node.textOnlyChildren;
+}
+
+bool HasTextOnlyChildren(const SnapshotNode& node) {
+    return node.HasTextOnlyChildren();
+}
+
+template <typename Tree>
+uint32_t FirstChild(const Tree& tree, uint32_t node) {
+    return node == Tree::kNoNode ? Tree::kNoNode : tree.Node(node).firstChild;
+}
+
+// Directories precede files in every child list; returns the first file, the end of the
+// directory run.
+template <typename Tree>
+uint32_t FirstFile(const Tree& tree, uint32_t node) {
+    while (node != Tree::kNoNode && IsDirectoryNode(tree.Node(node))) {
+        node = tree.Node(node).nextSibling;
+    }
+    return node;
+}
+
+// Moves cursor forward within [cursor, end) up to name and tells whether it is there. The
+// queries of one merge come in ascending order, so every cursor passes each node once.
+template <typename Tree>
+bool AdvanceTo(const Tree& tree, uint32_t& cursor, uint32_t end, NameView name) {
+    while (cursor != end) {
+        const int order = TreeNameOrder::CompareNames(tree.Name(cursor), name);
+        if (order == 0) {
+            return true;
+        }
+        if (order > 0) {
+            return false;
+        }
+        cursor = tree.Node(cursor).nextSibling;
+    }
+    return false;
+}
+}
+
+TreeDiff::TreeDiff()
+    : m_addedCount(0)
+    , m_removedCount(0)
+    , m_typeChangedCount(0) {
+}
+
+void TreeDiff::Compare(const TreeModel& oldTree, const TreeModel& newTree) {
+    CompareTrees(oldTree, newTree);
+}
+
+void TreeDiff::Compare(const TreeSnapshot& oldTree, const TreeModel& newTree) {
+    CompareTrees(oldTree, newTree);
+}
+
+void TreeDiff::Compare(const TreeModel& oldTree, const TreeSnapshot& newTree) {
+    CompareTrees(oldTree, newTree);
+}
+
+void TreeDiff::Compare(const TreeSnapshot& oldTree, const TreeSnapshot& newTree) {
+    CompareTrees(oldTree, newTree);
+}
+
+void TreeDiff::Clear() {
+    m_model.Clear();
+    m_changes.clear();
+    m_addedCount = 0;
+    m_removedCount = 0;
+    m_typeChangedCount = 0;
+}
+
+template <typename OldTree, typename NewTree>
+void TreeDiff::CompareTrees(const OldTree& oldTree, const NewTree& newTree) {
+    Clear();
+
+    const uint32_t oldRoot = oldTree.Root();
+    const uint32_t newRoot = newTree.Root();
+    if (oldRoot == OldTree::kNoNode && newRoot == NewTree::kNoNode) {
+        return;
+    }
+
+    // Result nodes keep the mark of the node they show, so that a diff of text trees leaves
+    // out the same children in the structured formats as the trees do.
+    if (newRoot != NewTree::kNoNode) {
+        m_model.AddRoot(newTree.Name(newRoot), IsDirectoryNode(newTree.Node(newRoot)));
+        if (HasTextOnlyChildren(newTree.Node(newRoot))) {
+            m_model.SetTextOnlyChildren(m_model.Root());
+        }
+    } else {
+        m_model.AddRoot(oldTree.Name(oldRoot), IsDirectoryNode(oldTree.Node(oldRoot)));
+        if (HasTextOnlyChildren(oldTree.Node(oldRoot))) {
+            m_model.SetTextOnlyChildren(m_model.Root());
+        }
+    }
+    const bool rootRetyped = oldRoot != OldTree::kNoNode && newRoot != NewTree::kNoNode &&
+                             IsDirectoryNode(oldTree.Node(oldRoot)) != IsDirectoryNode(newTree.Node(newRoot));
+    m_changes.push_back(rootRetyped ? TreeChange::TypeChanged : TreeChange::None);
+    m_typeChangedCount += rootRetyped ? 1 : 0;
+
+    // Levels are reused between branches, so their item buffers keep their capacity.
+    size_t depth = 1;
+    if (m_levels.empty()) {
+        m_levels.emplace_back();
+    }
+    Level& rootLevel = m_levels[0];
+    rootLevel.oldNode = oldRoot;
+    rootLevel.newNode = newRoot;
+    rootLevel.resultNode = m_model.Root();
+    rootLevel.lastChild = kNoNode;
+    MergeChildren(oldTree, newTree, rootLevel);
+
+    while (depth > 0) {
+        const size_t levelIndex = depth - 1;
+        if (m_levels[levelIndex].next == m_levels[levelIndex].items.size()) {
+            --depth;
+            continue;
+        }
+
+        const Item item = m_levels[levelIndex].items[m_levels[levelIndex].next++];
+        if (item.change == TreeChange::None) {
+            if (m_levels.size() == depth) {
+                m_levels.emplace_back();
+            }
+            Level& child = m_levels[depth++];
+            child.oldNode = item.oldNode;
+            child.newNode = item.newNode;
+            child.resultNode = kNoNode;
+            child.lastChild = kNoNode;
+            MergeChildren(oldTree, newTree, child);
+            continue;
+        }
+
+        MaterializeLevel(newTree, levelIndex);
+        if (item.change == TreeChange::Removed) {
+            CopySubtree(oldTree, item.oldNode, levelIndex, TreeChange::Removed);
+        } else {
+            CopySubtree(newTree, item.newNode, levelIndex, item.change);
+        }
+    }
+}
+
+template <typename OldTree, typename NewTree>
+void TreeDiff::MergeChildren(const OldTree& oldTree, const NewTree& newTree, Level& level) {
+    level.items.clear();
+    level.next = 0;
+
+    const uint32_t oldDirectories = FirstChild(oldTree, level.oldNode);
+    const uint32_t oldFiles = FirstFile(oldTree, oldDirectories);
+    const uint32_t newDirectories = FirstChild(newTree, level.newNode);
+    const uint32_t newFiles = FirstFile(newTree, newDirectories);
+
+    // Directory run: the new directories and the removed ones, in display order. A directory
+    // replaced by a file shows up in the file run instead.
+    uint32_t oldCursor = oldDirectories;
+    uint32_t newCursor = newDirectories;
+    uint32_t oldFileLookup = oldFiles;
+    uint32_t newFileLookup = newFiles;
+    while (oldCursor != oldFiles || newCursor != newFiles) {
+        const int order = oldCursor == oldFiles ? 1
+                        : newCursor == newFiles ? -1
+                        : TreeNameOrder::CompareNames(oldTree.Name(oldCursor), newTree.Name(newCursor));
+        if (order == 0) {
+            const bool oldIsSymlink = IsSymlinkNode(oldTree.Node(oldCursor));
+            if (oldIsSymlink != IsSymlinkNode(newTree.Node(newCursor))) {
+                level.items.push_back(Item{TreeChange::TypeChanged, oldCursor, newCursor});
+            } else if (oldTree.Node(oldCursor).firstChild != OldTree::kNoNode ||
+                       newTree.Node(newCursor).firstChild != NewTree::kNoNode) {
+                level.items.push_back(Item{TreeChange::None, oldCursor, newCursor});
+            }
+            oldCursor = oldTree.Node(oldCursor).nextSibling;
+            newCursor = newTree.Node(newCursor).nextSibling;
+        } else if (order < 0) {
+            if (!AdvanceTo(newTree, newFileLookup, NewTree::kNoNode, oldTree.Name(oldCursor))) {
+                level.items.push_back(Item{TreeChange::Removed, oldCursor, kNoNode});
+            }
+            oldCursor = oldTree.Node(oldCursor).nextSibling;
+        } else {
+            const bool wasFile = AdvanceTo(oldTree, oldFileLookup, OldTree::kNoNode, newTree.Name(newCursor));
+            level.items.push_back(Item{wasFile ? TreeChange::TypeChanged : TreeChange::Added, kNoNode, newCursor});
+            newCursor = newTree.Node(newCursor).nextSibling;
+        }
+    }
+
+    // File run, the mirror image.
+    oldCursor = oldFiles;
+    newCursor = newFiles;
+    uint32_t oldDirectoryLookup = oldDirectories;
+    uint32_t newDirectoryLookup = newDirectories;
+    while (oldCursor != OldTree::kNoNode || newCursor != NewTree::kNoNode) {
+        const int order = oldCursor == OldTree::kNoNode ? 1
+                        : newCursor == NewTree::kNoNode ? -1
+                        : TreeNameOrder::CompareNames(oldTree.Name(oldCursor), newTree.Name(newCursor));
+        if (order == 0) {
+            if (IsSymlinkNode(oldTree.Node(oldCursor)) != IsSymlinkNode(newTree.Node(newCursor))) {
+                level.items.push_back(Item{TreeChange::TypeChanged, oldCursor, newCursor});
+            }
+            oldCursor = oldTree.Node(oldCursor).nextSibling;
+            newCursor = newTree.Node(newCursor).nextSibling;
+        } else if (order < 0) {
+            if (!AdvanceTo(newTree, newDirectoryLookup, newFiles, oldTree.Name(oldCursor))) {
+                level.items.push_back(Item{TreeChange::Removed, oldCursor, kNoNode});
+            }
+            oldCursor = oldTree.Node(oldCursor).nextSibling;
+        } else {
+            const bool wasDirectory = AdvanceTo(oldTree, oldDirectoryLookup, oldFiles, newTree.Name(newCursor));
+            level.items.push_back(Item{wasDirectory ? TreeChange::TypeChanged : TreeChange::Added, kNoNode, newCursor});
+            newCursor = newTree.Node(newCursor).nextSibling;
+        }
+    }
+}
+
+template <typename NewTree>
+void TreeDiff::MaterializeLevel(const NewTree& newTree, size_t levelIndex) {
+    size_t first = levelIndex;
+    while (m_levels[first].resultNode == kNoNode) {
+        --first;
+    }
+    for (size_t i = first + 1; i <= levelIndex; ++i) {
+        const auto& node = newTree.Node(m_levels[i].newNode);
+        Level& parent = m_levels[i - 1];
+        m_levels[i].resultNode = Append(parent.resultNode, parent.lastChild, newTree.Name(m_levels[i].newNode),
+                                        IsDirectoryNode(node), IsSymlinkNode(node), HasTextOnlyChildren(node),
+                                        TreeChange::None);
+    }
+}
+
+template <typename Tree>
+void TreeDiff::CopySubtree(const Tree& tree, uint32_t source, size_t levelIndex, TreeChange rootChange) {
+    const auto& sourceNode = tree.Node(source);
+    Level& level = m_levels[levelIndex];
+    const uint32_t top = Append(level.resultNode, level.lastChild, tree.Name(source), IsDirectoryNode(sourceNode),
+                                IsSymlinkNode(sourceNode), HasTextOnlyChildren(sourceNode), rootChange);
+    if (sourceNode.firstChild == Tree::kNoNode) {
+        return;
+    }
+
+    // Below a removed entry everything is removed; below an added or retyped one, added.
+    const TreeChange childChange = rootChange == TreeChange::Removed ? TreeChange::Removed : TreeChange::Added;
+
+    // Pre-order walk of the source subtree; the stack holds the copy of each open ancestor.
+    m_copyParents.clear();
+    m_copyParents.push_back(CopyParent{top, kNoNode});
+
+    uint32_t node = sourceNode.firstChild;
+    for (;;) {
+        const auto& current = tree.Node(node);
+        CopyParent& parent = m_copyParents.back();
+        const uint32_t copy = Append(parent.resultNode, parent.lastChild, tree.Name(node), IsDirectoryNode(current),
+                                     IsSymlinkNode(current), HasTextOnlyChildren(current), childChange);
+        if (current.firstChild != Tree::kNoNode) {
+            m_copyParents.push_back(CopyParent{copy, kNoNode});
+            node = current.firstChild;
+            continue;
+        }
+
+        while (tree.Node(node).nextSibling == Tree::kNoNode) {
+            node = tree.Node(node).parent;
+            m_copyParents.pop_back();
+            if (node == source) {
+                return;
+            }
+        }
+        node = tree.Node(node).nextSibling;
+    }
+}
+
+uint32_t TreeDiff::Append(uint32_t parent, uint32_t& lastChild, NameView name, bool isDirectory, bool isSymlink,
+                          bool textOnlyChildren, TreeChange change) {
+    lastChild = m_model.AddChild(parent, lastChild, name, isDirectory, isSymlink);
+    if (textOnlyChildren) {
+        m_model.SetTextOnlyChildren(lastChild);
+    }
+    m_changes.push_back(change);
+    switch (change) {
+    case TreeChange::Added:
+        ++m_addedCount;
+        break;
+    case TreeChange::Removed:
+        ++m_removedCount;
+        break;
+    case TreeChange::TypeChanged:
+        ++m_typeChangedCount;
+        break;
+    case TreeChange::None:
+        break;
+    }
+    return lastChild;
+}
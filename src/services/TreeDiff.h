@@ -0,0 +1,91 @@
+#pragma once
+
+#include "TreeModel.h"
+#include "TreeRenderer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+class TreeSnapshot;
+
+// Differences between two trees whose siblings follow TreeNameOrder, as every built tree does.
+// Each level is a linear merge of the two sorted child lists, so a comparison is linear in the
+// size of the trees and needs memory only for the open levels and the result.
+//
+// The result is a tree itself: the changed entries and the directories leading to them, each
+// node carrying its TreeChange, so it renders in any TreeFormat. Added and removed directories
+// come with their whole subtree; an entry whose type changed shows its new form, with the new
+// children marked as added. The two roots are matched whatever their names.
+class TreeDiff {
+public:
+    static constexpr uint32_t kNoNode = TreeModel::kNoNode;
+
+    TreeDiff();
+
+    void Compare(const TreeModel& oldTree, const TreeModel& newTree);
+    void Compare(const TreeSnapshot& oldTree, const TreeModel& newTree);
+    void Compare(const TreeModel& oldTree, const TreeSnapshot& newTree);
+    void Compare(const TreeSnapshot& oldTree, const TreeSnapshot& newTree);
+
+    const TreeNode& Node(uint32_t index) const { return m_model.Node(index); }
+    NameView Name(uint32_t index) const { return m_model.Name(index); }
+    TreeChange Change(uint32_t index) const { return m_changes[index]; }
+
+    uint32_t Root() const { return m_model.Root(); }
+    size_t Size() const { return m_model.Size(); }
+    bool Empty() const { return m_model.Empty(); }
+
+    size_t AddedCount() const { return m_addedCount; }
+    size_t RemovedCount() const { return m_removedCount; }
+    size_t TypeChangedCount() const { return m_typeChangedCount; }
+    bool HasChanges() const { return m_addedCount + m_removedCount + m_typeChangedCount > 0; }
+
+    void Clear();
+
+private:
+    // A change to emit, or a pair of matching directories to descend into (change == None).
+    struct Item {
+        TreeChange change;
+        uint32_t oldNode;
+        uint32_t newNode;
+    };
+
+    // One open level of the comparison. The matching result node is only created once the
+    // first change below it is found, so unchanged directories leave no trace.
+    struct Level {
+        uint32_t oldNode;
+        uint32_t newNode;
+        uint32_t resultNode;
+        uint32_t lastChild;
+        std::vector<Item> items;
+        size_t next;
+    };
+
+    struct CopyParent {
+        uint32_t resultNode;
+        uint32_t lastChild;
+    };
+
+    template <typename OldTree, typename NewTree>
+    void CompareTrees(const OldTree& oldTree, const NewTree& newTree);
+    template <typename OldTree, typename NewTree>
+    void MergeChildren(const OldTree& oldTree, const NewTree& newTree, Level& level);
+    template <typename Tree>
+    void CopySubtree(const Tree& tree, uint32_t source, size_t levelIndex, TreeChange rootChange);
+    template <typename NewTree>
+    void MaterializeLevel(const NewTree& newTree, size_t levelIndex);
+
+    // Adds a result node after lastChild and updates it.
+    uint32_t Append(uint32_t parent, uint32_t& lastChild, NameView name, bool isDirectory, bool isSymlink,
+                    bool textOnlyChildren, TreeChange change);
+
+    TreeModel m_model;
+    std::vector<TreeChange> m_changes;
+    std::vector<Level> m_levels;
+    std::vector<CopyParent> m_copyParents;
+    size_t m_addedCount;
+    size_t m_removedCount;
+    size_t m_typeChangedCount;
+};
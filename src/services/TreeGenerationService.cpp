@@ -6,8 +6,7 @@
 #include <exception>
 
 TreeGenerationService::TreeGenerationService()
-    : m_cancelRequested(false)
-    , m_running(false) {
+    : m_running(false) {
 }
 
 TreeGenerationService::~TreeGenerationService() {
@@ -17,36 +16,57 @@ TreeGenerationService::~TreeGenerationService() {
 void TreeGenerationService::Start(const std::wstring& rootPath, int depth, bool expandSymlinks, CompletionCallback onCompleted, ErrorCallback onError, ProgressCallback onProgress) {
     Cancel();
 
-    m_cancelRequested.store(false);
+    m_stopToken.Reset();
     m_running.store(true);
+    m_progress.Reset();
+    m_output.Clear();
+    m_model.reset();
 
     m_worker = std::thread([this, rootPath, depth, expandSymlinks, onCompleted = std::move(onCompleted), onError = std::move(onError), onProgress = std::move(onProgress)]() mutable {
         try {
             DirectoryTreeBuilder builder;
-            BuildTreeResult result = builder.BuildTree(
+            builder.SetProgress(&m_progress);
+            builder.SetDirectoryCache(&m_directoryCache);
+            auto model = std::make_shared<TreeModel>();
+            BuildTreeResult result = builder.BuildTreeModel(
                 rootPath,
                 depth,
                 TreeFormat::TEXT,
+                *model,
                 expandSymlinks,
-                [this]() { return m_cancelRequested.load(); },
+                &m_stopToken,
                 onProgress
             );
+            if (result.success) {
+                std::unique_ptr<TreeRenderer> renderer = TreeRenderer::Create(TreeFormat::TEXT, m_output);
+                renderer->SetStopToken(&m_stopToken);
+                renderer->RenderModel(*model);
+                renderer->Flush();
+            }
 
-            if (m_cancelRequested.load()) {
+            if (m_stopToken.StopRequested()) {
+                m_output.Clear();
                 m_running.store(false);
                 return;
             }
 
             if (result.success) {
+                // Directories that are gone or were not visited by this build are dropped.
+                m_directoryCache.Prune();
+                m_model = std::move(model);
                 if (onCompleted) {
-                    onCompleted(std::move(result.content));
+                    onCompleted();
+                }
+            } else {
+                m_output.Clear();
+                if (onError) {
+                    onError(std::move(result.errorMessage));
                 }
-            } else if (onError) {
-                onError(std::move(result.errorMessage));
             }
         }
         catch (const std::exception& e) {
-            if (!m_cancelRequested.load() && onError) {
+            m_output.Clear();
+            if (!m_stopToken.StopRequested() && onError) {
                 std::wstring error = L"Ошибка: ";
                 error += std::wstring(e.what(), e.what() + strlen(e.what()));
                 onError(std::move(error));
@@ -58,7 +78,7 @@ void TreeGenerationService::Start(const std::wstring& rootPath, int depth, bool
 }
 
 void TreeGenerationService::Cancel() {
-    m_cancelRequested.store(true);
+    m_stopToken.RequestStop();
 
     if (m_worker.joinable()) {
         m_worker.join();
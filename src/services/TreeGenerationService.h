@@ -1,13 +1,20 @@
 #pragma once
 
+#include "DirectoryCache.h"
+#include "RenderedTreeText.h"
+#include "StopToken.h"
+#include "TraversalProgress.h"
+#include "TreeModel.h"
+
 #include <atomic>
 #include <functional>
+#include <memory>
 #include <string>
 #include <thread>
 
 class TreeGenerationService {
 public:
-    using CompletionCallback = std::function<void(std::wstring&&)>;
+    using CompletionCallback = std::function<void()>;
     using ErrorCallback = std::function<void(std::wstring&&)>;
     using ProgressCallback = std::function<void(const std::wstring&)>;
 
@@ -17,8 +24,25 @@ public:
     void Start(const std::wstring& rootPath, int depth, bool expandSymlinks, CompletionCallback onCompleted, ErrorCallback onError, ProgressCallback onProgress = {});
     void Cancel();
 
+    // Live counters of the running build, for the UI to poll on its own timer.
+    const TraversalProgress& Progress() const { return m_progress; }
+
+    // Text of the last build. It fills while the build runs, is complete once onCompleted is
+    // called and stays empty after a failure; Start() clears it.
+    const RenderedTreeText& Output() const { return m_output; }
+
+    // Structure of the last completed build, for exports in other formats. It is shared, so an
+    // export running in the background keeps it alive across the next Start(). nullptr until a
+    // build completes.
+    std::shared_ptr<const TreeModel> Model() const { return m_model; }
+
 private:
     std::thread m_worker;
-    std::atomic<bool> m_cancelRequested;
+    TraversalProgress m_progress;
+    RenderedTreeText m_output;
+    std::shared_ptr<const TreeModel> m_model;
+    StopToken m_stopToken;
+    // Kept between builds, so pressing the button again re-reads only changed directories.
+    DirectoryCache m_directoryCache;
     std::atomic<bool> m_running;
 };
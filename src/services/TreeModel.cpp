@@ -0,0 +1,47 @@
+#include "TreeModel.h"
+
+uint32_t TreeModel::AddRoot(NameView name, bool isDirectory) {
+    Clear();
+    m_nodes.push_back(TreeNode{kNoNode, kNoNode, kNoNode, m_names.Intern(name), isDirectory, false, false});
+    return 0;
+}
+
+uint32_t TreeModel::AddChild(uint32_t parent, uint32_t previousSibling, NameView name, bool isDirectory,
+                             bool isSymlink) {
+    const uint32_t index = static_cast<uint32_t>(m_nodes.size());
+    m_nodes.push_back(TreeNode{parent, kNoNode, kNoNode, m_names.Intern(name), isDirectory, isSymlink, false});
+    Link(index, parent, previousSibling);
+    return index;
+}
+
+uint32_t TreeModel::AddUnlinked(NameView name, bool isDirectory, bool isSymlink) {
+    const uint32_t index = static_cast<uint32_t>(m_nodes.size());
+    m_nodes.push_back(TreeNode{kNoNode, kNoNode, kNoNode, m_names.Intern(name), isDirectory, isSymlink, false});
+    return index;
+}
+
+void TreeModel::Unlink(uint32_t node) {
+    const uint32_t parent = m_nodes[node].parent;
+    uint32_t* link = &m_nodes[parent].firstChild;
+    while (*link != node) {
+        link = &m_nodes[*link].nextSibling;
+    }
+    *link = m_nodes[node].nextSibling;
+    m_nodes[node].nextSibling = kNoNode;
+}
+
+void TreeModel::Link(uint32_t node, uint32_t parent, uint32_t previousSibling) {
+    uint32_t& link = previousSibling == kNoNode ? m_nodes[parent].firstChild : m_nodes[previousSibling].nextSibling;
+    m_nodes[node].parent = parent;
+    m_nodes[node].nextSibling = link;
+    link = node;
+}
+
+void TreeModel::Rename(uint32_t node, NameView name) {
+    m_nodes[node].name = m_names.Intern(name);
+}
+
+void TreeModel::Clear() {
+    m_nodes.clear();
+    m_names.Clear();
+}
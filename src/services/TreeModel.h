@@ -0,0 +1,62 @@
+#pragma once
+
+#include "StringArena.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string_view>
+#include <vector>
+
+// One entry of the flat node table. Links are indices into TreeModel, kNoNode marks their absence.
+struct TreeNode {
+    uint32_t parent;
+    uint32_t firstChild;
+    uint32_t nextSibling;
+    StringRef name;
+    bool isDirectory;
+    bool isSymlink;
+    // The children exist only under the text view's root rules: the root of a depth 0 build, or
+    // a directory that leads back to the root through a link. JSON and XML render it without them.
+    bool textOnlyChildren;
+};
+
+// Directory tree stored as a contiguous node table with all names interned in one StringArena.
+// Children of a node are kept in display order through the firstChild/nextSibling chain.
+class TreeModel {
+public:
+    static constexpr uint32_t kNoNode = std::numeric_limits<uint32_t>::max();
+
+    TreeModel() = default;
+    TreeModel(TreeModel&&) noexcept = default;
+    TreeModel& operator=(TreeModel&&) noexcept = default;
+
+    uint32_t AddRoot(NameView name, bool isDirectory);
+    // Appends a node to the table and links it in after previousSibling (or as the first child
+    // when it is kNoNode).
+    uint32_t AddChild(uint32_t parent, uint32_t previousSibling, NameView name, bool isDirectory,
+                      bool isSymlink = false);
+
+    // In-place edits for models that follow a changing directory. An unlinked subtree stays in
+    // the table until the model is rebuilt, and edited models no longer keep children after
+    // their parents, so they are not fit for TreeSnapshot::Save as they are.
+    uint32_t AddUnlinked(NameView name, bool isDirectory, bool isSymlink);
+    void Unlink(uint32_t node);
+    void Link(uint32_t node, uint32_t parent, uint32_t previousSibling);
+    void Rename(uint32_t node, NameView name);
+    void SetTextOnlyChildren(uint32_t node) { m_nodes[node].textOnlyChildren = true; }
+
+    const TreeNode& Node(uint32_t index) const { return m_nodes[index]; }
+    NameView Name(uint32_t index) const { return m_names.View(m_nodes[index].name); }
+
+    uint32_t Root() const { return m_nodes.empty() ? kNoNode : 0; }
+    size_t Size() const { return m_nodes.size(); }
+    bool Empty() const { return m_nodes.empty(); }
+
+    void Reserve(size_t nodeCount) { m_nodes.reserve(nodeCount); }
+    void Clear();
+
+private:
+    std::vector<TreeNode> m_nodes;
+    StringArena m_names;
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "TextEncoding.h"
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+// Code unit of entry names inside the engine: the native path encoding, so names travel from
+// the directory listing to the output without conversion. That is UTF-16 on Windows, where
+// the file system and the UI speak it, and UTF-8 elsewhere, a quarter of the 32-bit wchar_t.
+// Wide text is produced only at the edges: UI strings, messages and the wide sinks.
+using NameChar = std::filesystem::path::value_type;
+using NameString = std::basic_string<NameChar>;
+using NameView = std::basic_string_view<NameChar>;
+
+inline NameString ToName(std::wstring_view text) {
+#ifdef _WIN32
+    return NameString(text);
+#else
+    return TextEncoding::ToUtf8(text);
+#endif
+}
+
+inline std::wstring FromName(NameView name) {
+#ifdef _WIN32
+    return std::wstring(name);
+#else
+    return TextEncoding::FromUtf8(name);
+#endif
+}
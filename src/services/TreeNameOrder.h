@@ -0,0 +1,39 @@
+#pragma once
+
+#include "TreeName.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <type_traits>
+
+// Order of siblings in every tree: directories first, then names compared with A-Z folded to
+// a-z. Names that fold to the same text fall back to a plain comparison, so the order is total.
+// Code units compare unsigned, so UTF-8 names sort exactly like their code points.
+namespace TreeNameOrder {
+// The application runs in the C locale, where towlower maps only A-Z. Folding that range
+// directly gives the same order without a locale lookup per character.
+inline bool IsFoldable(NameChar ch) {
+    return ch >= 'A' && ch <= 'Z';
+}
+
+inline NameChar Fold(NameChar ch) {
+    return IsFoldable(ch) ? static_cast<NameChar>(ch + ('a' - 'A')) : ch;
+}
+
+// Negative, zero or positive like NameView::compare.
+inline int CompareNames(NameView left, NameView right) {
+    using Unit = std::make_unsigned_t<NameChar>;
+    const size_t length = (std::min)(left.size(), right.size());
+    for (size_t i = 0; i < length; ++i) {
+        const Unit a = static_cast<Unit>(Fold(left[i]));
+        const Unit b = static_cast<Unit>(Fold(right[i]));
+        if (a != b) {
+            return a < b ? -1 : 1;
+        }
+    }
+    if (left.size() != right.size()) {
+        return left.size() < right.size() ? -1 : 1;
+    }
+    return left.compare(right);
+}
+} // namespace TreeNameOrder
@@ -0,0 +1,97 @@
+#include "TreeOutputSink.h"
+
+#include "TextEncoding.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+CallbackOutputSink::CallbackOutputSink(ChunkCallback callback, size_t bufferChars)
+    : TreeOutputSink(bufferChars)
+    , m_callback(std::move(callback)) {
+}
+
+bool CallbackOutputSink::WriteChunk(const wchar_t* data, size_t length) {
+    return m_callback && m_callback(data, length);
+}
+
+Utf8FileOutputSink::Utf8FileOutputSink(const std::wstring& fileName, size_t bufferBytes)
+    : Utf8OutputSink(bufferBytes)
+    , m_file(nullptr) {
+#ifdef _WIN32
+    HANDLE hFile = CreateFile(fileName.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    m_file = hFile == INVALID_HANDLE_VALUE ? nullptr : hFile;
+#else
+    m_file = std::fopen(TextEncoding::ToPathBytes(fileName).c_str(), "wb");
+#endif
+}
+
+Utf8FileOutputSink::~Utf8FileOutputSink() {
+    Close();
+}
+
+bool Utf8FileOutputSink::IsOpen() const {
+    return m_file != nullptr;
+}
+
+bool Utf8FileOutputSink::Close() {
+    if (!m_file) {
+        return false;
+    }
+
+    bool ok = Flush();
+#ifdef _WIN32
+    CloseHandle(static_cast<HANDLE>(m_file));
+#else
+    ok = std::fclose(static_cast<std::FILE*>(m_file)) == 0 && ok;
+#endif
+    m_file = nullptr;
+    return ok;
+}
+
+bool Utf8FileOutputSink::WriteChunk(const char* data, size_t length) {
+    if (!m_file) {
+        return false;
+    }
+
+#ifdef _WIN32
+    while (length > 0) {
+        const DWORD bytesToWrite = static_cast<DWORD>((std::min)(length, static_cast<size_t>(1u << 30)));
+        DWORD bytesWritten = 0;
+        if (!WriteFile(static_cast<HANDLE>(m_file), data, bytesToWrite, &bytesWritten, nullptr) || bytesWritten != bytesToWrite) {
+            return false;
+        }
+        data += bytesWritten;
+        length -= bytesWritten;
+    }
+    return true;
+#else
+    return std::fwrite(data, 1, length, static_cast<std::FILE*>(m_file)) == length;
+#endif
+}
+
+Utf8EncodingSink::Utf8EncodingSink(Utf8OutputSink& target, size_t bufferChars)
+    : TreeOutputSink(bufferChars)
+    , m_target(target)
+    , m_pendingHighSurrogate(0) {
+}
+
+bool Utf8EncodingSink::Finish() {
+    bool ok = Flush();
+    if (m_pendingHighSurrogate != 0) {
+        // The text ended in the middle of a surrogate pair.
+        m_pendingHighSurrogate = 0;
+        m_target.Append("\xEF\xBF\xBD", 3);
+    }
+    return ok && !m_target.Failed();
+}
+
+bool Utf8EncodingSink::WriteChunk(const wchar_t* data, size_t length) {
+    m_encoded.clear();
+    {
+        PhaseScope encode(StatsRecorder(), TraversalPhase::Encode);
+        TextEncoding::AppendUtf8(m_encoded, data, length, m_pendingHighSurrogate);
+    }
+    m_target.Append(m_encoded.data(), m_encoded.size());
+    return !m_target.Failed();
+}
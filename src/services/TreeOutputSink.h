@@ -0,0 +1,190 @@
+#pragma once
+
+#include "TraversalProgress.h"
+#include "TraversalStats.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Append-only text sink shared by the tree renderers. Appends land in a fixed-size buffer
+// that is handed to WriteChunk() whenever it fills up, so the caller decides whether output
+// is accumulated, streamed to a file or forwarded elsewhere. CharT is the output code unit:
+// wchar_t for UI text, char for UTF-8 bytes.
+template <typename CharT>
+class BasicTreeOutputSink {
+public:
+    static constexpr size_t kDefaultBufferChars = 64 * 1024;
+
+    // bufferChars == 0 disables buffering: every append goes straight to WriteChunk().
+    explicit BasicTreeOutputSink(size_t bufferChars = kDefaultBufferChars)
+        : m_buffer(bufferChars > 0 ? new CharT[bufferChars] : nullptr)
+        , m_capacity(bufferChars)
+        , m_used(0)
+        , m_failed(false)
+        , m_recorder(nullptr)
+        , m_progress(nullptr) {
+    }
+
+    virtual ~BasicTreeOutputSink() = default;
+
+    BasicTreeOutputSink(const BasicTreeOutputSink&) = delete;
+    BasicTreeOutputSink& operator=(const BasicTreeOutputSink&) = delete;
+
+    void Append(const CharT* text, size_t length) {
+        if (length <= m_capacity - m_used) {
+            std::memcpy(m_buffer.get() + m_used, text, length * sizeof(CharT));
+            m_used += length;
+            return;
+        }
+        AppendSlow(text, length);
+    }
+
+    void Append(std::basic_string_view<CharT> text) { Append(text.data(), text.size()); }
+    void Append(CharT ch) { Append(&ch, 1); }
+
+    void AppendFill(CharT ch, size_t count) {
+        CharT fill[64];
+        std::fill(std::begin(fill), std::end(fill), ch);
+        while (count > 0) {
+            const size_t step = (std::min)(count, std::size(fill));
+            Append(fill, step);
+            count -= step;
+        }
+    }
+
+    // Pushes buffered text to WriteChunk(). Returns false once any write has failed.
+    bool Flush() {
+        if (m_used > 0) {
+            PhaseScope write(m_recorder, TraversalPhase::Write);
+            if (!m_failed && !WriteChunk(m_buffer.get(), m_used)) {
+                m_failed = true;
+            }
+            CountEmitted(m_used);
+            m_used = 0;
+        }
+        return !m_failed;
+    }
+
+    bool Failed() const { return m_failed; }
+
+    // Time spent in WriteChunk() is charged to TraversalPhase::Write; nullptr turns it off.
+    void SetStatsRecorder(TraversalRecorder* recorder) { m_recorder = recorder; }
+    TraversalRecorder* StatsRecorder() const { return m_recorder; }
+
+    // Every chunk handed to WriteChunk() is added to progress->bytesEmitted; nullptr turns it off.
+    void SetProgress(TraversalProgress* progress) { m_progress = progress; }
+    TraversalProgress* Progress() const { return m_progress; }
+
+protected:
+    virtual bool WriteChunk(const CharT* data, size_t length) = 0;
+
+private:
+    void AppendSlow(const CharT* text, size_t length) {
+        Flush();
+        if (length >= m_capacity) {
+            // Larger than the whole buffer: bypass it instead of splitting the text.
+            PhaseScope write(m_recorder, TraversalPhase::Write);
+            if (!m_failed && length > 0 && !WriteChunk(text, length)) {
+                m_failed = true;
+            }
+            CountEmitted(length);
+            return;
+        }
+
+        std::memcpy(m_buffer.get(), text, length * sizeof(CharT));
+        m_used = length;
+    }
+
+    void CountEmitted(size_t length) {
+        if (m_progress) {
+            m_progress->bytesEmitted.fetch_add(length * sizeof(CharT), std::memory_order_relaxed);
+        }
+    }
+
+    std::unique_ptr<CharT[]> m_buffer;
+    size_t m_capacity;
+    size_t m_used;
+    bool m_failed;
+    TraversalRecorder* m_recorder;
+    TraversalProgress* m_progress;
+};
+
+using TreeOutputSink = BasicTreeOutputSink<wchar_t>;
+using Utf8OutputSink = BasicTreeOutputSink<char>;
+
+// Accumulates the output in a caller-owned string.
+template <typename CharT>
+class BasicStringOutputSink : public BasicTreeOutputSink<CharT> {
+public:
+    explicit BasicStringOutputSink(std::basic_string<CharT>& target)
+        : BasicTreeOutputSink<CharT>(0)
+        , m_target(target) {
+    }
+
+protected:
+    bool WriteChunk(const CharT* data, size_t length) override {
+        m_target.append(data, length);
+        return true;
+    }
+
+private:
+    std::basic_string<CharT>& m_target;
+};
+
+using StringOutputSink = BasicStringOutputSink<wchar_t>;
+using Utf8StringOutputSink = BasicStringOutputSink<char>;
+
+// Forwards every flushed chunk to a callback; returning false from it aborts the output.
+class CallbackOutputSink : public TreeOutputSink {
+public:
+    using ChunkCallback = std::function<bool(const wchar_t* data, size_t length)>;
+
+    explicit CallbackOutputSink(ChunkCallback callback, size_t bufferChars = kDefaultBufferChars);
+
+protected:
+    bool WriteChunk(const wchar_t* data, size_t length) override;
+
+private:
+    ChunkCallback m_callback;
+};
+
+// Writes UTF-8 bytes to a file as they are flushed.
+class Utf8FileOutputSink : public Utf8OutputSink {
+public:
+    explicit Utf8FileOutputSink(const std::wstring& fileName, size_t bufferBytes = kDefaultBufferChars);
+    ~Utf8FileOutputSink() override;
+
+    bool IsOpen() const;
+    // Flushes the remaining bytes and closes the file. Returns false if anything failed.
+    bool Close();
+
+protected:
+    bool WriteChunk(const char* data, size_t length) override;
+
+private:
+    void* m_file;
+};
+
+// Encodes wide text to UTF-8 chunk by chunk and passes it on to a byte sink.
+class Utf8EncodingSink : public TreeOutputSink {
+public:
+    explicit Utf8EncodingSink(Utf8OutputSink& target, size_t bufferChars = kDefaultBufferChars);
+
+    // Flushes this sink and completes a dangling surrogate pair; does not flush the target.
+    bool Finish();
+
+protected:
+    bool WriteChunk(const wchar_t* data, size_t length) override;
+
+private:
+    Utf8OutputSink& m_target;
+    std::string m_encoded;
+    wchar_t m_pendingHighSurrogate;
+};
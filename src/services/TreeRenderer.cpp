@@ -0,0 +1,509 @@
+#include "TreeRenderer.h"
+
+#include "StopToken.h"
+#include "TextEncoding.h"
+#include "TextEscaping.h"
+#include "TreeDiff.h"
+#include "TreeModel.h"
+#include "TreeSnapshot.h"
+
+#include <string>
+#include <type_traits>
+
+namespace {
+template <typename CharT>
+struct TreeGlyphs;
+
+template <>
+struct TreeGlyphs<wchar_t> {
+    static constexpr std::wstring_view TREE_BRANCH{L"├── "};
+    static constexpr std::wstring_view TREE_LAST{L"└── "};
+    static constexpr std::wstring_view TREE_VERTICAL{L"│   "};
+    static constexpr std::wstring_view TREE_SPACE{L"    "};
+};
+
+// Pre-encoded UTF-8 forms of the same box-drawing prefixes.
+template <>
+struct TreeGlyphs<char> {
+    static constexpr std::string_view TREE_BRANCH{"\xE2\x94\x9C\xE2\x94\x80\xE2\x94\x80 "};
+    static constexpr std::string_view TREE_LAST{"\xE2\x94\x94\xE2\x94\x80\xE2\x94\x80 "};
+    static constexpr std::string_view TREE_VERTICAL{"\xE2\x94\x82   "};
+    static constexpr std::string_view TREE_SPACE{"    "};
+};
+
+// Picks the narrow or wide spelling of an ASCII literal for the output code unit.
+template <typename CharT>
+constexpr std::basic_string_view<CharT> Literal(std::string_view narrow, std::wstring_view wide) {
+    if constexpr (std::is_same_v<CharT, char>) {
+        static_cast<void>(wide);
+        return narrow;
+    } else {
+        static_cast<void>(narrow);
+        return wide;
+    }
+}
+
+#define TREE_LITERAL(text) Literal<CharT>(text, L##text)
+
+template <typename CharT>
+std::basic_string_view<CharT> ChangeName(TreeChange change) {
+    switch (change) {
+    case TreeChange::Added:
+        return TREE_LITERAL("added");
+    case TreeChange::Removed:
+        return TREE_LITERAL("removed");
+    case TreeChange::TypeChanged:
+        return TREE_LITERAL("typeChanged");
+    case TreeChange::None:
+    default:
+        return {};
+    }
+}
+
+// Prefix of a changed entry in the text view, in the spirit of a unified diff.
+template <typename CharT>
+std::basic_string_view<CharT> ChangeMarker(TreeChange change) {
+    switch (change) {
+    case TreeChange::Added:
+        return TREE_LITERAL("+ ");
+    case TreeChange::Removed:
+        return TREE_LITERAL("- ");
+    case TreeChange::TypeChanged:
+        return TREE_LITERAL("~ ");
+    case TreeChange::None:
+    default:
+        return {};
+    }
+}
+
+// Renderer base bound to a typed sink. Names arrive in the native encoding; those that need
+// converting to the output code unit are converted exactly once, into a reused scratch buffer.
+template <typename CharT>
+class SinkTreeRenderer : public TreeRenderer {
+public:
+    explicit SinkTreeRenderer(BasicTreeOutputSink<CharT>& sink)
+        : m_sink(sink) {
+    }
+
+    bool Flush() override {
+        return m_sink.Flush();
+    }
+
+protected:
+    std::basic_string_view<CharT> EncodeName(NameView name) {
+        if constexpr (std::is_same_v<CharT, NameChar> && std::is_same_v<CharT, wchar_t>) {
+            return name;
+        } else if constexpr (std::is_same_v<CharT, NameChar>) {
+            // Names are the file system's bytes: output stays valid UTF-8 by replacing the
+            // rare ill-formed sequence with U+FFFD.
+            const std::basic_string_view<CharT> bytes = name;
+            if (TextEncoding::IsValidUtf8(bytes)) {
+                return bytes;
+            }
+            m_nameScratch.clear();
+            TextEncoding::AppendValidUtf8(m_nameScratch, bytes);
+            return m_nameScratch;
+        } else if constexpr (std::is_same_v<CharT, char>) {
+            m_nameScratch.clear();
+            wchar_t pendingHighSurrogate = 0;
+            TextEncoding::AppendUtf8(m_nameScratch, name.data(), name.size(), pendingHighSurrogate);
+            if (pendingHighSurrogate != 0) {
+                m_nameScratch.append("\xEF\xBF\xBD");
+            }
+            return m_nameScratch;
+        } else {
+            m_nameScratch.clear();
+            TextEncoding::AppendWide(m_nameScratch, name.data(), name.size());
+            return m_nameScratch;
+        }
+    }
+
+    void AppendJsonEscaped(std::basic_string_view<CharT> str) {
+        using UnsignedChar = std::make_unsigned_t<CharT>;
+        for (;;) {
+            // Most names have nothing to escape and go to the sink in a single append.
+            const size_t cleanLength = TextEscaping::FindJsonEscape(str.data(), str.size());
+            m_sink.Append(str.data(), cleanLength);
+            if (cleanLength == str.size()) {
+                return;
+            }
+
+            const CharT c = str[cleanLength];
+            str.remove_prefix(cleanLength + 1);
+            switch (c) {
+                case '"': m_sink.Append(TREE_LITERAL("\\\"")); break;
+                case '\\': m_sink.Append(TREE_LITERAL("\\\\")); break;
+                case '/': m_sink.Append(TREE_LITERAL("\\/")); break;
+                case '\b': m_sink.Append(TREE_LITERAL("\\b")); break;
+                case '\f': m_sink.Append(TREE_LITERAL("\\f")); break;
+                case '\n': m_sink.Append(TREE_LITERAL("\\n")); break;
+                case '\r': m_sink.Append(TREE_LITERAL("\\r")); break;
+                case '\t': m_sink.Append(TREE_LITERAL("\\t")); break;
+                default: {
+                    static constexpr char kHexDigits[] = "0123456789ABCDEF";
+                    const UnsignedChar value = static_cast<UnsignedChar>(c);
+                    const CharT unicodeEscape[6] = {
+                        '\\', 'u', '0', '0',
+                        static_cast<CharT>(kHexDigits[(value >> 4) & 0xF]),
+                        static_cast<CharT>(kHexDigits[value & 0xF])
+                    };
+                    m_sink.Append(unicodeEscape, 6);
+                    break;
+                }
+            }
+        }
+    }
+
+    void AppendXmlEscaped(std::basic_string_view<CharT> str) {
+        for (;;) {
+            const size_t cleanLength = TextEscaping::FindXmlEscape(str.data(), str.size());
+            m_sink.Append(str.data(), cleanLength);
+            if (cleanLength == str.size()) {
+                return;
+            }
+
+            const CharT c = str[cleanLength];
+            str.remove_prefix(cleanLength + 1);
+            switch (c) {
+                case '&': m_sink.Append(TREE_LITERAL("&amp;")); break;
+                case '<': m_sink.Append(TREE_LITERAL("&lt;")); break;
+                case '>': m_sink.Append(TREE_LITERAL("&gt;")); break;
+                case '"': m_sink.Append(TREE_LITERAL("&quot;")); break;
+                case '\'': m_sink.Append(TREE_LITERAL("&apos;")); break;
+                default: m_sink.Append(c); break;
+            }
+        }
+    }
+
+    BasicTreeOutputSink<CharT>& m_sink;
+
+private:
+    std::basic_string<CharT> m_nameScratch;
+};
+
+template <typename CharT>
+class TextTreeRenderer : public SinkTreeRenderer<CharT> {
+public:
+    using SinkTreeRenderer<CharT>::SinkTreeRenderer;
+
+    bool ListsTextOnlyChildren() const override { return true; }
+
+protected:
+    using Frame = TreeRenderer::Frame;
+    using Glyphs = TreeGlyphs<CharT>;
+
+    void OnBeginNode(NameView name, const Frame& frame, size_t depth) override {
+        auto& sink = this->m_sink;
+        if (depth == 0) {
+            // The root line carries no connector and is always shown as a directory.
+            sink.Append(this->EncodeName(name));
+            sink.Append(TREE_LITERAL("/\r\n"));
+            ResetPrefix();
+            return;
+        }
+
+        TrimPrefix(depth);
+        sink.Append(m_prefix);
+        sink.Append(frame.isLast ? Glyphs::TREE_LAST : Glyphs::TREE_BRANCH);
+        sink.Append(ChangeMarker<CharT>(frame.change));
+        sink.Append(this->EncodeName(name));
+        if (frame.isDirectory) {
+            sink.Append(static_cast<CharT>('/'));
+        }
+        sink.Append(TREE_LITERAL("\r\n"));
+        ExtendPrefix(frame);
+    }
+
+    void OnEndNode(const Frame&, size_t) override {
+    }
+
+    void OnEnterAncestor(const Frame& frame, size_t depth) override {
+        if (depth == 0) {
+            ResetPrefix();
+            return;
+        }
+        TrimPrefix(depth);
+        ExtendPrefix(frame);
+    }
+
+private:
+    void ResetPrefix() {
+        m_levelPrefixLengths.assign(1, 0);
+        m_prefix.clear();
+    }
+
+    // Segments differ in length once UTF-8 encoded, so the prefix length of every open
+    // level is remembered instead of being derived from the depth.
+    void TrimPrefix(size_t depth) {
+        m_prefix.resize(m_levelPrefixLengths[depth - 1]);
+        m_levelPrefixLengths.resize(depth);
+    }
+
+    void ExtendPrefix(const Frame& frame) {
+        if (frame.hasChildren) {
+            m_prefix.append(frame.isLast ? Glyphs::TREE_SPACE : Glyphs::TREE_VERTICAL);
+            m_levelPrefixLengths.push_back(m_prefix.size());
+        }
+    }
+
+    std::basic_string<CharT> m_prefix;
+    std::vector<size_t> m_levelPrefixLengths;
+};
+
+template <typename CharT>
+class JsonTreeRenderer : public SinkTreeRenderer<CharT> {
+public:
+    using SinkTreeRenderer<CharT>::SinkTreeRenderer;
+
+protected:
+    using Frame = TreeRenderer::Frame;
+
+    void OnBeginNode(NameView name, const Frame& frame, size_t depth) override {
+        auto& sink = this->m_sink;
+        const size_t indent = depth * 4;
+
+        sink.AppendFill(' ', indent);
+        sink.Append(TREE_LITERAL("{\r\n"));
+        sink.AppendFill(' ', indent);
+        sink.Append(TREE_LITERAL("  \"name\": \""));
+        this->AppendJsonEscaped(this->EncodeName(name));
+        sink.Append(TREE_LITERAL("\",\r\n"));
+        sink.AppendFill(' ', indent);
+        sink.Append(TREE_LITERAL("  \"type\": \""));
+        sink.Append(frame.isDirectory ? TREE_LITERAL("directory") : TREE_LITERAL("file"));
+        sink.Append(static_cast<CharT>('"'));
+        if (frame.change != TreeChange::None) {
+            sink.Append(TREE_LITERAL(",\r\n"));
+            sink.AppendFill(' ', indent);
+            sink.Append(TREE_LITERAL("  \"change\": \""));
+            sink.Append(ChangeName<CharT>(frame.change));
+            sink.Append(static_cast<CharT>('"'));
+        }
+
+        if (frame.hasChildren) {
+            sink.Append(TREE_LITERAL(",\r\n"));
+            sink.AppendFill(' ', indent);
+            sink.Append(TREE_LITERAL("  \"children\": [\r\n"));
+        } else {
+            sink.Append(TREE_LITERAL("\r\n"));
+        }
+    }
+
+    void OnEndNode(const Frame& frame, size_t depth) override {
+        auto& sink = this->m_sink;
+        const size_t indent = depth * 4;
+
+        if (frame.hasChildren) {
+            sink.AppendFill(' ', indent);
+            sink.Append(TREE_LITERAL("  ]\r\n"));
+        }
+        sink.AppendFill(' ', indent);
+        sink.Append(static_cast<CharT>('}'));
+
+        if (depth > 0) {
+            if (!frame.isLast) {
+                sink.Append(static_cast<CharT>(','));
+            }
+            sink.Append(TREE_LITERAL("\r\n"));
+        }
+    }
+};
+
+template <typename CharT>
+class XmlTreeRenderer : public SinkTreeRenderer<CharT> {
+public:
+    using SinkTreeRenderer<CharT>::SinkTreeRenderer;
+
+protected:
+    using Frame = TreeRenderer::Frame;
+
+    void OnBeginNode(NameView name, const Frame& frame, size_t depth) override {
+        auto& sink = this->m_sink;
+        if (depth == 0) {
+            sink.Append(TREE_LITERAL("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\r\n"));
+        }
+
+        sink.AppendFill(' ', depth * 2);
+        sink.Append(static_cast<CharT>('<'));
+        sink.Append(ElementName(frame));
+        sink.Append(TREE_LITERAL(" name=\""));
+        this->AppendXmlEscaped(this->EncodeName(name));
+        sink.Append(static_cast<CharT>('"'));
+        if (frame.change != TreeChange::None) {
+            sink.Append(TREE_LITERAL(" change=\""));
+            sink.Append(ChangeName<CharT>(frame.change));
+            sink.Append(static_cast<CharT>('"'));
+        }
+
+        if (frame.hasChildren) {
+            sink.Append(TREE_LITERAL(">\r\n"));
+        } else {
+            sink.Append(TREE_LITERAL("/>"));
+        }
+    }
+
+    void OnEndNode(const Frame& frame, size_t depth) override {
+        auto& sink = this->m_sink;
+        if (frame.hasChildren) {
+            sink.AppendFill(' ', depth * 2);
+            sink.Append(TREE_LITERAL("</"));
+            sink.Append(ElementName(frame));
+            sink.Append(static_cast<CharT>('>'));
+        }
+
+        if (depth > 0) {
+            sink.Append(TREE_LITERAL("\r\n"));
+        }
+    }
+
+private:
+    static std::basic_string_view<CharT> ElementName(const Frame& frame) {
+        return frame.isDirectory ? TREE_LITERAL("directory") : TREE_LITERAL("file");
+    }
+};
+
+#undef TREE_LITERAL
+
+template <typename CharT>
+std::unique_ptr<TreeRenderer> CreateRenderer(TreeFormat format, BasicTreeOutputSink<CharT>& sink) {
+    switch (format) {
+    case TreeFormat::JSON:
+        return std::make_unique<JsonTreeRenderer<CharT>>(sink);
+    case TreeFormat::XML:
+        return std::make_unique<XmlTreeRenderer<CharT>>(sink);
+    case TreeFormat::TEXT:
+    default:
+        return std::make_unique<TextTreeRenderer<CharT>>(sink);
+    }
+}
+
+bool IsDirectoryNode(const TreeNode& node) {
+    return node.isDirectory;
+}
+
+bool IsDirectoryNode(const SnapshotNode& node) {
+    return node.IsDirectory();
+}
+
+bool HasTextOnlyChildren(const TreeNode& node) {
+    return node.textOnlyChildren;
+}
+
+bool HasTextOnlyChildren(const SnapshotNode& node) {
+    return node.HasTextOnlyChildren();
+}
+
+template <typename Tree>
+TreeChange NodeChange(const Tree&, uint32_t) {
+    return TreeChange::None;
+}
+
+TreeChange NodeChange(const TreeDiff& diff, uint32_t node) {
+    return diff.Change(node);
+}
+
+// Works on any node table with TreeModel's Root()/Node()/Name() shape. Renders the subtree
+// of top, the whole tree by default. Returns false if the renderer was asked to stop.
+template <typename Tree>
+bool ReplayTree(TreeRenderer& renderer, const Tree& model, uint32_t top = Tree::kNoNode) {
+    uint32_t node = top == Tree::kNoNode ? model.Root() : top;
+    if (node == Tree::kNoNode) {
+        return true;
+    }
+    top = node;
+    const bool listsTextOnlyChildren = renderer.ListsTextOnlyChildren();
+
+    // Pre-order walk over the first-child/next-sibling links; parent links replace a stack.
+    for (;;) {
+        if (renderer.StopRequested()) {
+            return false;
+        }
+        const auto& current = model.Node(node);
+        const bool hasChildren = current.firstChild != Tree::kNoNode &&
+                                 (listsTextOnlyChildren || !HasTextOnlyChildren(current));
+        renderer.BeginNode(model.Name(node), IsDirectoryNode(current), hasChildren,
+                           current.nextSibling == Tree::kNoNode,
+                           NodeChange(model, node));
+        if (hasChildren) {
+            node = current.firstChild;
+            continue;
+        }
+
+        renderer.EndNode();
+        while (node != top && model.Node(node).nextSibling == Tree::kNoNode) {
+            node = model.Node(node).parent;
+            renderer.EndNode();
+        }
+        if (node == top) {
+            return true;
+        }
+        node = model.Node(node).nextSibling;
+    }
+}
+}
+
+TreeRenderer::TreeRenderer()
+    : m_stop(nullptr) {
+}
+
+TreeRenderer::~TreeRenderer() {
+}
+
+std::unique_ptr<TreeRenderer> TreeRenderer::Create(TreeFormat format, TreeOutputSink& sink) {
+    return CreateRenderer(format, sink);
+}
+
+std::unique_ptr<TreeRenderer> TreeRenderer::Create(TreeFormat format, Utf8OutputSink& sink) {
+    return CreateRenderer(format, sink);
+}
+
+void TreeRenderer::BeginNode(NameView name, bool isDirectory, bool hasChildren, bool isLast,
+                             TreeChange change) {
+    m_frames.push_back(Frame{isDirectory, hasChildren, isLast, change});
+    OnBeginNode(name, m_frames.back(), m_frames.size() - 1);
+}
+
+void TreeRenderer::EndNode() {
+    const Frame frame = m_frames.back();
+    m_frames.pop_back();
+    OnEndNode(frame, m_frames.size());
+}
+
+bool TreeRenderer::RenderModel(const TreeModel& model) {
+    return ReplayTree(*this, model);
+}
+
+bool TreeRenderer::RenderModel(const TreeSnapshot& snapshot) {
+    return ReplayTree(*this, snapshot);
+}
+
+bool TreeRenderer::RenderModel(const TreeDiff& diff) {
+    return ReplayTree(*this, diff);
+}
+
+bool TreeRenderer::StopRequested() const {
+    return m_stop && m_stop->StopRequested();
+}
+
+bool TreeRenderer::RenderSubtree(const TreeModel& model, uint32_t node) {
+    // Ancestors are entered root first; each of them has children and closes its parent's
+    // list exactly when it has no next sibling.
+    std::vector<uint32_t> ancestors;
+    for (uint32_t ancestor = model.Node(node).parent; ancestor != TreeModel::kNoNode; ancestor = model.Node(ancestor).parent) {
+        ancestors.push_back(ancestor);
+    }
+
+    const size_t baseDepth = m_frames.size();
+    for (auto it = ancestors.rbegin(); it != ancestors.rend(); ++it) {
+        const TreeNode& ancestor = model.Node(*it);
+        m_frames.push_back(Frame{ancestor.isDirectory, true, ancestor.nextSibling == TreeModel::kNoNode, TreeChange::None});
+        OnEnterAncestor(m_frames.back(), m_frames.size() - 1);
+    }
+
+    const bool completed = ReplayTree(*this, model, node);
+    m_frames.resize(baseDepth);
+    return completed;
+}
+
+void TreeRenderer::OnEnterAncestor(const Frame&, size_t) {
+}
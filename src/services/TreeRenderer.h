@@ -0,0 +1,88 @@
+#pragma once
+
+#include "TreeName.h"
+#include "TreeOutputSink.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+class StopToken;
+class TreeDiff;
+class TreeModel;
+class TreeSnapshot;
+
+enum class TreeFormat {
+    TEXT,
+    JSON,
+    XML
+};
+
+// Marks a node of a rendered diff; plain trees use None throughout.
+enum class TreeChange : unsigned char {
+    None,
+    Added,
+    Removed,
+    TypeChanged
+};
+
+// Event-driven renderer: nodes arrive in display order (pre-order, children sorted) and the
+// formatted text is appended to a sink as they come, keeping only per-depth state.
+class TreeRenderer {
+public:
+    TreeRenderer();
+    virtual ~TreeRenderer();
+
+    static std::unique_ptr<TreeRenderer> Create(TreeFormat format, TreeOutputSink& sink);
+    // Emits UTF-8 directly: separators are pre-encoded and names pass through as they are where
+    // they are UTF-8 already, or are encoded once.
+    static std::unique_ptr<TreeRenderer> Create(TreeFormat format, Utf8OutputSink& sink);
+
+    // The first node is the root. hasChildren must be known up front, isLast tells whether
+    // the node closes its parent's child list.
+    void BeginNode(NameView name, bool isDirectory, bool hasChildren, bool isLast,
+                   TreeChange change = TreeChange::None);
+    void EndNode();
+
+    // The model replays below stop as soon as stop is requested, leaving the output truncated;
+    // nullptr, the default, renders to the end. The token must outlive the renders.
+    void SetStopToken(const StopToken* stop) { m_stop = stop; }
+
+    // Replays a whole model through BeginNode/EndNode without recursion. Returns false if the
+    // stop token cut it short.
+    bool RenderModel(const TreeModel& model);
+    bool RenderModel(const TreeSnapshot& snapshot);
+    bool RenderModel(const TreeDiff& diff);
+
+    // Renders only the subtree of node, laid out as it appears in the whole model: the text
+    // view indents it under its ancestors' connectors. Used to regenerate part of a view.
+    bool RenderSubtree(const TreeModel& model, uint32_t node);
+
+    bool StopRequested() const;
+
+    // Whether the model replays keep the children of nodes marked with textOnlyChildren. Only
+    // the text view does; JSON and XML follow their own root rules and close such nodes.
+    virtual bool ListsTextOnlyChildren() const { return false; }
+
+    // Flushes the underlying sink; false if any write failed.
+    virtual bool Flush() = 0;
+
+protected:
+    struct Frame {
+        bool isDirectory;
+        bool hasChildren;
+        bool isLast;
+        TreeChange change;
+    };
+
+    virtual void OnBeginNode(NameView name, const Frame& frame, size_t depth) = 0;
+    virtual void OnEndNode(const Frame& frame, size_t depth) = 0;
+    // An ancestor of a partial render: update the per-depth state as OnBeginNode would, emit nothing.
+    virtual void OnEnterAncestor(const Frame& frame, size_t depth);
+
+private:
+    std::vector<Frame> m_frames;
+    const StopToken* m_stop;
+};
@@ -0,0 +1,357 @@
+#include "TreeSnapshot.h"
+
+#include "DirectoryReader.h"
+#include "TextEncoding.h"
+#include "TreeOutputSink.h"
+
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+constexpr char kMagic[8] = {'D', 'T', 'S', 'N', 'A', 'P', '\r', '\n'};
+// Version 2 keeps the pool in the native name encoding; version 1 held wchar_t everywhere.
+constexpr uint32_t kVersion = 2;
+// Read back in the native byte order; a foreign-endian file does not match.
+constexpr uint32_t kByteOrderMark = 0x01020304u;
+constexpr uint32_t kExpandSymlinksFlag = 1u << 0;
+
+// Layout: header, node table, padding up to the pool alignment, string pool. The root path is
+// the first string in the pool, node names follow in node order.
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t charSize;
+    int32_t maxDepth;
+    uint32_t format;
+    uint32_t flags;
+    int64_t createdTime;
+    uint64_t nodeCount;
+    uint64_t nodeOffset;
+    uint64_t poolOffset;
+    uint64_t poolChars;
+    uint32_t rootPathOffset;
+    uint32_t rootPathLength;
+};
+
+static_assert(sizeof(SnapshotHeader) == 80, "the snapshot header layout is part of the file format");
+static_assert(sizeof(SnapshotNode) == 24, "the snapshot node layout is part of the file format");
+static_assert(std::is_trivially_copyable<SnapshotHeader>::value && std::is_trivially_copyable<SnapshotNode>::value,
+              "snapshot records are written and mapped as raw bytes");
+
+constexpr uint64_t kPoolAlignment = 8;
+
+uint64_t AlignUp(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+template <typename T>
+void AppendRaw(Utf8OutputSink& file, const T* data, size_t count) {
+    file.Append(reinterpret_cast<const char*>(data), count * sizeof(T));
+}
+
+std::wstring CorruptMessage(const std::wstring& fileName) {
+    return L"Снимок повреждён: " + fileName;
+}
+
+// The nodes of model in pre-order. A parallel scan appends them in the order its tasks happen
+// to run, the walk gives one order per tree, so equal trees are saved as equal files.
+std::vector<uint32_t> PreOrder(const TreeModel& model) {
+    std::vector<uint32_t> order;
+    if (model.Empty()) {
+        return order;
+    }
+    order.reserve(model.Size());
+
+    uint32_t node = model.Root();
+    for (;;) {
+        order.push_back(node);
+        if (model.Node(node).firstChild != TreeModel::kNoNode) {
+            node = model.Node(node).firstChild;
+            continue;
+        }
+        while (node != model.Root() && model.Node(node).nextSibling == TreeModel::kNoNode) {
+            node = model.Node(node).parent;
+        }
+        if (node == model.Root()) {
+            return order;
+        }
+        node = model.Node(node).nextSibling;
+    }
+}
+}
+
+TreeSnapshot::TreeSnapshot()
+    : m_data(nullptr)
+    , m_size(0)
+    , m_mapping(nullptr)
+    , m_nodes(nullptr)
+    , m_pool(nullptr)
+    , m_nodeCount(0) {
+}
+
+TreeSnapshot::~TreeSnapshot() {
+    Close();
+}
+
+bool TreeSnapshot::Save(const std::wstring& fileName, const TreeModel& model, const TreeSnapshotInfo& info,
+                        std::wstring& errorMessage) {
+    // Names are addressed with 32-bit offsets, so the pool size is checked before anything is written.
+    const NameString rootPath = ToName(info.rootPath);
+    const std::vector<uint32_t> order = PreOrder(model);
+    uint64_t poolChars = rootPath.size();
+    for (uint32_t node : order) {
+        poolChars += model.Name(node).size();
+    }
+    if (poolChars > std::numeric_limits<uint32_t>::max()) {
+        errorMessage = L"Дерево слишком велико для снимка";
+        return false;
+    }
+
+    SnapshotHeader header{};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.byteOrder = kByteOrderMark;
+    header.charSize = sizeof(NameChar);
+    header.maxDepth = info.maxDepth;
+    header.format = static_cast<uint32_t>(info.format);
+    header.flags = info.expandSymlinks ? kExpandSymlinksFlag : 0;
+    header.createdTime = info.createdTime;
+    header.nodeCount = order.size();
+    header.nodeOffset = sizeof(SnapshotHeader);
+    header.poolOffset = AlignUp(header.nodeOffset + header.nodeCount * sizeof(SnapshotNode), kPoolAlignment);
+    header.poolChars = poolChars;
+    header.rootPathOffset = 0;
+    header.rootPathLength = static_cast<uint32_t>(rootPath.size());
+
+    Utf8FileOutputSink file(fileName);
+    if (!file.IsOpen()) {
+        errorMessage = L"Ошибка создания файла: " + fileName;
+        return false;
+    }
+
+    AppendRaw(file, &header, 1);
+
+    std::vector<uint32_t> indices(model.Size(), kNoNode);
+    for (uint32_t i = 0; i < order.size(); ++i) {
+        indices[order[i]] = i;
+    }
+    const auto index = [&indices](uint32_t node) { return node == TreeModel::kNoNode ? kNoNode : indices[node]; };
+
+    uint32_t nameOffset = header.rootPathLength;
+    for (uint32_t modelNode : order) {
+        const TreeNode& node = model.Node(modelNode);
+        const SnapshotNode record{index(node.parent), index(node.firstChild), index(node.nextSibling), nameOffset,
+                                  static_cast<uint32_t>(model.Name(modelNode).size()),
+                                  (node.isDirectory ? SnapshotNode::kDirectory : 0u) |
+                                      (node.isSymlink ? SnapshotNode::kSymlink : 0u) |
+                                      (node.textOnlyChildren ? SnapshotNode::kTextOnlyChildren : 0u)};
+        AppendRaw(file, &record, 1);
+        nameOffset += record.nameLength;
+    }
+
+    const size_t padding = static_cast<size_t>(header.poolOffset - header.nodeOffset - header.nodeCount * sizeof(SnapshotNode));
+    file.AppendFill('\0', padding);
+
+    AppendRaw(file, rootPath.data(), rootPath.size());
+    for (uint32_t node : order) {
+        const NameView name = model.Name(node);
+        AppendRaw(file, name.data(), name.size());
+    }
+
+    if (!file.Close()) {
+        std::error_code ec;
+        std::filesystem::remove(ToNativePath(fileName), ec);
+        errorMessage = L"Ошибка записи снимка: " + fileName;
+        return false;
+    }
+    return true;
+}
+
+bool TreeSnapshot::Open(const std::wstring& fileName, std::wstring& errorMessage) {
+    Close();
+
+#ifdef _WIN32
+    HANDLE hFile = CreateFile(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        errorMessage = L"Не удалось открыть снимок: " + fileName;
+        return false;
+    }
+
+    LARGE_INTEGER fileSize{};
+    HANDLE hMapping = nullptr;
+    if (GetFileSizeEx(hFile, &fileSize) && fileSize.QuadPart >= static_cast<LONGLONG>(sizeof(SnapshotHeader))) {
+        hMapping = CreateFileMapping(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    }
+    CloseHandle(hFile);
+
+    const void* view = hMapping ? MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view) {
+        if (hMapping) {
+            CloseHandle(hMapping);
+        }
+        errorMessage = L"Не удалось открыть снимок: " + fileName;
+        return false;
+    }
+    m_mapping = hMapping;
+    m_size = static_cast<size_t>(fileSize.QuadPart);
+#else
+    const int fd = open(TextEncoding::ToPathBytes(fileName).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        errorMessage = L"Не удалось открыть снимок: " + fileName;
+        return false;
+    }
+
+    struct stat status {};
+    void* view = MAP_FAILED;
+    if (fstat(fd, &status) == 0 && status.st_size >= static_cast<off_t>(sizeof(SnapshotHeader))) {
+        view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+
+    if (view == MAP_FAILED) {
+        errorMessage = L"Не удалось открыть снимок: " + fileName;
+        return false;
+    }
+    m_size = static_cast<size_t>(status.st_size);
+#endif
+    m_data = static_cast<const unsigned char*>(view);
+
+    SnapshotHeader header;
+    std::memcpy(&header, m_data, sizeof(header));
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+        Close();
+        errorMessage = L"Файл не является снимком дерева: " + fileName;
+        return false;
+    }
+    if (header.version != kVersion || header.byteOrder != kByteOrderMark || header.charSize != sizeof(NameChar)) {
+        Close();
+        errorMessage = L"Снимок создан другой версией программы или на другой платформе: " + fileName;
+        return false;
+    }
+
+    const uint64_t size = m_size;
+    const bool layoutValid =
+        header.format <= static_cast<uint32_t>(TreeFormat::XML) &&
+        header.nodeOffset >= sizeof(SnapshotHeader) && header.nodeOffset % alignof(SnapshotNode) == 0 &&
+        header.nodeOffset <= size && header.nodeCount < kNoNode &&
+        header.nodeCount <= (size - header.nodeOffset) / sizeof(SnapshotNode) &&
+        header.poolOffset % alignof(NameChar) == 0 &&
+        header.poolOffset >= header.nodeOffset + header.nodeCount * sizeof(SnapshotNode) &&
+        header.poolOffset <= size && header.poolChars <= (size - header.poolOffset) / sizeof(NameChar) &&
+        header.rootPathOffset <= header.poolChars && header.rootPathLength <= header.poolChars - header.rootPathOffset;
+    if (!layoutValid) {
+        Close();
+        errorMessage = CorruptMessage(fileName);
+        return false;
+    }
+
+    m_nodes = reinterpret_cast<const SnapshotNode*>(m_data + header.nodeOffset);
+    m_pool = reinterpret_cast<const NameChar*>(m_data + header.poolOffset);
+    m_nodeCount = static_cast<size_t>(header.nodeCount);
+    if (!Validate(static_cast<size_t>(header.poolChars))) {
+        Close();
+        errorMessage = CorruptMessage(fileName);
+        return false;
+    }
+
+    m_info.rootPath = FromName(NameView(m_pool + header.rootPathOffset, header.rootPathLength));
+    m_info.maxDepth = header.maxDepth;
+    m_info.format = static_cast<TreeFormat>(header.format);
+    m_info.expandSymlinks = (header.flags & kExpandSymlinksFlag) != 0;
+    m_info.createdTime = header.createdTime;
+    return true;
+}
+
+void TreeSnapshot::Close() {
+    if (m_data) {
+#ifdef _WIN32
+        UnmapViewOfFile(m_data);
+        CloseHandle(static_cast<HANDLE>(m_mapping));
+#else
+        munmap(const_cast<unsigned char*>(m_data), m_size);
+#endif
+    }
+    m_data = nullptr;
+    m_size = 0;
+    m_mapping = nullptr;
+    m_nodes = nullptr;
+    m_pool = nullptr;
+    m_nodeCount = 0;
+    m_info = TreeSnapshotInfo{};
+}
+
+bool TreeSnapshot::Validate(size_t poolChars) const {
+    if (m_nodeCount == 0) {
+        return true;
+    }
+    if (m_nodes[0].parent != kNoNode || m_nodes[0].nextSibling != kNoNode) {
+        return false;
+    }
+
+    // Children follow their parent and siblings follow each other, as TreeModel appends them.
+    // Together with the parent check this makes every node but the root sit in exactly one
+    // child chain, so walks over the mapped table always terminate.
+    size_t chained = 0;
+    for (size_t i = 0; i < m_nodeCount; ++i) {
+        const SnapshotNode& node = m_nodes[i];
+        if (node.nameOffset > poolChars || node.nameLength > poolChars - node.nameOffset) {
+            return false;
+        }
+        if (i > 0 && node.parent >= i) {
+            return false;
+        }
+
+        size_t previous = i;
+        for (uint32_t child = node.firstChild; child != kNoNode; child = m_nodes[child].nextSibling) {
+            if (child <= previous || child >= m_nodeCount || m_nodes[child].parent != i) {
+                return false;
+            }
+            previous = child;
+            ++chained;
+        }
+    }
+    return chained == m_nodeCount - 1;
+}
+
+void TreeSnapshot::CopyTo(TreeModel& model) const {
+    model.Clear();
+    if (m_nodeCount == 0) {
+        return;
+    }
+
+    // Nodes are appended in table order, so every index is preserved; only the previous sibling
+    // of each node has to be looked up.
+    std::vector<uint32_t> previousSibling(m_nodeCount, kNoNode);
+    for (size_t i = 0; i < m_nodeCount; ++i) {
+        if (m_nodes[i].nextSibling != kNoNode) {
+            previousSibling[m_nodes[i].nextSibling] = static_cast<uint32_t>(i);
+        }
+    }
+
+    model.Reserve(m_nodeCount);
+    model.AddRoot(Name(0), m_nodes[0].IsDirectory());
+    for (uint32_t i = 1; i < m_nodeCount; ++i) {
+        const SnapshotNode& node = m_nodes[i];
+        model.AddChild(node.parent, previousSibling[i], Name(i), node.IsDirectory(), node.IsSymlink());
+    }
+    for (uint32_t i = 0; i < m_nodeCount; ++i) {
+        if (m_nodes[i].HasTextOnlyChildren()) {
+            model.SetTextOnlyChildren(i);
+        }
+    }
+}
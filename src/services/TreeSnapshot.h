@@ -0,0 +1,88 @@
+#pragma once
+
+#include "TreeModel.h"
+#include "TreeRenderer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// How the snapshotted tree was built; the format names the root rules the model follows.
+struct TreeSnapshotInfo {
+    std::wstring rootPath;
+    int maxDepth = -1;
+    TreeFormat format = TreeFormat::TEXT;
+    bool expandSymlinks = false;
+    // Seconds since the Unix epoch; 0 when unknown.
+    int64_t createdTime = 0;
+};
+
+// One record of the snapshot node table. Links have the TreeModel meaning, the name is a
+// range of code units in the string pool.
+struct SnapshotNode {
+    uint32_t parent;
+    uint32_t firstChild;
+    uint32_t nextSibling;
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t flags;
+
+    static constexpr uint32_t kDirectory = 1u << 0;
+    static constexpr uint32_t kSymlink = 1u << 1;
+    static constexpr uint32_t kTextOnlyChildren = 1u << 2;
+
+    bool IsDirectory() const { return (flags & kDirectory) != 0; }
+    bool IsSymlink() const { return (flags & kSymlink) != 0; }
+    bool HasTextOnlyChildren() const { return (flags & kTextOnlyChildren) != 0; }
+};
+
+// Read-only view of a tree snapshot file. The file is a fixed header followed by the flat node
+// table and the string pool of names in their native encoding, so it is mapped into memory as
+// is and the nodes are read in place: opening costs one validation pass, not a rebuild of the
+// tree.
+class TreeSnapshot {
+public:
+    static constexpr uint32_t kNoNode = TreeModel::kNoNode;
+
+    TreeSnapshot();
+    ~TreeSnapshot();
+
+    TreeSnapshot(const TreeSnapshot&) = delete;
+    TreeSnapshot& operator=(const TreeSnapshot&) = delete;
+
+    // Writes model to fileName with the nodes in pre-order, whatever order the model holds them
+    // in; a partially written file is removed on failure.
+    static bool Save(const std::wstring& fileName, const TreeModel& model, const TreeSnapshotInfo& info,
+                     std::wstring& errorMessage);
+
+    // Maps fileName and checks its structure. The previous mapping, if any, is released.
+    bool Open(const std::wstring& fileName, std::wstring& errorMessage);
+    void Close();
+    bool IsOpen() const { return m_data != nullptr; }
+
+    const TreeSnapshotInfo& Info() const { return m_info; }
+
+    const SnapshotNode& Node(uint32_t index) const { return m_nodes[index]; }
+    NameView Name(uint32_t index) const {
+        return NameView(m_pool + m_nodes[index].nameOffset, m_nodes[index].nameLength);
+    }
+
+    uint32_t Root() const { return m_nodeCount == 0 ? kNoNode : 0; }
+    size_t Size() const { return m_nodeCount; }
+    bool Empty() const { return m_nodeCount == 0; }
+
+    // Copies the snapshot into model, e.g. to keep it after Close().
+    void CopyTo(TreeModel& model) const;
+
+private:
+    bool Validate(size_t poolChars) const;
+
+    const unsigned char* m_data;
+    size_t m_size;
+    void* m_mapping;
+    const SnapshotNode* m_nodes;
+    const NameChar* m_pool;
+    size_t m_nodeCount;
+    TreeSnapshotInfo m_info;
+};
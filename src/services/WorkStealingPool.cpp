@@ -0,0 +1,129 @@
+#include "WorkStealingPool.h"
+
+#include <algorithm>
+
+namespace {
+thread_local const WorkStealingPool* t_currentPool = nullptr;
+thread_local size_t t_currentWorker = 0;
+}
+
+WorkStealingPool::WorkStealingPool(size_t threadCount)
+    : m_queuedTasks(0)
+    , m_pendingTasks(0)
+    , m_nextQueue(0)
+    , m_stopping(false) {
+    if (threadCount == 0) {
+        threadCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+
+    m_queues.reserve(threadCount);
+    for (size_t i = 0; i < threadCount; ++i) {
+        m_queues.push_back(std::make_unique<WorkerQueue>());
+    }
+
+    m_threads.reserve(threadCount);
+    for (size_t i = 0; i < threadCount; ++i) {
+        m_threads.emplace_back([this, i]() { WorkerLoop(i); });
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_stateMutex);
+        m_stopping = true;
+    }
+    m_workAvailable.notify_all();
+
+    for (auto& thread : m_threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+}
+
+void WorkStealingPool::Submit(Task task) {
+    size_t target = 0;
+    if (t_currentPool == this) {
+        target = t_currentWorker;
+    } else {
+        target = m_nextQueue.fetch_add(1, std::memory_order_relaxed) % m_queues.size();
+    }
+
+    m_pendingTasks.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> lock(m_stateMutex);
+        m_queuedTasks.fetch_add(1);
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_queues[target]->mutex);
+        m_queues[target]->tasks.push_back(std::move(task));
+    }
+    m_workAvailable.notify_one();
+}
+
+bool WorkStealingPool::WaitIdle(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(m_stateMutex);
+    return m_idle.wait_for(lock, timeout, [this]() { return m_pendingTasks.load() == 0; });
+}
+
+void WorkStealingPool::WorkerLoop(size_t index) {
+    t_currentPool = this;
+    t_currentWorker = index;
+
+    for (;;) {
+        Task task;
+        if (TryPopLocal(index, task) || TrySteal(index, task)) {
+            m_queuedTasks.fetch_sub(1);
+            try {
+                task();
+            }
+            catch (...) {
+                // Tasks own their error reporting; a throwing task must not take the worker down.
+            }
+            FinishTask();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_stateMutex);
+        m_workAvailable.wait(lock, [this]() { return m_stopping || m_queuedTasks.load() > 0; });
+        if (m_stopping) {
+            return;
+        }
+    }
+}
+
+bool WorkStealingPool::TryPopLocal(size_t index, Task& task) {
+    WorkerQueue& queue = *m_queues[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+}
+
+bool WorkStealingPool::TrySteal(size_t thiefIndex, Task& task) {
+    const size_t queueCount = m_queues.size();
+    for (size_t offset = 1; offset < queueCount; ++offset) {
+        WorkerQueue& victim = *m_queues[(thiefIndex + offset) % queueCount];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.tasks.empty()) {
+            continue;
+        }
+
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        return true;
+    }
+
+    return false;
+}
+
+void WorkStealingPool::FinishTask() {
+    if (m_pendingTasks.fetch_sub(1) == 1) {
+        std::lock_guard<std::mutex> lock(m_stateMutex);
+        m_idle.notify_all();
+    }
+}
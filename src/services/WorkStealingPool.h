@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkStealingPool {
+public:
+    using Task = std::function<void()>;
+
+    // threadCount == 0 sizes the pool to std::thread::hardware_concurrency().
+    explicit WorkStealingPool(size_t threadCount = 0);
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Tasks submitted from a worker go to that worker's own queue (LIFO for the owner,
+    // FIFO for thieves); external submissions are distributed round-robin.
+    void Submit(Task task);
+
+    // Returns true once every submitted task has finished, false on timeout.
+    bool WaitIdle(std::chrono::milliseconds timeout);
+
+    size_t ThreadCount() const { return m_threads.size(); }
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void WorkerLoop(size_t index);
+    bool TryPopLocal(size_t index, Task& task);
+    bool TrySteal(size_t thiefIndex, Task& task);
+    void FinishTask();
+
+    std::vector<std::unique_ptr<WorkerQueue>> m_queues;
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_stateMutex;
+    std::condition_variable m_workAvailable;
+    std::condition_variable m_idle;
+    std::atomic<std::ptrdiff_t> m_queuedTasks;
+    std::atomic<size_t> m_pendingTasks;
+    std::atomic<size_t> m_nextQueue;
+    bool m_stopping;
+};
@@ -0,0 +1,178 @@
+#include "TestSupport.h"
+#include "RenderedTreeText.h"
+#include "TreeOutputSink.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+// Lines as RenderedTreeText defines them: each ends after '\n', a trailing unterminated
+// line counts as well.
+std::vector<std::wstring> SplitLines(const std::wstring& text) {
+    std::vector<std::wstring> lines;
+    size_t start = 0;
+    while (start < text.size()) {
+        const size_t lineBreak = text.find(L'\n', start);
+        const size_t end = lineBreak == std::wstring::npos ? text.size() : lineBreak + 1;
+        lines.push_back(text.substr(start, end - start));
+        start = end;
+    }
+    return lines;
+}
+
+std::wstring WithoutLineBreak(std::wstring line) {
+    if (!line.empty() && line.back() == L'\n') {
+        line.pop_back();
+        if (!line.empty() && line.back() == L'\r') {
+            line.pop_back();
+        }
+    }
+    return line;
+}
+
+// Compares every query against the plain split of the text that was written.
+void CheckAgainst(const RenderedTreeText& rendered, const std::wstring& text) {
+    const std::vector<std::wstring> lines = SplitLines(text);
+    CHECK(rendered.LineCount() == lines.size());
+    CHECK(rendered.CharCount() == text.size());
+    CHECK(rendered.Text() == text);
+
+    for (size_t i = 0; i < lines.size(); ++i) {
+        CHECK(rendered.Line(i) == WithoutLineBreak(lines[i]));
+    }
+    CHECK(rendered.Line(lines.size()).empty());
+
+    for (size_t first = 0; first <= lines.size(); ++first) {
+        for (size_t count = 0; count <= lines.size() - first + 1; ++count) {
+            std::wstring expected;
+            const size_t present = first + count <= lines.size() ? count : lines.size() - first;
+            for (size_t i = first; i < first + present; ++i) {
+                expected += lines[i];
+            }
+            std::wstring copied = L"prefix";
+            CHECK(rendered.CopyLines(first, count, copied) == present);
+            CHECK(copied == L"prefix" + expected);
+        }
+    }
+
+    std::wstring written;
+    StringOutputSink sink(written);
+    rendered.WriteTo(sink);
+    sink.Flush();
+    CHECK(written == text);
+}
+
+// Writes text in pieces of the given sizes, flushing after each so that every piece reaches
+// the chunk store as a separate write.
+void WriteInPieces(RenderedTreeText& rendered, const std::wstring& text, const std::vector<size_t>& pieces) {
+    size_t offset = 0;
+    size_t piece = 0;
+    while (offset < text.size()) {
+        const size_t length = std::min(pieces[piece++ % pieces.size()], text.size() - offset);
+        rendered.Append(text.data() + offset, length);
+        rendered.Flush();
+        offset += length;
+    }
+}
+
+std::wstring SampleText(const wchar_t* lineBreak, bool terminated) {
+    const std::vector<std::wstring> lines = {L"root/", L"├── a/", L"│   └── a-long-name-that-exceeds-a-chunk.txt",
+                                             L"├── b", L"", L"└── c"};
+    std::wstring text;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        text += lines[i];
+        if (terminated || i + 1 < lines.size()) {
+            text += lineBreak;
+        }
+    }
+    return text;
+}
+
+// Chunk sizes below, at and above the line lengths, with writes from single characters up to
+// whole lines, so that lines end exactly at, just before and just past chunk boundaries.
+void TestChunkBoundaries() {
+    for (const wchar_t* lineBreak : {L"\n", L"\r\n"}) {
+        for (bool terminated : {true, false}) {
+            const std::wstring text = SampleText(lineBreak, terminated);
+            for (size_t chunkChars : {1, 2, 5, 7, 8, 16, 31, 64, 4096}) {
+                for (const std::vector<size_t>& pieces :
+                     {std::vector<size_t>{1}, std::vector<size_t>{3}, std::vector<size_t>{7, 1, 13},
+                      std::vector<size_t>{text.size()}}) {
+                    RenderedTreeText rendered(chunkChars);
+                    WriteInPieces(rendered, text, pieces);
+                    CheckAgainst(rendered, text);
+                }
+            }
+        }
+    }
+}
+
+void TestFinalLine() {
+    RenderedTreeText rendered(8);
+    rendered.Append(std::wstring_view(L"one\r\ntwo"));
+    rendered.Flush();
+    CHECK(rendered.LineCount() == 2);
+    CHECK(rendered.Line(1) == L"two");
+
+    // The open line is completed by the next write, not counted twice.
+    rendered.Append(std::wstring_view(L" more\r\n"));
+    rendered.Flush();
+    CHECK(rendered.LineCount() == 2);
+    CHECK(rendered.Line(1) == L"two more");
+    CHECK(rendered.Line(2).empty());
+
+    // A lone '\r' before the end is part of the line, only "\r\n" and "\n" end one.
+    rendered.Append(std::wstring_view(L"x\ry\n"));
+    rendered.Flush();
+    CHECK(rendered.LineCount() == 3);
+    CHECK(rendered.Line(2) == L"x\ry");
+    CheckAgainst(rendered, L"one\r\ntwo more\r\nx\ry\n");
+}
+
+void TestRandomWrites() {
+    std::mt19937 random(2024);
+    std::uniform_int_distribution<int> character(0, 9);
+    std::uniform_int_distribution<size_t> pieceLength(1, 40);
+    for (int round = 0; round < 60; ++round) {
+        std::wstring text;
+        const size_t length = 200 + static_cast<size_t>(round) * 7;
+        for (size_t i = 0; i < length; ++i) {
+            const int value = character(random);
+            text += value == 0 ? L'\n' : value == 1 ? L'\r' : static_cast<wchar_t>(L'a' + value);
+        }
+        std::vector<size_t> pieces(16);
+        for (size_t& piece : pieces) {
+            piece = pieceLength(random);
+        }
+
+        RenderedTreeText rendered(1 + static_cast<size_t>(round % 24));
+        WriteInPieces(rendered, text, pieces);
+        CheckAgainst(rendered, text);
+    }
+}
+
+void TestClear() {
+    RenderedTreeText rendered(4);
+    rendered.Append(std::wstring_view(L"a\nb\nunflushed"));
+    rendered.Clear();
+    CHECK(rendered.LineCount() == 0);
+    CHECK(rendered.CharCount() == 0);
+    CHECK(rendered.Text().empty());
+
+    rendered.Append(std::wstring_view(L"c\n"));
+    rendered.Flush();
+    CheckAgainst(rendered, L"c\n");
+}
+}
+
+int main() {
+    TestChunkBoundaries();
+    TestFinalLine();
+    TestRandomWrites();
+    TestClear();
+    return TestSupport::Result();
+}
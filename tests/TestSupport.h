@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdio>
+
+// Minimal checks for the unit test executables, independent of NDEBUG: a failed CHECK prints
+// its location and the test carries on, main() returns TestSupport::Result() for CTest.
+namespace TestSupport {
+inline int& FailureCount() {
+    static int count = 0;
+    return count;
+}
+
+inline void Fail(const char* file, int line, const char* expression) {
+    std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+    ++FailureCount();
+}
+
+inline int Result() {
+    if (FailureCount() > 0) {
+        std::fprintf(stderr, "%d check(s) failed\n", FailureCount());
+        return 1;
+    }
+    return 0;
+}
+} // namespace TestSupport
+
+#define CHECK(expression)                                                  \
+    do {                                                                   \
+        if (!(expression)) {                                               \
+            TestSupport::Fail(__FILE__, __LINE__, #expression);            \
+        }                                                                  \
+    } while (false)
@@ -0,0 +1,59 @@
+#include "TestSupport.h"
+#include "DirectoryReader.h"
+#include "TextEncoding.h"
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+void TestValidText() {
+    for (const std::wstring& text : {std::wstring(), std::wstring(L"plain"), std::wstring(L"каталог/имя"),
+                                     std::wstring(L"\U0001F600 �")}) {
+        CHECK(TextEncoding::ToPathBytes(text) == TextEncoding::ToUtf8(text));
+        CHECK(TextEncoding::FromPathBytes(TextEncoding::ToUtf8(text)) == text);
+    }
+}
+
+// Bytes that are not UTF-8 survive the wide form in both directions, next to valid sequences.
+void TestInvalidBytes() {
+    const std::vector<std::string> samples = {
+        "\xff", "a\x80z", "\xd0", "\xd0\xb8\xd0", "\xc0\xaf", "\xed\xa0\x80", "\xf4\x90\x80\x80",
+        "dir\xe9t\xe9/\xef\xbf\xbd", std::string("\xc3\xa9\xc3", 3),
+    };
+    for (const std::string& bytes : samples) {
+        const std::wstring wide = TextEncoding::FromPathBytes(bytes);
+        CHECK(TextEncoding::ToPathBytes(wide) == bytes);
+        // Shown to the user, the same bytes read as replacement characters.
+        CHECK(TextEncoding::ToUtf8(wide) == TextEncoding::ToUtf8(TextEncoding::FromUtf8(bytes)));
+    }
+    for (int value = 0x80; value <= 0xFF; ++value) {
+        const std::string bytes(1, static_cast<char>(value));
+        CHECK(TextEncoding::ToPathBytes(TextEncoding::FromPathBytes(bytes)) == bytes);
+    }
+}
+
+#ifndef _WIN32
+// A directory whose name is not UTF-8 is reached through its wide path, as the command line does.
+void TestNativePath() {
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / "dirtree-test-\xff\xfe";
+    std::filesystem::create_directories(directory);
+    std::ofstream(directory / "file").put('x');
+
+    const std::wstring wide = FromNativePath(directory);
+    CHECK(ToNativePath(wide) == directory);
+    CHECK(std::filesystem::exists(ToNativePath(wide) / "file"));
+    std::filesystem::remove_all(directory);
+}
+#endif
+}
+
+int main() {
+    TestValidText();
+    TestInvalidBytes();
+#ifndef _WIN32
+    TestNativePath();
+#endif
+    return TestSupport::Result();
+}
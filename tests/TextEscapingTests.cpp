@@ -0,0 +1,99 @@
+#include "TestSupport.h"
+#include "TextEscaping.h"
+
+#include <cstddef>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace {
+// Plain per-character definitions of what the renderers escape.
+template <typename CharT>
+bool IsJsonEscape(CharT ch) {
+    const unsigned long value = static_cast<unsigned long>(static_cast<std::make_unsigned_t<CharT>>(ch));
+    return value < 0x20 || value == '"' || value == '\\' || value == '/';
+}
+
+template <typename CharT>
+bool IsXmlEscape(CharT ch) {
+    const unsigned long value = static_cast<unsigned long>(static_cast<std::make_unsigned_t<CharT>>(ch));
+    return value == '&' || value == '<' || value == '>' || value == '"' || value == '\'';
+}
+
+template <typename CharT, typename Predicate>
+size_t FindReference(const std::basic_string<CharT>& text, Predicate isEscape) {
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (isEscape(text[i])) {
+            return i;
+        }
+    }
+    return text.size();
+}
+
+template <typename CharT>
+void CheckBoth(const std::basic_string<CharT>& text) {
+    CHECK(TextEscaping::FindJsonEscape(text.data(), text.size()) == FindReference(text, IsJsonEscape<CharT>));
+    CHECK(TextEscaping::FindXmlEscape(text.data(), text.size()) == FindReference(text, IsXmlEscape<CharT>));
+}
+
+// Every length across the vector widths, with each special character at every position, so
+// the vector loops and their scalar tails are both covered.
+template <typename CharT>
+void TestEveryPosition(const std::vector<CharT>& fillers, const std::vector<CharT>& specials) {
+    for (CharT filler : fillers) {
+        for (size_t length = 0; length <= 70; ++length) {
+            std::basic_string<CharT> text(length, filler);
+            CheckBoth(text);
+            for (CharT special : specials) {
+                for (size_t position = 0; position < length; ++position) {
+                    text[position] = special;
+                    CheckBoth(text);
+                    text[position] = filler;
+                }
+            }
+        }
+    }
+}
+
+template <typename CharT>
+void TestRandom(const std::vector<CharT>& alphabet) {
+    std::mt19937 random(12345);
+    std::uniform_int_distribution<size_t> pick(0, alphabet.size() - 1);
+    std::uniform_int_distribution<size_t> length(0, 200);
+    for (int round = 0; round < 2000; ++round) {
+        std::basic_string<CharT> text(length(random), CharT());
+        for (CharT& ch : text) {
+            ch = alphabet[pick(random)];
+        }
+        CheckBoth(text);
+    }
+}
+
+void TestNarrow() {
+    // Bytes of multi-byte UTF-8 sequences are at or above 0x80 and never escaped.
+    const std::vector<char> fillers = {'a', ' ', '~', static_cast<char>(0x80), static_cast<char>(0xD0),
+                                       static_cast<char>(0xFF)};
+    const std::vector<char> specials = {'"', '\\', '/', '\0', '\n', static_cast<char>(0x1F), '&', '<', '>', '\''};
+    TestEveryPosition(fillers, specials);
+    TestRandom(std::vector<char>{'a', 'z', ' ', '"', '/', '&', '\t', static_cast<char>(0x7F), static_cast<char>(0xC3),
+                                 static_cast<char>(0xA9)});
+}
+
+void TestWide() {
+    // Units whose low byte alone would be special must not match: 0x0122 is not '"'.
+    const std::vector<wchar_t> fillers = {L'a', static_cast<wchar_t>(0x0122), static_cast<wchar_t>(0x263C),
+                                          static_cast<wchar_t>(0xFF3C), static_cast<wchar_t>(0xD83D)};
+    const std::vector<wchar_t> specials = {L'"', L'\\', L'/', L'\0', L'\n', static_cast<wchar_t>(0x1F), L'&', L'<',
+                                           L'>', L'\''};
+    TestEveryPosition(fillers, specials);
+    TestRandom(std::vector<wchar_t>{L'a', L'"', L'<', L'\'', static_cast<wchar_t>(0x0126), static_cast<wchar_t>(0x2F00),
+                                    static_cast<wchar_t>(0x0410), static_cast<wchar_t>(0x1F)});
+}
+}
+
+int main() {
+    TestNarrow();
+    TestWide();
+    return TestSupport::Result();
+}
@@ -0,0 +1,199 @@
+#include "TestSupport.h"
+#include "DirectoryReader.h"
+#include "TreeDiff.h"
+#include "TreeModel.h"
+#include "TreeOutputSink.h"
+#include "TreeRenderer.h"
+#include "TreeSnapshot.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+// One result node as "path change", with '/' after directories and the change as + - ~ or a
+// space, listed in pre-order.
+std::vector<std::wstring> Describe(const TreeDiff& diff) {
+    std::vector<std::wstring> lines;
+    if (diff.Empty()) {
+        return lines;
+    }
+
+    struct Frame {
+        uint32_t node;
+        std::wstring path;
+    };
+    std::vector<Frame> stack{Frame{diff.Root(), L""}};
+    while (!stack.empty()) {
+        const Frame frame = stack.back();
+        stack.pop_back();
+        const TreeNode& node = diff.Node(frame.node);
+        const std::wstring path = frame.path + FromName(diff.Name(frame.node)) + (node.isDirectory ? L"/" : L"");
+        static const wchar_t kMarks[] = {L' ', L'+', L'-', L'~'};
+        lines.push_back(path + L" " + kMarks[static_cast<int>(diff.Change(frame.node))]);
+
+        std::vector<uint32_t> children;
+        for (uint32_t child = node.firstChild; child != TreeDiff::kNoNode; child = diff.Node(child).nextSibling) {
+            children.push_back(child);
+        }
+        for (auto it = children.rbegin(); it != children.rend(); ++it) {
+            stack.push_back(Frame{*it, path});
+        }
+    }
+    return lines;
+}
+
+// root/ { a/ { x }, c/ { y }, b, e }
+TreeModel OldTree() {
+    TreeModel model;
+    const uint32_t root = model.AddRoot(ToName(L"root"), true);
+    const uint32_t a = model.AddChild(root, TreeModel::kNoNode, ToName(L"a"), true);
+    const uint32_t c = model.AddChild(root, a, ToName(L"c"), true);
+    const uint32_t b = model.AddChild(root, c, ToName(L"b"), false);
+    model.AddChild(root, b, ToName(L"e"), false);
+    model.AddChild(a, TreeModel::kNoNode, ToName(L"x"), false);
+    model.AddChild(c, TreeModel::kNoNode, ToName(L"y"), false);
+    return model;
+}
+
+// root/ { a/ { x, z }, d/ { w }, c, e }: z and d/ added, b removed, c turned into a file.
+TreeModel NewTree() {
+    TreeModel model;
+    const uint32_t root = model.AddRoot(ToName(L"root"), true);
+    const uint32_t a = model.AddChild(root, TreeModel::kNoNode, ToName(L"a"), true);
+    const uint32_t d = model.AddChild(root, a, ToName(L"d"), true);
+    const uint32_t c = model.AddChild(root, d, ToName(L"c"), false);
+    model.AddChild(root, c, ToName(L"e"), false);
+    const uint32_t x = model.AddChild(a, TreeModel::kNoNode, ToName(L"x"), false);
+    model.AddChild(a, x, ToName(L"z"), false);
+    model.AddChild(d, TreeModel::kNoNode, ToName(L"w"), false);
+    return model;
+}
+
+void TestChanges() {
+    TreeDiff diff;
+    diff.Compare(OldTree(), NewTree());
+    CHECK(diff.HasChanges());
+    CHECK(diff.AddedCount() == 3);
+    CHECK(diff.RemovedCount() == 1);
+    CHECK(diff.TypeChangedCount() == 1);
+
+    // Unchanged e and the unchanged x leave no trace; a/ only leads to z.
+    const std::vector<std::wstring> expected = {
+        L"root/  ", L"root/a/  ", L"root/a/z +", L"root/d/ +", L"root/d/w +", L"root/b -", L"root/c ~",
+    };
+    CHECK(Describe(diff) == expected);
+}
+
+void TestTypeChangeToDirectory() {
+    TreeDiff diff;
+    diff.Compare(NewTree(), OldTree());
+    // c is a directory again and comes back with its child; the rest is the mirror image.
+    const std::vector<std::wstring> expected = {
+        L"root/  ", L"root/a/  ", L"root/a/z -", L"root/c/ ~", L"root/c/y +", L"root/d/ -", L"root/d/w -",
+        L"root/b +",
+    };
+    CHECK(Describe(diff) == expected);
+    CHECK(diff.AddedCount() == 2);
+    CHECK(diff.RemovedCount() == 3);
+    CHECK(diff.TypeChangedCount() == 1);
+}
+
+void TestSymlinkTypeChange() {
+    TreeModel before;
+    const uint32_t root = before.AddRoot(ToName(L"root"), true);
+    before.AddChild(root, TreeModel::kNoNode, ToName(L"link"), false);
+    TreeModel after;
+    after.AddChild(after.AddRoot(ToName(L"root"), true), TreeModel::kNoNode, ToName(L"link"), false, true);
+
+    TreeDiff diff;
+    diff.Compare(before, after);
+    CHECK(diff.TypeChangedCount() == 1);
+    CHECK(diff.AddedCount() + diff.RemovedCount() == 0);
+}
+
+void TestNoChanges() {
+    TreeDiff diff;
+    diff.Compare(NewTree(), NewTree());
+    CHECK(!diff.HasChanges());
+    CHECK(diff.Size() == 1);
+}
+
+std::wstring Render(const TreeDiff& diff, TreeFormat format) {
+    std::wstring text;
+    StringOutputSink sink(text);
+    std::unique_ptr<TreeRenderer> renderer = TreeRenderer::Create(format, sink);
+    renderer->RenderModel(diff);
+    renderer->Flush();
+    return text;
+}
+
+// Text trees whose loop/ leads back to the root: its children are listed by the text view only.
+TreeModel LoopTree(bool withNewFile) {
+    TreeModel model;
+    const uint32_t root = model.AddRoot(ToName(L"root"), true);
+    const uint32_t loop = model.AddChild(root, TreeModel::kNoNode, ToName(L"loop"), true, true);
+    const uint32_t inner = model.AddChild(loop, TreeModel::kNoNode, ToName(L"loop"), true, true);
+    model.SetTextOnlyChildren(loop);
+    if (withNewFile) {
+        model.AddChild(loop, inner, ToName(L"new"), false);
+        model.AddChild(root, loop, ToName(L"new"), false);
+    }
+    return model;
+}
+
+void TestTextOnlyChildren() {
+    TreeDiff diff;
+    diff.Compare(LoopTree(false), LoopTree(true));
+    const std::vector<std::wstring> expected = {L"root/  ", L"root/loop/  ", L"root/loop/new +", L"root/new +"};
+    CHECK(Describe(diff) == expected);
+    const uint32_t loop = diff.Node(diff.Root()).firstChild;
+    CHECK(diff.Node(loop).textOnlyChildren);
+
+    // The text view shows the change below the link, the structured formats stop at it as they
+    // do for the trees themselves.
+    CHECK(Render(diff, TreeFormat::TEXT).find(L"loop/") != std::wstring::npos);
+    const std::wstring json = Render(diff, TreeFormat::JSON);
+    CHECK(json.find(L"\"new\"") == json.rfind(L"\"new\""));
+    const std::wstring xml = Render(diff, TreeFormat::XML);
+    CHECK(xml.find(L"\"new\"") != std::wstring::npos);
+    CHECK(xml.find(L"\"new\"") == xml.rfind(L"\"new\""));
+
+    // A removed subtree keeps the marks of the tree it was removed from.
+    diff.Compare(LoopTree(true), TreeModel());
+    CHECK(diff.Node(diff.Node(diff.Root()).firstChild).textOnlyChildren);
+}
+
+void TestSnapshotSides() {
+    const std::wstring fileName = FromNativePath(std::filesystem::temp_directory_path() / "dirtree-test-diff.snap");
+    std::wstring error;
+    CHECK(TreeSnapshot::Save(fileName, OldTree(), TreeSnapshotInfo(), error));
+    TreeSnapshot snapshot;
+    CHECK(snapshot.Open(fileName, error));
+
+    TreeDiff fromModels;
+    fromModels.Compare(OldTree(), NewTree());
+    TreeDiff fromSnapshot;
+    fromSnapshot.Compare(snapshot, NewTree());
+    CHECK(Describe(fromSnapshot) == Describe(fromModels));
+
+    TreeDiff bothSnapshots;
+    bothSnapshots.Compare(snapshot, snapshot);
+    CHECK(!bothSnapshots.HasChanges());
+
+    snapshot.Close();
+    std::filesystem::remove(ToNativePath(fileName));
+}
+}
+
+int main() {
+    TestChanges();
+    TestTypeChangeToDirectory();
+    TestSymlinkTypeChange();
+    TestNoChanges();
+    TestTextOnlyChildren();
+    TestSnapshotSides();
+    return TestSupport::Result();
+}
@@ -0,0 +1,223 @@
+#include "TestSupport.h"
+#include "DirectoryReader.h"
+#include "TreeModel.h"
+#include "TreeOutputSink.h"
+#include "TreeRenderer.h"
+#include "TreeSnapshot.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+// Fixed by the file format; the node table follows the header directly.
+constexpr size_t kHeaderSize = 80;
+
+std::wstring TempFile(const char* name) {
+    return FromNativePath(std::filesystem::temp_directory_path() / name);
+}
+
+std::vector<char> ReadFile(const std::wstring& fileName) {
+    std::ifstream file(ToNativePath(fileName), std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+void WriteFile(const std::wstring& fileName, const std::vector<char>& bytes) {
+    std::ofstream file(ToNativePath(fileName), std::ios::binary | std::ios::trunc);
+    file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+}
+
+// root/
+// ├── a/          with one file
+// ├── loop/       a link back to the root, its children listed by the text view only
+// ├── b.txt
+// └── имя
+TreeModel SampleModel() {
+    TreeModel model;
+    const uint32_t root = model.AddRoot(ToName(L"root"), true);
+    const uint32_t a = model.AddChild(root, TreeModel::kNoNode, ToName(L"a"), true);
+    const uint32_t loop = model.AddChild(root, a, ToName(L"loop"), true, true);
+    const uint32_t file = model.AddChild(root, loop, ToName(L"b.txt"), false);
+    model.AddChild(root, file, ToName(L"имя"), false);
+    model.AddChild(a, TreeModel::kNoNode, ToName(L"inner"), false);
+    model.AddChild(loop, TreeModel::kNoNode, ToName(L"a"), true);
+    model.SetTextOnlyChildren(loop);
+    return model;
+}
+
+// SampleModel() with the nodes appended in another order, as a parallel scan may do.
+TreeModel ShuffledSampleModel() {
+    TreeModel model;
+    const uint32_t root = model.AddRoot(ToName(L"root"), true);
+    const uint32_t loop = model.AddChild(root, TreeModel::kNoNode, ToName(L"loop"), true, true);
+    model.AddChild(loop, TreeModel::kNoNode, ToName(L"a"), true);
+    model.SetTextOnlyChildren(loop);
+    const uint32_t a = model.AddChild(root, TreeModel::kNoNode, ToName(L"a"), true);
+    const uint32_t file = model.AddChild(root, loop, ToName(L"b.txt"), false);
+    model.AddChild(a, TreeModel::kNoNode, ToName(L"inner"), false);
+    model.AddChild(root, file, ToName(L"имя"), false);
+    return model;
+}
+
+// Walks both trees side by side; indices may differ, structure and names may not.
+void CheckSameTree(const TreeModel& model, uint32_t modelNode, const TreeSnapshot& snapshot, uint32_t snapshotNode) {
+    const TreeNode& expected = model.Node(modelNode);
+    const SnapshotNode& actual = snapshot.Node(snapshotNode);
+    CHECK(model.Name(modelNode) == snapshot.Name(snapshotNode));
+    CHECK(expected.isDirectory == actual.IsDirectory());
+    CHECK(expected.isSymlink == actual.IsSymlink());
+    CHECK(expected.textOnlyChildren == actual.HasTextOnlyChildren());
+
+    uint32_t modelChild = expected.firstChild;
+    uint32_t snapshotChild = actual.firstChild;
+    while (modelChild != TreeModel::kNoNode && snapshotChild != TreeSnapshot::kNoNode) {
+        CHECK(snapshot.Node(snapshotChild).parent == snapshotNode);
+        CheckSameTree(model, modelChild, snapshot, snapshotChild);
+        modelChild = model.Node(modelChild).nextSibling;
+        snapshotChild = snapshot.Node(snapshotChild).nextSibling;
+    }
+    CHECK(modelChild == TreeModel::kNoNode);
+    CHECK(snapshotChild == TreeSnapshot::kNoNode);
+}
+
+template <typename Tree>
+std::wstring Render(const Tree& tree, TreeFormat format) {
+    std::wstring text;
+    StringOutputSink sink(text);
+    std::unique_ptr<TreeRenderer> renderer = TreeRenderer::Create(format, sink);
+    renderer->RenderModel(tree);
+    renderer->Flush();
+    return text;
+}
+
+void TestRoundTrip() {
+    const TreeModel model = SampleModel();
+    TreeSnapshotInfo info;
+    info.rootPath = L"/data/корень";
+    info.maxDepth = 3;
+    info.format = TreeFormat::JSON;
+    info.expandSymlinks = true;
+    info.createdTime = 1700000000;
+
+    const std::wstring fileName = TempFile("dirtree-test-roundtrip.snap");
+    std::wstring error;
+    CHECK(TreeSnapshot::Save(fileName, model, info, error));
+
+    TreeSnapshot snapshot;
+    CHECK(snapshot.Open(fileName, error));
+    CHECK(snapshot.Size() == model.Size());
+    CHECK(snapshot.Info().rootPath == info.rootPath);
+    CHECK(snapshot.Info().maxDepth == info.maxDepth);
+    CHECK(snapshot.Info().format == info.format);
+    CHECK(snapshot.Info().expandSymlinks == info.expandSymlinks);
+    CHECK(snapshot.Info().createdTime == info.createdTime);
+    CheckSameTree(model, model.Root(), snapshot, snapshot.Root());
+
+    for (TreeFormat format : {TreeFormat::TEXT, TreeFormat::JSON, TreeFormat::XML}) {
+        CHECK(Render(snapshot, format) == Render(model, format));
+    }
+
+    TreeModel copy;
+    snapshot.CopyTo(copy);
+    CHECK(Render(copy, TreeFormat::JSON) == Render(model, TreeFormat::JSON));
+    CheckSameTree(copy, copy.Root(), snapshot, snapshot.Root());
+
+    snapshot.Close();
+    std::filesystem::remove(ToNativePath(fileName));
+}
+
+void TestCanonicalOrder() {
+    const std::wstring first = TempFile("dirtree-test-order-1.snap");
+    const std::wstring second = TempFile("dirtree-test-order-2.snap");
+    std::wstring error;
+    CHECK(TreeSnapshot::Save(first, SampleModel(), TreeSnapshotInfo(), error));
+    CHECK(TreeSnapshot::Save(second, ShuffledSampleModel(), TreeSnapshotInfo(), error));
+    CHECK(ReadFile(first) == ReadFile(second));
+
+    // Pre-order: every node follows the one before it in the text view.
+    TreeSnapshot snapshot;
+    CHECK(snapshot.Open(second, error));
+    const std::vector<std::wstring> expected = {L"root", L"a", L"inner", L"loop", L"a", L"b.txt", L"имя"};
+    CHECK(snapshot.Size() == expected.size());
+    for (uint32_t i = 0; i < snapshot.Size() && i < expected.size(); ++i) {
+        CHECK(snapshot.Name(i) == ToName(expected[i]));
+    }
+    const TreeModel shuffled = ShuffledSampleModel();
+    CheckSameTree(shuffled, shuffled.Root(), snapshot, snapshot.Root());
+
+    snapshot.Close();
+    std::filesystem::remove(ToNativePath(first));
+    std::filesystem::remove(ToNativePath(second));
+}
+
+void TestEmptyModel() {
+    const std::wstring fileName = TempFile("dirtree-test-empty.snap");
+    std::wstring error;
+    CHECK(TreeSnapshot::Save(fileName, TreeModel(), TreeSnapshotInfo(), error));
+    TreeSnapshot snapshot;
+    CHECK(snapshot.Open(fileName, error));
+    CHECK(snapshot.Empty());
+    CHECK(snapshot.Root() == TreeSnapshot::kNoNode);
+    snapshot.Close();
+    std::filesystem::remove(ToNativePath(fileName));
+}
+
+void TestRejectsDamagedFiles() {
+    const std::wstring fileName = TempFile("dirtree-test-damaged.snap");
+    std::wstring error;
+    CHECK(TreeSnapshot::Save(fileName, SampleModel(), TreeSnapshotInfo(), error));
+    const std::vector<char> original = ReadFile(fileName);
+    CHECK(original.size() > kHeaderSize + 2 * sizeof(SnapshotNode));
+
+    TreeSnapshot snapshot;
+    std::vector<char> bytes = original;
+    bytes[0] = 'X';
+    WriteFile(fileName, bytes);
+    CHECK(!snapshot.Open(fileName, error));
+
+    // Cut inside the string pool.
+    bytes = original;
+    bytes.resize(bytes.size() - 3);
+    WriteFile(fileName, bytes);
+    CHECK(!snapshot.Open(fileName, error));
+
+    // Cut inside the header.
+    bytes.resize(40);
+    WriteFile(fileName, bytes);
+    CHECK(!snapshot.Open(fileName, error));
+
+    // The second node names itself as its parent, which would make walks loop.
+    bytes = original;
+    const uint32_t selfParent = 1;
+    std::memcpy(bytes.data() + kHeaderSize + sizeof(SnapshotNode) + offsetof(SnapshotNode, parent), &selfParent,
+                sizeof(selfParent));
+    WriteFile(fileName, bytes);
+    CHECK(!snapshot.Open(fileName, error));
+
+    // A name reaching past the pool.
+    bytes = original;
+    const uint32_t longName = 0x7FFFFFFF;
+    std::memcpy(bytes.data() + kHeaderSize + offsetof(SnapshotNode, nameLength), &longName, sizeof(longName));
+    WriteFile(fileName, bytes);
+    CHECK(!snapshot.Open(fileName, error));
+
+    WriteFile(fileName, original);
+    CHECK(snapshot.Open(fileName, error));
+    snapshot.Close();
+    std::filesystem::remove(ToNativePath(fileName));
+}
+}
+
+int main() {
+    TestRoundTrip();
+    TestCanonicalOrder();
+    TestEmptyModel();
+    TestRejectsDamagedFiles();
+    return TestSupport::Result();
+}